@@ -0,0 +1,139 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#include "SharedFrameRing.hpp"
+
+// Example reader of the shared memory export (CaptureFormat::SharedMemory in slime-viz).
+// Follows the newest frame, reads it in place and checks that the stream is consistent:
+// usage: slime-viz-consumer [ring name] [seconds]
+
+#ifdef _WIN32
+constexpr const char* DEFAULT_RING_NAME = "Local\\slime-viz-trail";
+#else
+constexpr const char* DEFAULT_RING_NAME = "/slime-viz-trail";
+#endif
+
+size_t getBytesPerFrame(SharedFrameFormat format, uint32_t width, uint32_t height) {
+	auto pixelCount = static_cast<size_t>(width) * height;
+	switch (format) {
+	case SharedFrameFormat::R32f:
+	case SharedFrameFormat::Rgba8:
+		return pixelCount * 4;
+	case SharedFrameFormat::Yuv420:
+		return pixelCount + 2 * static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+	default:
+		return 0;
+	}
+}
+
+// mean of the trail intensity or the first channel, straight from the mapped slot
+double getMeanValue(const SharedSlotHeader& slot, const uint8_t* data) {
+	auto pixelCount = static_cast<size_t>(slot.width) * slot.height;
+	double sum = 0.0;
+	if (slot.format == SharedFrameFormat::R32f) {
+		auto values = reinterpret_cast<const float*>(data);
+		for (size_t i = 0; i < pixelCount; i++) {
+			sum += values[i];
+		}
+		return sum / pixelCount;
+	}
+	auto stride = slot.format == SharedFrameFormat::Rgba8 ? 4 : 1;
+	for (size_t i = 0; i < pixelCount; i++) {
+		sum += data[i * stride];
+	}
+	return sum / pixelCount / 255.0;
+}
+
+int main(int argc, char** argv) {
+	std::string name = argc > 1 ? argv[1] : DEFAULT_RING_NAME;
+	double seconds = argc > 2 ? atof(argv[2]) : 10.0;
+
+	SharedFrameRing ring;
+	auto openResult = ring.open(name);
+	if (!openResult) {
+		printf(openResult.error().c_str());
+		return -1;
+	}
+	auto &header = ring.getHeader();
+	printf("%s: %i slots of %llu bytes\n", name.c_str(), ring.getSlotCount(), static_cast<unsigned long long>(header.slotCapacity));
+
+	uint64_t framesRead = 0, framesSkipped = 0, tornReads = 0, overwrittenReads = 0, invalidFrames = 0;
+	uint64_t lastFrame = 0;
+	bool hasLastFrame = false;
+	double meanValue = 0.0;
+
+	auto start = std::chrono::steady_clock::now();
+	auto lastReport = start;
+	while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds) {
+		auto published = header.publishedFrames.load(std::memory_order_acquire);
+		if (published == 0 || (hasLastFrame && published - 1 == lastFrame)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		auto frame = published - 1;
+		auto slotIndex = static_cast<int>(frame % ring.getSlotCount());
+		uint32_t sequence;
+		if (!ring.beginRead(slotIndex, sequence)) {
+			tornReads++;
+			continue;
+		}
+
+		// a copy of the slot header, the frame data itself is only read in place
+		auto &sharedSlot = ring.getSlot(slotIndex);
+		SharedSlotHeader slot{};
+		slot.format = sharedSlot.format;
+		slot.width = sharedSlot.width;
+		slot.height = sharedSlot.height;
+		slot.frame = sharedSlot.frame;
+		slot.dataSize = sharedSlot.dataSize;
+
+		auto slotFrame = slot.frame;
+		auto expectedSize = getBytesPerFrame(slot.format, slot.width, slot.height);
+		auto valid = expectedSize != 0 && slot.dataSize == expectedSize && slot.dataSize <= header.slotCapacity;
+		auto value = valid && slotFrame == frame ? getMeanValue(slot, ring.getSlotData(slotIndex)) : 0.0;
+
+		if (!ring.endRead(slotIndex, sequence)) {
+			tornReads++;
+			continue;
+		}
+		if (slotFrame != frame) {
+			// the writer lapped the ring between reading the count and the slot
+			overwrittenReads++;
+			continue;
+		}
+		if (!valid) {
+			invalidFrames++;
+			printf("frame %llu: size %ux%u, format %u and %llu bytes don't match\n", static_cast<unsigned long long>(frame),
+					slot.width, slot.height, static_cast<uint32_t>(slot.format), static_cast<unsigned long long>(slot.dataSize));
+		}
+		else if (hasLastFrame && frame < lastFrame) {
+			invalidFrames++;
+			printf("frame %llu arrived after frame %llu\n", static_cast<unsigned long long>(frame), static_cast<unsigned long long>(lastFrame));
+		}
+
+		if (hasLastFrame && frame > lastFrame) {
+			framesSkipped += frame - lastFrame - 1;
+		}
+		lastFrame = frame;
+		hasLastFrame = true;
+		framesRead++;
+		meanValue = value;
+
+		auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration<double>(now - lastReport).count() >= 1.0) {
+			printf("frame %llu: %ux%u, mean %.4f\n", static_cast<unsigned long long>(frame), slot.width, slot.height, meanValue);
+			lastReport = now;
+		}
+	}
+
+	printf("read %llu frames, skipped %llu, %llu torn and %llu overwritten reads retried, %llu dropped by the writer, %llu invalid\n",
+			static_cast<unsigned long long>(framesRead), static_cast<unsigned long long>(framesSkipped),
+			static_cast<unsigned long long>(tornReads), static_cast<unsigned long long>(overwrittenReads),
+			static_cast<unsigned long long>(header.droppedFrames.load()), static_cast<unsigned long long>(invalidFrames));
+	return invalidFrames == 0 ? 0 : 1;
+}
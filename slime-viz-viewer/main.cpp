@@ -0,0 +1,270 @@
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "StreamProtocol.hpp"
+
+// Viewer for the frame stream of slime-viz (CaptureFormat::Stream).
+// usage: slime-viz-viewer [address], the address as given to slime-viz, "localhost:7878" by default
+
+constexpr int WINDOW_WIDTH = 1000;
+constexpr int WINDOW_HEIGHT = 1000;
+
+const char* vertexShaderSource = R"(#version 330 core
+out vec2 textureCoordinate;
+void main() {
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	textureCoordinate = corner;
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char* fragmentShaderSource = R"(#version 330 core
+in vec2 textureCoordinate;
+out vec4 color;
+uniform sampler2D frame;
+void main() {
+	color = texture(frame, textureCoordinate);
+}
+)";
+
+// the receiving thread decodes into this, the render loop uploads and acks it
+struct ViewerFrame {
+	std::mutex mutex;
+	std::vector<uint32_t> pixels;
+	int width = 0;
+	int height = 0;
+	uint32_t frame = 0;
+	bool updated = false;
+	uint64_t receivedBytes = 0;
+	uint64_t receivedFrames = 0;
+};
+
+bool applyTiles(const std::vector<uint8_t>& payload, uint32_t tileCount, int width, int height, std::vector<uint32_t>& pixels) {
+	std::vector<uint32_t> tile(STREAM_TILE_SIZE * STREAM_TILE_SIZE);
+	size_t offset = 0;
+	for (uint32_t i = 0; i < tileCount; i++) {
+		if (offset + STREAM_TILE_HEADER_SIZE > payload.size()) {
+			return false;
+		}
+		auto x0 = static_cast<int>(readU16(&payload[offset])) * STREAM_TILE_SIZE;
+		auto y0 = static_cast<int>(readU16(&payload[offset + 2])) * STREAM_TILE_SIZE;
+		auto encodedSize = readU32(&payload[offset + 4]);
+		offset += STREAM_TILE_HEADER_SIZE;
+		if (x0 >= width || y0 >= height || offset + encodedSize > payload.size()) {
+			return false;
+		}
+
+		auto tileWidth = std::min(STREAM_TILE_SIZE, width - x0);
+		auto tileHeight = std::min(STREAM_TILE_SIZE, height - y0);
+		if (!decodeRle(&payload[offset], encodedSize, tile.data(), static_cast<size_t>(tileWidth) * tileHeight)) {
+			return false;
+		}
+		for (int y = 0; y < tileHeight; y++) {
+			std::copy_n(tile.data() + y * tileWidth, tileWidth, pixels.begin() + static_cast<size_t>(y0 + y) * width + x0);
+		}
+		offset += encodedSize;
+	}
+	return offset == payload.size();
+}
+
+void receiveFrames(SocketHandle socket, ViewerFrame& viewerFrame, std::atomic<bool>& connected) {
+	std::vector<uint32_t> pixels{};
+	int width = 0, height = 0;
+	std::vector<uint8_t> payload{};
+
+	while (connected) {
+		uint8_t header[STREAM_FRAME_HEADER_SIZE];
+		if (!receiveAll(socket, header, sizeof(header))) {
+			break;
+		}
+		if (readU32(header) != STREAM_FRAME_MAGIC) {
+			printf("stream is out of sync\n");
+			break;
+		}
+		auto frame = readU32(header + 4);
+		auto frameWidth = static_cast<int>(readU16(header + 8));
+		auto frameHeight = static_cast<int>(readU16(header + 10));
+		auto tileCount = readU32(header + 12);
+		payload.resize(readU32(header + 16));
+		if (!receiveAll(socket, payload.data(), payload.size())) {
+			break;
+		}
+
+		if (frameWidth != width || frameHeight != height) {
+			width = frameWidth;
+			height = frameHeight;
+			pixels.assign(static_cast<size_t>(width) * height, 0);
+		}
+		if (!applyTiles(payload, tileCount, width, height, pixels)) {
+			printf("frame %u has malformed tiles\n", frame);
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock (viewerFrame.mutex);
+		viewerFrame.pixels = pixels;
+		viewerFrame.width = width;
+		viewerFrame.height = height;
+		viewerFrame.frame = frame;
+		viewerFrame.updated = true;
+		viewerFrame.receivedBytes += sizeof(header) + payload.size();
+		viewerFrame.receivedFrames++;
+	}
+	connected = false;
+}
+
+expected<unsigned int, std::string> buildProgram() {
+	unsigned int shaders[2];
+	const char* sources[2] = { vertexShaderSource, fragmentShaderSource };
+	GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	auto program = glCreateProgram();
+	for (int i = 0; i < 2; i++) {
+		shaders[i] = glCreateShader(types[i]);
+		glShaderSource(shaders[i], 1, &sources[i], nullptr);
+		glCompileShader(shaders[i]);
+		int success;
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+		if (!success) {
+			char infoLog[512];
+			glGetShaderInfoLog(shaders[i], 512, nullptr, infoLog);
+			return make_unexpected(std::string("viewer shader compilation failed\n") + infoLog);
+		}
+		glAttachShader(program, shaders[i]);
+	}
+	glLinkProgram(program);
+	for (auto shader : shaders) {
+		glDeleteShader(shader);
+	}
+	return program;
+}
+
+int main(int argc, char** argv) {
+	std::string address = argc > 1 ? argv[1] : "localhost:7878";
+
+	if (!initializeSockets()) {
+		printf("socket initialization failed\n");
+		return -1;
+	}
+	auto socket = openSocket(address, false);
+	if (!socket) {
+		printf(socket.error().c_str());
+		return -1;
+	}
+
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	const auto window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "slime-viz viewer", nullptr, nullptr);
+	if (window == 0) {
+		printf("GLFW init failed\n");
+		return -1;
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(1);
+
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+		printf("GLAD init failed\n");
+		return -1;
+	}
+
+	auto program = buildProgram();
+	if (!program) {
+		printf(program.error().c_str());
+		return -1;
+	}
+
+	unsigned int VAO;
+	glGenVertexArrays(1, &VAO);
+
+	unsigned int texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	ViewerFrame viewerFrame;
+	std::atomic<bool> connected (true);
+	std::thread receiveThread(receiveFrames, *socket, std::ref(viewerFrame), std::ref(connected));
+
+	int textureWidth = 0, textureHeight = 0;
+	double lastReportTime = glfwGetTime();
+	uint64_t lastReportBytes = 0, lastReportFrames = 0;
+
+	while (!glfwWindowShouldClose(window) && connected) {
+		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+			glfwSetWindowShouldClose(window, true);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock (viewerFrame.mutex);
+			if (viewerFrame.updated) {
+				glBindTexture(GL_TEXTURE_2D, texture);
+				if (viewerFrame.width != textureWidth || viewerFrame.height != textureHeight) {
+					textureWidth = viewerFrame.width;
+					textureHeight = viewerFrame.height;
+					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, textureWidth, textureHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+				}
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, textureWidth, textureHeight, GL_RGBA, GL_UNSIGNED_BYTE, viewerFrame.pixels.data());
+				viewerFrame.updated = false;
+
+				// the ack lets the server send the next frame, so the stream runs at the pace frames are shown here
+				std::vector<uint8_t> ack{};
+				appendU32(ack, STREAM_ACK_MAGIC);
+				appendU32(ack, viewerFrame.frame);
+				sendAll(*socket, ack.data(), ack.size());
+			}
+
+			auto now = glfwGetTime();
+			if (now - lastReportTime >= 1.0) {
+				auto frames = viewerFrame.receivedFrames - lastReportFrames;
+				auto bytes = viewerFrame.receivedBytes - lastReportBytes;
+				char title[128];
+				snprintf(title, sizeof(title), "slime-viz viewer - %.0f frames/s, %.1f KB per frame",
+						frames / (now - lastReportTime), frames == 0 ? 0.0 : bytes / 1024.0 / frames);
+				glfwSetWindowTitle(window, title);
+				lastReportTime = now;
+				lastReportFrames = viewerFrame.receivedFrames;
+				lastReportBytes = viewerFrame.receivedBytes;
+			}
+		}
+
+		int windowWidth, windowHeight;
+		glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		if (textureWidth > 0) {
+			auto scale = std::min(static_cast<float>(windowWidth) / textureWidth, static_cast<float>(windowHeight) / textureHeight);
+			auto viewportWidth = static_cast<int>(textureWidth * scale);
+			auto viewportHeight = static_cast<int>(textureHeight * scale);
+			glViewport((windowWidth - viewportWidth) / 2, (windowHeight - viewportHeight) / 2, viewportWidth, viewportHeight);
+
+			glUseProgram(*program);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glBindVertexArray(VAO);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+
+		glfwSwapBuffers(window);
+		glfwPollEvents();
+	}
+
+	connected = false;
+	shutdownSocket(*socket);
+	receiveThread.join();
+	closeSocket(*socket);
+
+	glfwTerminate();
+	return 0;
+}
@@ -1,19 +1,70 @@
 #ifndef APPLICATION_BASE_HPP
 #define APPLICATION_BASE_HPP
 
+#include <string>
+#include <cstdint>
+#include <vector>
+
 #include "expected.hpp"
 
+#include "Snapshot.hpp"
+
 using namespace nonstd;
 
+// the GL objects holding the simulation state and a snapshot header describing them, without frame and sections
+struct StateObjects {
+	SnapshotHeader header;
+	unsigned int trailTexture;
+	unsigned int agentBuffer;
+	size_t agentBufferSize;
+	// 0 unless the agent layout is packed
+	unsigned int headingBuffer;
+	size_t headingBufferSize;
+};
+
 class ApplicationBase {
 public:
-	virtual int getWindowWidth() = 0;
-	virtual int getWindowHeight() = 0;
+	// resolution of the simulation grid, independent of the window it is presented in
+	virtual int getGridWidth() = 0;
+	virtual int getGridHeight() = 0;
+	// resolution of the display texture, the grid size unless the grid is larger than a texture can be
+	virtual int getDisplayWidth() = 0;
+	virtual int getDisplayHeight() = 0;
 	virtual void setupTextures() = 0;
 	virtual unsigned int getMainTexture() = 0;
+	virtual unsigned int getDisplayTexture() = 0;
+	// with several display buffers, run() writes into the texture of the selected slot
+	virtual void setDisplaySlot(int slot) = 0;
 	virtual void setupSSBO() = 0;
 	virtual expected<void, std::string> setupShaders() = 0;
-	virtual void run(int frame) = 0;
+	// reallocates the grid at a new resolution, carrying the current state over
+	virtual expected<void, std::string> resizeGrid(int width, int height) = 0;
+	// writes the whole simulation state to a file, frame being the index of the next step
+	virtual expected<void, std::string> saveSnapshot(const std::string& path, int frame) = 0;
+	// replaces the state with a saved one, including its grid size; returns the frame to continue from
+	virtual expected<int, std::string> loadSnapshot(const std::string& path) = 0;
+	virtual StateObjects getStateObjects() = 0;
+	// replaces the state with data laid out like the snapshot sections, taking over the header's grid size and agent count
+	virtual expected<void, std::string> setState(const SnapshotHeader& header, const uint8_t* agents, const uint8_t* headings,
+			const uint8_t* trail) = 0;
+	// advances the simulation by steps steps, frame being the index of the first one
+	virtual void run(int frame, int steps) = 0;
+	// GPU time of a recent run(), negative until the first measurement is available
+	virtual float getGpuMilliseconds() = 0;
+	virtual void setAgentFraction(float fraction) = 0;
+	// writes the display image as planar 8-bit YUV 4:2:0 into buffer, scaling the crop rectangle (grid pixels,
+	// top left origin) to the output size, which must be a multiple of 8x2
+	virtual void convertDisplayToYuv420(unsigned int buffer, int cropX, int cropY, int cropWidth, int cropHeight,
+			int outputWidth, int outputHeight) = 0;
+	// writes the x and y positions and then the headings of agents firstAgent, firstAgent + agentStride, ... into buffer
+	// as three columns of sampleCount floats, NaN past the agent count
+	virtual void sampleAgents(unsigned int buffer, int firstAgent, int agentStride, int sampleCount) = 0;
+	// writes the colormapped trail of the rectangle (grid pixels, top left origin) into buffer as RGBA8 rows, top
+	// row first
+	virtual void renderTile(unsigned int buffer, int x, int y, int width, int height) = 0;
+	// the RGBA trail of the whole grid, bottom row first, of one ensemble member after the other. In a distributed
+	// run every process has to call it, the others get an empty vector back
+	virtual std::vector<float> gatherTrail() = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,319 @@
+#ifndef BATCH_RUNNER_HPP
+#define BATCH_RUNNER_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <memory>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+#include "expected.hpp"
+
+#include "Json.hpp"
+#include "JobFile.hpp"
+
+using namespace nonstd;
+
+// the path to start this program again with, argv0 being its first argument
+std::string getExecutablePath(const char* argv0) {
+#ifdef _WIN32
+	char path[MAX_PATH];
+	if (GetModuleFileNameA(nullptr, path, MAX_PATH) > 0) {
+		return path;
+	}
+#endif
+	return argv0;
+}
+
+// A worker process running one attempt at a job, its output appended to a log file
+class WorkerProcess {
+private:
+#ifdef _WIN32
+	HANDLE process;
+#else
+	pid_t process;
+#endif
+	int exitCode;
+
+public:
+	WorkerProcess() {
+#ifdef _WIN32
+		process = nullptr;
+#else
+		process = -1;
+#endif
+		exitCode = -1;
+	}
+
+	WorkerProcess(const WorkerProcess&) = delete;
+	WorkerProcess& operator=(const WorkerProcess&) = delete;
+
+	expected<void, std::string> start(const std::string& executable, const std::vector<std::string>& arguments, const std::string& logPath) {
+#ifdef _WIN32
+		std::string commandLine = "\"" + executable + "\"";
+		for (auto &argument : arguments) {
+			commandLine += " \"" + argument + "\"";
+		}
+		SECURITY_ATTRIBUTES inherit = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+		auto log = CreateFileA(logPath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, &inherit, OPEN_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (log == INVALID_HANDLE_VALUE) {
+			return make_unexpected("failed to open the log " + logPath + "\n");
+		}
+		STARTUPINFOA startup{};
+		startup.cb = sizeof(startup);
+		startup.dwFlags = STARTF_USESTDHANDLES;
+		startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+		startup.hStdOutput = log;
+		startup.hStdError = log;
+		PROCESS_INFORMATION information{};
+		auto created = CreateProcessA(executable.c_str(), &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr,
+				&startup, &information);
+		CloseHandle(log);
+		if (!created) {
+			return make_unexpected("failed to start " + executable + "\n");
+		}
+		CloseHandle(information.hThread);
+		process = information.hProcess;
+#else
+		std::vector<char*> argv{};
+		argv.push_back(const_cast<char*>(executable.c_str()));
+		for (auto &argument : arguments) {
+			argv.push_back(const_cast<char*>(argument.c_str()));
+		}
+		argv.push_back(nullptr);
+		process = fork();
+		if (process < 0) {
+			return make_unexpected("failed to start " + executable + "\n");
+		}
+		if (process == 0) {
+			auto log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if (log >= 0) {
+				dup2(log, STDOUT_FILENO);
+				dup2(log, STDERR_FILENO);
+				close(log);
+			}
+			execvp(executable.c_str(), argv.data());
+			_exit(127);
+		}
+#endif
+		return {};
+	}
+
+	// false while the process runs
+	bool poll() {
+#ifdef _WIN32
+		if (WaitForSingleObject(process, 0) != WAIT_OBJECT_0) {
+			return false;
+		}
+		DWORD code;
+		GetExitCodeProcess(process, &code);
+		exitCode = static_cast<int>(code);
+		CloseHandle(process);
+		process = nullptr;
+#else
+		int status;
+		if (waitpid(process, &status, WNOHANG) != process) {
+			return false;
+		}
+		// a crash reports 128 plus the signal, like shells do
+		exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		process = -1;
+#endif
+		return true;
+	}
+
+	void kill() {
+#ifdef _WIN32
+		TerminateProcess(process, 1);
+		WaitForSingleObject(process, INFINITE);
+		CloseHandle(process);
+		process = nullptr;
+#else
+		::kill(process, SIGKILL);
+		waitpid(process, nullptr, 0);
+		process = -1;
+#endif
+		exitCode = -1;
+	}
+
+	int getExitCode() {
+		return exitCode;
+	}
+};
+
+// Runs the jobs of a job file (JobFile.hpp) over a pool of worker processes, each a headless slime-viz with its own
+// GL context running a single job (see runJob() in main.cpp). A failed attempt, a crash, a non-zero exit or one
+// past the timeout, goes to the back of the queue until the job's retries are used up. When a job is done the runner
+// writes its result manifest: the status, every attempt, the job's settings and outputs and the worker's metrics
+class BatchRunner {
+private:
+	struct Attempt {
+		int exitCode;
+		double seconds;
+		bool timedOut;
+	};
+
+	struct Running {
+		int job;
+		std::unique_ptr<WorkerProcess> process;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	std::string executable;
+	std::string jobFilePath;
+	JobFile jobFile;
+	std::vector<std::vector<Attempt>> attempts;
+
+	expected<void, std::string> launch(int job, std::vector<Running>& running) {
+		auto &spec = jobFile.jobs[job];
+		FILE* log = fopen(spec.log.c_str(), attempts[job].empty() ? "w" : "a");
+		if (log != nullptr) {
+			fprintf(log, "attempt %i of %s\n", static_cast<int>(attempts[job].size()) + 1, spec.name.c_str());
+			fclose(log);
+		}
+		Running worker{ job, std::make_unique<WorkerProcess>(), std::chrono::steady_clock::now() };
+		auto started = worker.process->start(executable, { "--job", jobFilePath, std::to_string(job) }, spec.log);
+		if (!started) {
+			return started;
+		}
+		running.push_back(std::move(worker));
+		return {};
+	}
+
+	// the metrics the worker wrote, null when there are none
+	std::string readMetrics(const JobSpec& spec) {
+		if (spec.outputs.metrics.empty()) {
+			return "null";
+		}
+		std::ifstream stream (spec.outputs.metrics);
+		std::stringstream text;
+		text << stream.rdbuf();
+		auto metrics = parseJson(text.str());
+		return metrics ? toJson(*metrics) : "null";
+	}
+
+	void writeManifest(int job) {
+		auto &spec = jobFile.jobs[job];
+		auto succeeded = attempts[job].back().exitCode == 0;
+		std::string manifest = "{\n";
+		manifest += "  \"job\": " + quoteJson(spec.name) + ",\n";
+		manifest += std::string("  \"status\": ") + (succeeded ? "\"succeeded\"" : "\"failed\"") + ",\n";
+		manifest += "  \"attempts\": [";
+		for (size_t i = 0; i < attempts[job].size(); i++) {
+			auto &attempt = attempts[job][i];
+			char entry[128];
+			snprintf(entry, sizeof(entry), "%s{ \"exitCode\": %i, \"seconds\": %.3f, \"timedOut\": %s }", i > 0 ? ", " : "",
+					attempt.exitCode, attempt.seconds, attempt.timedOut ? "true" : "false");
+			manifest += entry;
+		}
+		manifest += "],\n";
+		manifest += "  \"settings\": " + toJson(spec.source) + ",\n";
+		manifest += "  \"outputs\": {";
+		std::pair<const char*, const std::string*> outputs[] = {
+			{ "snapshot", &spec.outputs.snapshot }, { "trail", &spec.outputs.trail }, { "render", &spec.outputs.render },
+			{ "metrics", &spec.outputs.metrics }
+		};
+		auto separator = "";
+		for (auto &output : outputs) {
+			if (!output.second->empty()) {
+				manifest += separator + quoteJson(output.first) + ": " + quoteJson(*output.second);
+				separator = ", ";
+			}
+		}
+		manifest += "},\n";
+		manifest += "  \"log\": " + quoteJson(spec.log) + ",\n";
+		manifest += "  \"metrics\": " + (succeeded ? readMetrics(spec) : std::string("null")) + "\n";
+		manifest += "}\n";
+
+		std::ofstream stream (spec.manifest);
+		stream << manifest;
+		if (!stream) {
+			fprintf(stderr, "writing %s failed\n", spec.manifest.c_str());
+		}
+	}
+
+	// records the attempt and queues a retry or writes the manifest, returns whether the job is done for good
+	bool finishAttempt(int job, int exitCode, double seconds, bool timedOut, std::deque<int>& queue) {
+		attempts[job].push_back({ exitCode, seconds, timedOut });
+		auto &spec = jobFile.jobs[job];
+		if (exitCode != 0 && static_cast<int>(attempts[job].size()) <= jobFile.retries) {
+			printf("%s failed with %i%s, retrying\n", spec.name.c_str(), exitCode, timedOut ? " (timed out)" : "");
+			queue.push_back(job);
+			return false;
+		}
+		printf("%s %s after %i attempt(s), see %s\n", spec.name.c_str(), exitCode == 0 ? "succeeded" : "failed",
+				static_cast<int>(attempts[job].size()), spec.manifest.c_str());
+		writeManifest(job);
+		return true;
+	}
+
+public:
+	// executable is started for every attempt with --job, the job file path and the job index
+	BatchRunner(const std::string& executable, const std::string& jobFilePath, const JobFile& jobFile)
+			: executable(executable), jobFilePath(jobFilePath), jobFile(jobFile) {
+		attempts.resize(jobFile.jobs.size());
+	}
+
+	// number of jobs that failed
+	int run() {
+		std::deque<int> queue{};
+		for (size_t job = 0; job < jobFile.jobs.size(); job++) {
+			queue.push_back(static_cast<int>(job));
+		}
+		std::vector<Running> running{};
+		auto failed = 0;
+		while (!queue.empty() || !running.empty()) {
+			while (!queue.empty() && static_cast<int>(running.size()) < jobFile.workers) {
+				auto job = queue.front();
+				queue.pop_front();
+				auto launched = launch(job, running);
+				if (!launched) {
+					fprintf(stderr, "%s", launched.error().c_str());
+					failed += finishAttempt(job, -1, 0.0, false, queue) ? 1 : 0;
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			for (auto worker = running.begin(); worker != running.end();) {
+				auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - worker->start).count();
+				auto timedOut = jobFile.timeout > 0.0 && seconds > jobFile.timeout;
+				if (timedOut) {
+					worker->process->kill();
+				}
+				else if (!worker->process->poll()) {
+					++worker;
+					continue;
+				}
+				auto exitCode = timedOut ? -1 : worker->process->getExitCode();
+				if (finishAttempt(worker->job, exitCode, seconds, timedOut, queue) && exitCode != 0) {
+					failed++;
+				}
+				worker = running.erase(worker);
+			}
+		}
+		return failed;
+	}
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "expected.hpp"
+
+#include "Snapshot.hpp"
+#include "Compression.hpp"
+
+using namespace nonstd;
+
+// Checkpoint file: a chain of records appended as the simulation runs. The first record is full, every
+// later one holds only the trail tiles that changed since the record before it, so restoring replays the
+// chain onto the full record. Every record carries all agents, they move everywhere between checkpoints.
+// A record is a header followed by compressed blocks, each a block header and shuffled PackBits data
+// (see Compression.hpp); trail tiles are RGBA32F rows of the tile, bottom first. A crash while appending
+// leaves a truncated last record, which restoring ignores. All integers are little endian.
+
+constexpr uint32_t CHECKPOINT_MAGIC = 0x4B435653; // "SVCK"
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr int CHECKPOINT_TILE_SIZE = 64;
+// agent data is split into blocks of this size so it compresses in parallel
+constexpr size_t CHECKPOINT_AGENT_BLOCK_SIZE = 4 << 20;
+
+struct CheckpointRecordHeader {
+	uint32_t magic;
+	uint32_t version;
+	// bytes of the whole record, this header included
+	uint64_t recordSize;
+	// as in SnapshotHeader
+	uint64_t frame;
+	uint32_t width;
+	uint32_t height;
+	uint32_t agentCount;
+	uint32_t agentLayout;
+	uint32_t depositMode;
+	uint32_t updateMode;
+	uint32_t agentOffset;
+	uint32_t tileSize;
+	// 1 when the record has every tile and starts a chain
+	uint32_t full;
+	uint32_t blockCount;
+	uint64_t agentBufferSize;
+	uint64_t headingBufferSize;
+};
+
+struct CheckpointBlockHeader {
+	// Agents and Headings blocks are numbered by their offset in CHECKPOINT_AGENT_BLOCK_SIZE, Trail blocks by tile
+	SnapshotSection section;
+	uint32_t index;
+	uint32_t rawSize;
+	uint32_t compressedSize;
+};
+
+// texel rectangle of a tile, tiles are numbered row by row from the bottom left
+struct CheckpointTile {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+int getCheckpointTileCount(int width, int height, int tileSize) {
+	return ((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize);
+}
+
+CheckpointTile getCheckpointTile(int index, int width, int height, int tileSize) {
+	auto tilesX = (width + tileSize - 1) / tileSize;
+	CheckpointTile tile{};
+	tile.x = index % tilesX * tileSize;
+	tile.y = index / tilesX * tileSize;
+	tile.width = std::min(tileSize, width - tile.x);
+	tile.height = std::min(tileSize, height - tile.y);
+	return tile;
+}
+
+// appends a block header and the compressed data, elementSize as for compressShuffled()
+void appendCheckpointBlock(SnapshotSection section, uint32_t index, const uint8_t* data, size_t size, int elementSize,
+		std::vector<uint8_t>& out) {
+	auto headerOffset = out.size();
+	out.resize(headerOffset + sizeof(CheckpointBlockHeader));
+	compressShuffled(data, size, elementSize, out);
+
+	CheckpointBlockHeader block{};
+	block.section = section;
+	block.index = index;
+	block.rawSize = static_cast<uint32_t>(size);
+	block.compressedSize = static_cast<uint32_t>(out.size() - headerOffset - sizeof(block));
+	memcpy(&out[headerOffset], &block, sizeof(block));
+}
+
+// the state at the newest complete record of a checkpoint file, laid out for ApplicationBase::setState()
+struct CheckpointState {
+	// no magic, version or sections
+	SnapshotHeader header;
+	std::vector<uint8_t> agents;
+	std::vector<uint8_t> headings;
+	std::vector<uint8_t> trail;
+	int recordCount;
+};
+
+expected<void, std::string> applyCheckpointRecord(const CheckpointRecordHeader& record, const std::vector<uint8_t>& data,
+		CheckpointState& state) {
+	auto width = static_cast<int>(record.width);
+	auto height = static_cast<int>(record.height);
+	auto tileSize = static_cast<int>(record.tileSize);
+	if (width <= 0 || height <= 0 || tileSize <= 0) {
+		return make_unexpected("a record has an invalid grid or tile size\n");
+	}
+	if (record.full) {
+		state.trail.assign(static_cast<size_t>(width) * height * 4 * sizeof(float), 0);
+	}
+	else if (record.width != state.header.width || record.height != state.header.height) {
+		return make_unexpected("a delta record doesn't match the grid size of the record before it\n");
+	}
+	state.agents.assign(record.agentBufferSize, 0);
+	state.headings.assign(record.headingBufferSize, 0);
+
+	std::vector<uint8_t> tile{};
+	size_t agentBytes = 0;
+	size_t offset = 0;
+	for (uint32_t i = 0; i < record.blockCount; i++) {
+		CheckpointBlockHeader block;
+		if (offset + sizeof(block) > data.size()) {
+			return make_unexpected("a record ends in the middle of a block\n");
+		}
+		memcpy(&block, &data[offset], sizeof(block));
+		offset += sizeof(block);
+		if (offset + block.compressedSize > data.size()) {
+			return make_unexpected("a record ends in the middle of a block\n");
+		}
+		auto compressed = &data[offset];
+		offset += block.compressedSize;
+
+		if (block.section == SnapshotSection::Trail) {
+			if (block.index >= static_cast<uint32_t>(getCheckpointTileCount(width, height, tileSize))) {
+				return make_unexpected("a record has a tile outside of its grid\n");
+			}
+			auto rect = getCheckpointTile(static_cast<int>(block.index), width, height, tileSize);
+			auto rowSize = static_cast<size_t>(rect.width) * 4 * sizeof(float);
+			tile.resize(rowSize * rect.height);
+			if (block.rawSize != tile.size() || !decompressShuffled(compressed, block.compressedSize, 4 * sizeof(float), tile.data(), tile.size())) {
+				return make_unexpected("a record has a corrupt tile\n");
+			}
+			for (int y = 0; y < rect.height; y++) {
+				auto trailOffset = ((static_cast<size_t>(rect.y) + y) * width + rect.x) * 4 * sizeof(float);
+				memcpy(&state.trail[trailOffset], &tile[y * rowSize], rowSize);
+			}
+			continue;
+		}
+
+		auto &target = block.section == SnapshotSection::Agents ? state.agents : state.headings;
+		auto blockOffset = static_cast<size_t>(block.index) * CHECKPOINT_AGENT_BLOCK_SIZE;
+		if ((block.section != SnapshotSection::Agents && block.section != SnapshotSection::Headings) ||
+				blockOffset > target.size() || block.rawSize > target.size() - blockOffset ||
+				!decompressShuffled(compressed, block.compressedSize, sizeof(uint32_t), &target[blockOffset], block.rawSize)) {
+			return make_unexpected("a record has a corrupt agent block\n");
+		}
+		agentBytes += block.rawSize;
+	}
+	if (offset != data.size() || agentBytes != state.agents.size() + state.headings.size()) {
+		return make_unexpected("a record's blocks don't add up to its size\n");
+	}
+
+	state.header = SnapshotHeader{};
+	state.header.width = record.width;
+	state.header.height = record.height;
+	state.header.agentCount = record.agentCount;
+	state.header.agentLayout = record.agentLayout;
+	state.header.depositMode = record.depositMode;
+	state.header.updateMode = record.updateMode;
+	state.header.frame = record.frame;
+	state.header.agentOffset = record.agentOffset;
+	state.recordCount++;
+	return {};
+}
+
+// replays the records of a checkpoint file up to the last complete one
+expected<CheckpointState, std::string> readCheckpoint(const std::string& path) {
+	auto file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		return make_unexpected("failed to open checkpoint " + path + "\n");
+	}
+
+	CheckpointState state{};
+	std::vector<uint8_t> data{};
+	while (true) {
+		CheckpointRecordHeader record;
+		if (fread(&record, sizeof(record), 1, file) != 1 || record.magic != CHECKPOINT_MAGIC ||
+				record.recordSize < sizeof(record)) {
+			break;
+		}
+		if (record.version != CHECKPOINT_VERSION) {
+			fclose(file);
+			return make_unexpected(path + " has checkpoint version " + std::to_string(record.version) +
+					", expected " + std::to_string(CHECKPOINT_VERSION) + "\n");
+		}
+		if (state.recordCount == 0 && !record.full) {
+			fclose(file);
+			return make_unexpected(path + " doesn't start with a full checkpoint\n");
+		}
+		data.resize(record.recordSize - sizeof(record));
+		if (fread(data.data(), 1, data.size(), file) != data.size()) {
+			// cut off while it was being written
+			break;
+		}
+		auto result = applyCheckpointRecord(record, data, state);
+		if (!result) {
+			fclose(file);
+			return make_unexpected(path + ": " + result.error());
+		}
+	}
+	fclose(file);
+
+	if (state.recordCount == 0) {
+		return make_unexpected(path + " has no complete checkpoint\n");
+	}
+	return state;
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef CHECKPOINTER_HPP
+#define CHECKPOINTER_HPP
+
+#include <glad/glad.h>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include "expected.hpp"
+
+#include "ApplicationBase.hpp"
+#include "Checkpoint.hpp"
+#include "StateRecorder.hpp"
+
+using namespace nonstd;
+
+struct CheckpointSettings {
+	std::string path = "slime-viz.checkpoint";
+	// seconds from the start of one checkpoint to the next
+	double interval = 60.0;
+	// every this many records a full one replaces the file, which bounds the chain a restore replays
+	int fullInterval = 32;
+	int tileSize = CHECKPOINT_TILE_SIZE;
+	int threadCount = 4;
+};
+
+// Appends incremental checkpoints to a file while the simulation runs, see Checkpoint.hpp for the format.
+// The StateRecorder makes delta records of the tiles that changed, a writer thread appends them to the
+// file, so neither the GPU, the compression nor the disk ever stall update().
+class Checkpointer {
+private:
+	struct Record {
+		bool full;
+		// the header bytes and then the blocks
+		std::vector<std::vector<uint8_t>> parts;
+	};
+
+	CheckpointSettings settings;
+	std::chrono::steady_clock::time_point lastCheckpointTime;
+	int recordsInChain;
+	// set when a record failed to write, the chain is broken and the next record must be full
+	std::atomic<bool> needsFullRecord;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable recordAvailable;
+	std::condition_variable recordWritten;
+	std::deque<Record> records;
+	bool writing;
+	bool stopping;
+	FILE* file;
+
+	// declared last so its compression jobs finish before anything they use is destroyed
+	StateRecorder recorder;
+
+	static bool writeParts(FILE* output, const Record& record) {
+		for (auto &part : record.parts) {
+			if (fwrite(part.data(), 1, part.size(), output) != part.size()) {
+				return false;
+			}
+		}
+		return fflush(output) == 0;
+	}
+
+	// a full record goes to a new file that replaces the old one once complete, deltas are appended to it
+	expected<void, std::string> writeRecord(const Record& record) {
+		if (record.full) {
+			if (file != nullptr) {
+				fclose(file);
+				file = nullptr;
+			}
+			auto temporaryPath = settings.path + ".partial";
+			auto output = fopen(temporaryPath.c_str(), "wb");
+			if (output == nullptr) {
+				return make_unexpected("failed to create checkpoint " + temporaryPath + "\n");
+			}
+			auto failed = !writeParts(output, record);
+			failed |= fclose(output) != 0;
+			if (failed) {
+				remove(temporaryPath.c_str());
+				return make_unexpected("failed to write checkpoint " + temporaryPath + "\n");
+			}
+			// rename doesn't replace an existing file on Windows
+			remove(settings.path.c_str());
+			if (rename(temporaryPath.c_str(), settings.path.c_str()) != 0) {
+				return make_unexpected("failed to move checkpoint " + temporaryPath + " to " + settings.path + "\n");
+			}
+			file = fopen(settings.path.c_str(), "ab");
+			if (file == nullptr) {
+				return make_unexpected("failed to open checkpoint " + settings.path + " for appending\n");
+			}
+			return {};
+		}
+
+		if (file == nullptr) {
+			return make_unexpected("skipped a checkpoint, there is no full one to append it to\n");
+		}
+		if (!writeParts(file, record)) {
+			// whatever part of the record made it to the file is ignored when restoring, and so are later deltas
+			fclose(file);
+			file = nullptr;
+			return make_unexpected("failed to append to checkpoint " + settings.path + "\n");
+		}
+		return {};
+	}
+
+	void writeRecords() {
+		while (true) {
+			Record record;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				recordAvailable.wait(lock, [this]() { return stopping || !records.empty(); });
+				if (records.empty()) {
+					return;
+				}
+				record = std::move(records.front());
+				records.pop_front();
+				writing = true;
+			}
+
+			auto result = writeRecord(record);
+			if (!result) {
+				needsFullRecord = true;
+				fprintf(stderr, "%s", result.error().c_str());
+			}
+
+			std::lock_guard<std::mutex> lock (mutex);
+			writing = false;
+			recordWritten.notify_all();
+		}
+	}
+
+	// called by the recorder on the GL thread
+	void queueRecord(StateRecord&& stateRecord) {
+		Record record;
+		record.full = stateRecord.header.full != 0;
+		auto headerBytes = reinterpret_cast<const uint8_t*>(&stateRecord.header);
+		record.parts.emplace_back(headerBytes, headerBytes + sizeof(stateRecord.header));
+		for (auto &block : stateRecord.blocks) {
+			record.parts.push_back(std::move(block));
+		}
+		recordsInChain = record.full ? 1 : recordsInChain + 1;
+
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			records.push_back(std::move(record));
+		}
+		recordAvailable.notify_one();
+	}
+
+public:
+	Checkpointer(const CheckpointSettings& settings = CheckpointSettings())
+		: settings(settings), needsFullRecord(false),
+		recorder(settings.tileSize, true, settings.threadCount, [this](StateRecord&& record) { queueRecord(std::move(record)); }) {
+		lastCheckpointTime = std::chrono::steady_clock::now();
+		recordsInChain = 0;
+		writing = false;
+		stopping = false;
+		file = nullptr;
+		writer = std::thread(&Checkpointer::writeRecords, this);
+	}
+
+	// writes the records still queued, then joins the writer
+	~Checkpointer() {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			stopping = true;
+		}
+		recordAvailable.notify_all();
+		writer.join();
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	Checkpointer(const Checkpointer&) = delete;
+	Checkpointer& operator=(const Checkpointer&) = delete;
+
+	// needs the GL context that update() will be called from
+	expected<void, std::string> setup() {
+		return recorder.setup();
+	}
+
+	// after run(), frame being the next step to run. Starts a checkpoint once the interval has passed and
+	// otherwise moves the one in flight on as far as the GPU and the workers allow
+	void update(ApplicationBase& application, int frame) {
+		recorder.update();
+		if (!recorder.isIdle() ||
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - lastCheckpointTime).count() < settings.interval) {
+			return;
+		}
+		lastCheckpointTime = std::chrono::steady_clock::now();
+		auto full = needsFullRecord.exchange(false) || recordsInChain == 0 || recordsInChain >= settings.fullInterval;
+		recorder.record(application, frame, full);
+	}
+
+	// completes the checkpoint in flight and waits until every record is written
+	void finish() {
+		recorder.finish();
+		std::unique_lock<std::mutex> lock (mutex);
+		recordWritten.wait(lock, [this]() { return records.empty() && !writing; });
+	}
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Byte-shuffled run-length coding for arrays of floats and other fixed-size elements.
+// Byte i of every element goes into plane i before coding, so the exponent bytes that barely change and
+// the zeros of empty trail regions turn into long runs. Runs and literals are PackBits coded: a control
+// byte n < 128 is followed by n + 1 literal elements, n >= 128 by one element repeated n - 126 times.
+// The planes are coded a byte at a time, the stream tiles of StreamProtocol.hpp a pixel at a time.
+
+// appends count elements of elementSize bytes
+void appendPackBits(const uint8_t* data, size_t count, size_t elementSize, std::vector<uint8_t>& out) {
+	auto equal = [&](size_t a, size_t b) {
+		return memcmp(data + a * elementSize, data + b * elementSize, elementSize) == 0;
+	};
+
+	size_t i = 0;
+	while (i < count) {
+		size_t run = 1;
+		while (i + run < count && run < 129 && equal(i + run, i)) {
+			run++;
+		}
+		if (run >= 2) {
+			out.push_back(static_cast<uint8_t>(run + 126));
+			out.insert(out.end(), data + i * elementSize, data + (i + 1) * elementSize);
+			i += run;
+			continue;
+		}
+
+		// literals up to the next run of at least two
+		size_t literals = 1;
+		while (i + literals < count && literals < 128 &&
+				!(i + literals + 1 < count && equal(i + literals, i + literals + 1))) {
+			literals++;
+		}
+		out.push_back(static_cast<uint8_t>(literals - 1));
+		out.insert(out.end(), data + i * elementSize, data + (i + literals) * elementSize);
+		i += literals;
+	}
+}
+
+// decodes count elements of elementSize bytes, outStride bytes apart, starting at data[in] and advancing in.
+// False when the data ends early or a run goes past count
+bool readPackBits(const uint8_t* data, size_t size, size_t& in, size_t elementSize, uint8_t* out, size_t outStride, size_t count) {
+	size_t decoded = 0;
+	while (decoded < count) {
+		if (in >= size) {
+			return false;
+		}
+		auto control = data[in++];
+		auto repeated = control >= 128;
+		size_t elements = repeated ? control - 126 : control + 1;
+		auto bytes = (repeated ? 1 : elements) * elementSize;
+		if (in + bytes > size || decoded + elements > count) {
+			return false;
+		}
+		for (size_t j = 0; j < elements; j++) {
+			memcpy(out + (decoded + j) * outStride, data + in + (repeated ? 0 : j * elementSize), elementSize);
+		}
+		in += bytes;
+		decoded += elements;
+	}
+	return true;
+}
+
+// appends the coded data to out, size must be a multiple of elementSize
+void compressShuffled(const uint8_t* data, size_t size, int elementSize, std::vector<uint8_t>& out) {
+	auto elementCount = size / elementSize;
+	std::vector<uint8_t> plane(elementCount);
+	for (int byte = 0; byte < elementSize; byte++) {
+		for (size_t i = 0; i < elementCount; i++) {
+			plane[i] = data[i * elementSize + byte];
+		}
+		appendPackBits(plane.data(), elementCount, 1, out);
+	}
+}
+
+// false when the data doesn't decode to exactly outSize bytes
+bool decompressShuffled(const uint8_t* data, size_t size, int elementSize, uint8_t* out, size_t outSize) {
+	auto elementCount = outSize / elementSize;
+	size_t in = 0;
+	for (int byte = 0; byte < elementSize; byte++) {
+		if (!readPackBits(data, size, in, 1, out + byte, elementSize, elementCount)) {
+			return false;
+		}
+	}
+	return in == size;
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef FRAME_CAPTURE_HPP
+#define FRAME_CAPTURE_HPP
+
+#include <glad/glad.h>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "expected.hpp"
+
+#include "ThreadPool.hpp"
+#include "ImageEncoding.hpp"
+#include "SharedFrameRing.hpp"
+#include "StreamServer.hpp"
+
+using namespace nonstd;
+
+enum class CaptureFormat {
+	// one PNG file per frame
+	Png,
+	// a single uncompressed YUV4MPEG2 stream, "-" writes it to stdout for piping into an encoder
+	Y4m,
+	// the newest frames in a SharedFrameRing named by the path, for other processes to map
+	SharedMemory,
+	// tile deltas to a slime-viz-viewer connected to the address in the path, see StreamServer
+	Stream
+};
+
+enum class CapturePixels {
+	// RGBA8 rows, bottom row first as OpenGL reads them
+	Rgba8,
+	// planar 8-bit YUV 4:2:0 ready for the Y4M stream, top row first
+	Yuv420,
+	// one float per texel from the red channel, bottom row first
+	R32f
+};
+
+size_t getCaptureFrameSize(CapturePixels pixels, int width, int height) {
+	auto pixelCount = static_cast<size_t>(width) * height;
+	if (pixels == CapturePixels::Yuv420) {
+		return pixelCount + 2 * static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+	}
+	return pixelCount * 4;
+}
+
+SharedFrameFormat getSharedFrameFormat(CapturePixels pixels) {
+	switch (pixels) {
+	case CapturePixels::Yuv420:
+		return SharedFrameFormat::Yuv420;
+	case CapturePixels::R32f:
+		return SharedFrameFormat::R32f;
+	default:
+		return SharedFrameFormat::Rgba8;
+	}
+}
+
+struct CaptureSettings {
+	CaptureFormat format = CaptureFormat::Png;
+	// printf pattern taking the frame number for PNG, a file name or "-" for Y4M, the ring name for shared memory,
+	// the listening address ("port", "host:port" or "unix:/path") for streaming
+	std::string path = "frame_%05d.png";
+	int framesPerSecond = 60;
+	int threadCount = 4;
+	// readbacks in flight, covers both the GPU latency and the time the encoders hold a frame
+	int ringSize = 8;
+	// frames kept in the shared memory ring and the largest frame it takes, in bytes
+	int sharedSlotCount = 4;
+	size_t sharedSlotCapacity = 0;
+};
+
+// Reads frames back through a ring of pixel pack buffers and encodes them on a thread pool.
+// capture() only records the copy into a buffer and a fence; a buffer is mapped once its fence has
+// passed, handed to an encoder as is and unmapped when the ring comes back to it. The calling thread
+// only blocks when the GPU or the encoders fall a whole ring behind.
+class FrameCapture {
+private:
+	struct Slot {
+		unsigned int buffer;
+		size_t size;
+		int width;
+		int height;
+		int frame;
+		CapturePixels pixelFormat;
+		// set while the copy into the buffer is in flight
+		GLsync fence;
+		// mapped buffer contents while an encoder reads them
+		const uint8_t* pixels;
+		// guarded by mutex
+		bool encoding;
+	};
+
+	CaptureSettings settings;
+	std::vector<Slot> slots;
+	int nextSlot;
+	int oldestReadbackSlot;
+	int frameCount;
+	// reads textures that can be larger than the captured area, like a sparse trail
+	unsigned int readFramebuffer;
+
+	std::mutex mutex;
+	std::condition_variable encodingDone;
+
+	// Y4M frames are encoded in parallel but written in order
+	FILE* output;
+	int streamWidth;
+	int streamHeight;
+	int nextWrittenFrame;
+	std::condition_variable frameWritten;
+
+	SharedFrameRing sharedRing;
+	StreamServer streamServer;
+
+	// declared last so its workers are joined before anything they use is destroyed
+	ThreadPool threadPool;
+
+	// the stream takes over the stdout file descriptor, later prints go to stderr instead
+	static FILE* takeStdout() {
+		fflush(stdout);
+#ifdef _WIN32
+		auto fd = _dup(_fileno(stdout));
+		_dup2(_fileno(stderr), _fileno(stdout));
+		_setmode(fd, _O_BINARY);
+		return _fdopen(fd, "wb");
+#else
+		auto fd = dup(fileno(stdout));
+		dup2(fileno(stderr), fileno(stdout));
+		return fdopen(fd, "wb");
+#endif
+	}
+
+	void encode(const Slot& slot) {
+		if (settings.format == CaptureFormat::SharedMemory) {
+			sharedRing.write(slot.frame, getSharedFrameFormat(slot.pixelFormat), slot.width, slot.height, slot.pixels, slot.size);
+			return;
+		}
+
+		if (slot.pixelFormat == CapturePixels::R32f) {
+			fprintf(stderr, "float frames can only be exported to shared memory\n");
+			return;
+		}
+
+		if (settings.format == CaptureFormat::Stream) {
+			if (slot.pixelFormat == CapturePixels::Rgba8) {
+				streamServer.submitFrame(slot.frame, slot.pixels, slot.width, slot.height);
+			}
+			return;
+		}
+
+		if (settings.format == CaptureFormat::Png) {
+			if (slot.pixelFormat != CapturePixels::Rgba8) {
+				fprintf(stderr, "PNG capture needs RGBA frames\n");
+				return;
+			}
+			char path[1024];
+			snprintf(path, sizeof(path), settings.path.c_str(), slot.frame);
+			auto result = writePng(path, slot.pixels, slot.width, slot.height);
+			if (!result) {
+				fprintf(stderr, "%s", result.error().c_str());
+			}
+			return;
+		}
+
+		std::vector<uint8_t> yuv{};
+		if (slot.pixelFormat == CapturePixels::Yuv420) {
+			yuv.assign(slot.pixels, slot.pixels + slot.size);
+		}
+		else {
+			convertToYuv420(slot.pixels, slot.width, slot.height, yuv);
+		}
+
+		std::unique_lock<std::mutex> lock (mutex);
+		frameWritten.wait(lock, [&]() { return nextWrittenFrame == slot.frame; });
+		auto result = writeY4mFrame(output, yuv);
+		if (!result) {
+			fprintf(stderr, "%s", result.error().c_str());
+		}
+		nextWrittenFrame++;
+		frameWritten.notify_all();
+	}
+
+	// maps the oldest readback and queues it for encoding, false when there is none or it hasn't finished
+	bool dispatchOldestReadback(bool wait) {
+		auto &slot = slots[oldestReadbackSlot];
+		if (slot.fence == nullptr) {
+			return false;
+		}
+		auto status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		slot.pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT));
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			slot.encoding = true;
+		}
+		threadPool.submit([this, &slot]() {
+			encode(slot);
+			std::lock_guard<std::mutex> lock (mutex);
+			slot.encoding = false;
+			encodingDone.notify_all();
+		});
+
+		oldestReadbackSlot = (oldestReadbackSlot + 1) % static_cast<int>(slots.size());
+		return true;
+	}
+
+	// waits for the encoder to let go of the slot's buffer and unmaps it
+	void reclaim(Slot& slot) {
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			encodingDone.wait(lock, [&]() { return !slot.encoding; });
+		}
+		if (slot.pixels != nullptr) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			slot.pixels = nullptr;
+		}
+	}
+
+public:
+	FrameCapture(const CaptureSettings& settings = CaptureSettings())
+		: settings(settings), threadPool(settings.threadCount) {
+		slots = std::vector<Slot>(settings.ringSize, Slot{ 0, 0, 0, 0, 0, CapturePixels::Rgba8, nullptr, nullptr, false });
+		nextSlot = 0;
+		oldestReadbackSlot = 0;
+		frameCount = 0;
+		readFramebuffer = 0;
+		output = nullptr;
+		streamWidth = 0;
+		streamHeight = 0;
+		nextWrittenFrame = 0;
+	}
+
+	~FrameCapture() {
+		threadPool.wait();
+		if (output != nullptr && output != stdout) {
+			fclose(output);
+		}
+	}
+
+	// before anything else is printed, when the stream goes to stdout
+	expected<void, std::string> openOutput() {
+		if (settings.format == CaptureFormat::SharedMemory) {
+			return sharedRing.create(settings.path, settings.sharedSlotCount, settings.sharedSlotCapacity);
+		}
+		if (settings.format == CaptureFormat::Stream) {
+			return streamServer.start(settings.path);
+		}
+		if (settings.format == CaptureFormat::Y4m) {
+			output = settings.path == "-" ? takeStdout() : fopen(settings.path.c_str(), "wb");
+			if (output == nullptr) {
+				return make_unexpected("failed to open " + settings.path + " for the Y4M stream\n");
+			}
+		}
+		return {};
+	}
+
+	// needs the GL context that capture() will be called from
+	void setup() {
+		for (auto &slot : slots) {
+			glGenBuffers(1, &slot.buffer);
+		}
+		glGenFramebuffers(1, &readFramebuffer);
+	}
+
+	// queues a readback of the width x height corner of a texture, after the commands that render it
+	void capture(unsigned int texture, int width, int height, CapturePixels pixelFormat = CapturePixels::Rgba8) {
+		capture(width, height, pixelFormat, [this, texture, width, height, pixelFormat](unsigned int buffer) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			if (pixelFormat == CapturePixels::R32f) {
+				glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, nullptr);
+			}
+			else {
+				glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		});
+	}
+
+	// queues a frame that write fills into the given ring buffer with GL commands,
+	// e.g. a compute pass that has already converted it on the GPU
+	void capture(int width, int height, CapturePixels pixelFormat, const std::function<void(unsigned int buffer)>& write) {
+		// no readback while there is no viewer or it is still busy with earlier frames
+		if (settings.format == CaptureFormat::Stream && !streamServer.canTakeFrame()) {
+			return;
+		}
+
+		if (settings.format == CaptureFormat::Y4m) {
+			if (streamWidth == 0) {
+				streamWidth = width;
+				streamHeight = height;
+				writeY4mHeader(output, width, height, settings.framesPerSecond);
+			}
+			else if (width != streamWidth || height != streamHeight) {
+				// a Y4M stream has a single frame size
+				return;
+			}
+		}
+
+		// readbacks finish in order, so this hands every finished frame to the encoders
+		while (dispatchOldestReadback(false));
+
+		// the ring is full, this only waits for its oldest readback
+		auto &slot = slots[nextSlot];
+		if (slot.fence != nullptr) {
+			dispatchOldestReadback(true);
+		}
+		reclaim(slot);
+
+		slot.width = width;
+		slot.height = height;
+		slot.frame = frameCount++;
+		slot.pixelFormat = pixelFormat;
+
+		auto size = getCaptureFrameSize(pixelFormat, width, height);
+		if (size != slot.size) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			slot.size = size;
+		}
+
+		// the source was last written by image stores
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+		write(slot.buffer);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextSlot = (nextSlot + 1) % static_cast<int>(slots.size());
+	}
+
+	// encodes and writes every captured frame
+	void finish() {
+		while (dispatchOldestReadback(true));
+		threadPool.wait();
+		for (auto &slot : slots) {
+			reclaim(slot);
+		}
+		if (output != nullptr) {
+			fflush(output);
+		}
+	}
+
+	int getFrameCount() {
+		return frameCount;
+	}
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef FRAME_EXCHANGE_HPP
+#define FRAME_EXCHANGE_HPP
+
+#include <glad/glad.h>
+#include <array>
+#include <mutex>
+#include <utility>
+
+// Triple buffered hand-over of display frames from the simulation context to the presenting context.
+// The simulation renders into the write slot, the newest finished frame waits in the ready slot and
+// the presenter shows the present slot. Fences order the GL work of the two contexts on each slot.
+class FrameExchange {
+public:
+	static constexpr int SLOT_COUNT = 3;
+
+	// the grid can be resized between frames, so every frame carries its own texture and size
+	struct Frame {
+		unsigned int texture;
+		int width;
+		int height;
+	};
+
+private:
+	std::mutex mutex;
+	int writeSlot;
+	int readySlot;
+	int presentSlot;
+	bool hasNewFrame;
+	bool hasPresentedFrame;
+	std::array<Frame, SLOT_COUNT> frames;
+
+	// signalled when the simulation finished writing a slot
+	std::array<GLsync, SLOT_COUNT> writeFences;
+	// signalled when the presenter finished reading a slot
+	std::array<GLsync, SLOT_COUNT> readFences;
+
+	void waitAndDelete(GLsync& fence) {
+		if (fence != nullptr) {
+			glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	void replace(GLsync& fence, GLsync newFence) {
+		if (fence != nullptr) {
+			glDeleteSync(fence);
+		}
+		fence = newFence;
+	}
+
+public:
+	FrameExchange() {
+		writeSlot = 0;
+		readySlot = 1;
+		presentSlot = 2;
+		hasNewFrame = false;
+		hasPresentedFrame = false;
+		writeFences = std::array<GLsync, SLOT_COUNT>{};
+		readFences = std::array<GLsync, SLOT_COUNT>{};
+		frames = std::array<Frame, SLOT_COUNT>{};
+	}
+
+	// simulation thread, before recording a frame: the slot to write into
+	int beginWrite() {
+		std::lock_guard<std::mutex> lock (mutex);
+		waitAndDelete(readFences[writeSlot]);
+		return writeSlot;
+	}
+
+	// simulation thread, after recording a frame into the texture of the write slot
+	void publish(const Frame& frame) {
+		auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		// the other context can only wait on a fence that has reached the GPU
+		glFlush();
+
+		std::lock_guard<std::mutex> lock (mutex);
+		replace(writeFences[writeSlot], fence);
+		frames[writeSlot] = frame;
+		std::swap(writeSlot, readySlot);
+		hasNewFrame = true;
+	}
+
+	// presenting thread: the newest finished frame, texture 0 until the first one arrives.
+	// frames the presenter never got to are skipped
+	Frame acquire() {
+		std::lock_guard<std::mutex> lock (mutex);
+		if (hasNewFrame) {
+			std::swap(presentSlot, readySlot);
+			hasNewFrame = false;
+			hasPresentedFrame = true;
+			waitAndDelete(writeFences[presentSlot]);
+		}
+		return hasPresentedFrame ? frames[presentSlot] : Frame{ 0, 0, 0 };
+	}
+
+	// presenting thread, after the draw that samples the acquired slot
+	void release() {
+		auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+
+		std::lock_guard<std::mutex> lock (mutex);
+		replace(readFences[presentSlot], fence);
+	}
+};
+
+#endif
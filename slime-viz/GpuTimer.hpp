@@ -0,0 +1,75 @@
+#ifndef GPU_TIMER_HPP
+#define GPU_TIMER_HPP
+
+#include <glad/glad.h>
+#include <array>
+#include <cstdint>
+
+// Measures GPU time between begin() and end() with timestamp queries.
+// Results are read a few frames late from a ring of query pairs, so measuring never stalls the pipeline
+class GpuTimer {
+private:
+	static constexpr int QUERY_RING_SIZE = 4;
+
+	std::array<unsigned int, QUERY_RING_SIZE * 2> queries;
+	std::array<bool, QUERY_RING_SIZE> pending;
+	int nextSlot;
+	int oldestPendingSlot;
+	float lastMilliseconds;
+
+	void readSlot(int slot) {
+		uint64_t beginTime, endTime;
+		glGetQueryObjectui64v(queries[slot * 2], GL_QUERY_RESULT, &beginTime);
+		glGetQueryObjectui64v(queries[slot * 2 + 1], GL_QUERY_RESULT, &endTime);
+		lastMilliseconds = static_cast<float>(endTime - beginTime) / 1000000.0f;
+		pending[slot] = false;
+		oldestPendingSlot = (slot + 1) % QUERY_RING_SIZE;
+	}
+
+public:
+	GpuTimer() {
+		queries = std::array<unsigned int, QUERY_RING_SIZE * 2>{};
+		pending = std::array<bool, QUERY_RING_SIZE>{};
+		nextSlot = 0;
+		oldestPendingSlot = 0;
+		lastMilliseconds = -1.0f;
+	}
+
+	void setup() {
+		glGenQueries(static_cast<int>(queries.size()), queries.data());
+	}
+
+	void begin() {
+		// only blocks when the GPU is more than QUERY_RING_SIZE frames behind
+		if (pending[nextSlot]) {
+			readSlot(nextSlot);
+		}
+		glQueryCounter(queries[nextSlot * 2], GL_TIMESTAMP);
+	}
+
+	void end() {
+		glQueryCounter(queries[nextSlot * 2 + 1], GL_TIMESTAMP);
+		pending[nextSlot] = true;
+		nextSlot = (nextSlot + 1) % QUERY_RING_SIZE;
+		poll();
+	}
+
+	// reads every finished measurement without waiting
+	void poll() {
+		while (pending[oldestPendingSlot]) {
+			int available = 0;
+			glGetQueryObjectiv(queries[oldestPendingSlot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				break;
+			}
+			readSlot(oldestPendingSlot);
+		}
+	}
+
+	// newest finished measurement, negative until the first one is available
+	float getMilliseconds() {
+		return lastMilliseconds;
+	}
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef IMAGE_ENCODING_HPP
+#define IMAGE_ENCODING_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// Frame encoders for the capture path. Pixels are RGBA8 rows in OpenGL order (bottom row first),
+// all encoders write them top row first.
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	static const auto table = []() {
+		std::array<uint32_t, 256> table{};
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i;
+			for (int bit = 0; bit < 8; bit++) {
+				value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+			}
+			table[i] = value;
+		}
+		return table;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back(static_cast<uint8_t>(value >> 24));
+	out.push_back(static_cast<uint8_t>(value >> 16));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+void appendPngChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+	appendBigEndian(out, static_cast<uint32_t>(data.size()));
+	auto typeOffset = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	appendBigEndian(out, crc32(out.data() + typeOffset, out.size() - typeOffset));
+}
+
+// zlib stream of stored (uncompressed) deflate blocks: encoding runs at memory speed, which keeps up
+// with capturing every frame. recompress offline if the size matters
+std::vector<uint8_t> storeZlib(const std::vector<uint8_t>& data) {
+	constexpr size_t MAX_BLOCK_SIZE = 65535;
+
+	std::vector<uint8_t> out{};
+	out.reserve(data.size() + data.size() / MAX_BLOCK_SIZE * 5 + 16);
+	out.push_back(0x78);
+	out.push_back(0x01);
+
+	uint32_t adlerLow = 1, adlerHigh = 0;
+	size_t offset = 0;
+	do {
+		auto blockSize = std::min(MAX_BLOCK_SIZE, data.size() - offset);
+		auto last = offset + blockSize == data.size();
+		out.push_back(last ? 1 : 0);
+		out.push_back(static_cast<uint8_t>(blockSize));
+		out.push_back(static_cast<uint8_t>(blockSize >> 8));
+		out.push_back(static_cast<uint8_t>(~blockSize));
+		out.push_back(static_cast<uint8_t>(~blockSize >> 8));
+		out.insert(out.end(), data.begin() + offset, data.begin() + offset + blockSize);
+
+		// at most 5552 bytes can be summed before the 32-bit sums need the modulo
+		for (size_t i = 0; i < blockSize; i += 5552) {
+			auto end = std::min(blockSize, i + 5552);
+			for (size_t j = i; j < end; j++) {
+				adlerLow += data[offset + j];
+				adlerHigh += adlerLow;
+			}
+			adlerLow %= 65521;
+			adlerHigh %= 65521;
+		}
+		offset += blockSize;
+	} while (offset < data.size());
+
+	appendBigEndian(out, (adlerHigh << 16) | adlerLow);
+	return out;
+}
+
+expected<void, std::string> writePng(const std::string& path, const uint8_t* pixels, int width, int height) {
+	auto rowSize = static_cast<size_t>(width) * 4;
+
+	// every row starts with filter type 0 (none)
+	std::vector<uint8_t> rows((rowSize + 1) * height);
+	for (int y = 0; y < height; y++) {
+		auto row = rows.data() + (rowSize + 1) * y;
+		row[0] = 0;
+		std::copy_n(pixels + rowSize * (height - 1 - y), rowSize, row + 1);
+	}
+
+	std::vector<uint8_t> header{};
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	// 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+	header.insert(header.end(), { 8, 6, 0, 0, 0 });
+
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	appendPngChunk(png, "IHDR", header);
+	appendPngChunk(png, "IDAT", storeZlib(rows));
+	appendPngChunk(png, "IEND", {});
+
+	auto file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		return make_unexpected("failed to open " + path + " for writing\n");
+	}
+	auto written = fwrite(png.data(), 1, png.size(), file);
+	fclose(file);
+	if (written != png.size()) {
+		return make_unexpected("failed to write " + path + "\n");
+	}
+	return {};
+}
+
+// YUV4MPEG2 stream header, 4:2:0 with JPEG chroma siting and full range BT.601, see convertToYuv420()
+void writeY4mHeader(FILE* file, int width, int height, int framesPerSecond) {
+	fprintf(file, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height, framesPerSecond);
+}
+
+// planar Y, U, V with chroma averaged over 2x2 blocks. odd sizes round the chroma planes up
+void convertToYuv420(const uint8_t* pixels, int width, int height, std::vector<uint8_t>& yuv) {
+	auto chromaWidth = (width + 1) / 2;
+	auto chromaHeight = (height + 1) / 2;
+	yuv.resize(static_cast<size_t>(width) * height + static_cast<size_t>(chromaWidth) * chromaHeight * 2);
+
+	auto yPlane = yuv.data();
+	auto uPlane = yPlane + static_cast<size_t>(width) * height;
+	auto vPlane = uPlane + static_cast<size_t>(chromaWidth) * chromaHeight;
+
+	auto pixel = [&](int x, int y) {
+		return pixels + (static_cast<size_t>(height - 1 - y) * width + x) * 4;
+	};
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			auto rgb = pixel(x, y);
+			yPlane[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>(0.299f * rgb[0] + 0.587f * rgb[1] + 0.114f * rgb[2] + 0.5f);
+		}
+	}
+
+	for (int y = 0; y < chromaHeight; y++) {
+		for (int x = 0; x < chromaWidth; x++) {
+			float r = 0.0f, g = 0.0f, b = 0.0f;
+			for (int i = 0; i < 4; i++) {
+				auto rgb = pixel(std::min(x * 2 + (i & 1), width - 1), std::min(y * 2 + (i >> 1), height - 1));
+				r += rgb[0];
+				g += rgb[1];
+				b += rgb[2];
+			}
+			r *= 0.25f;
+			g *= 0.25f;
+			b *= 0.25f;
+			auto index = static_cast<size_t>(y) * chromaWidth + x;
+			uPlane[index] = static_cast<uint8_t>(std::min(255.0f, 128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f));
+			vPlane[index] = static_cast<uint8_t>(std::min(255.0f, 128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f));
+		}
+	}
+}
+
+expected<void, std::string> writeY4mFrame(FILE* file, const std::vector<uint8_t>& yuv) {
+	fputs("FRAME\n", file);
+	if (fwrite(yuv.data(), 1, yuv.size(), file) != yuv.size()) {
+		return make_unexpected("failed to write a Y4M frame\n");
+	}
+	return {};
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef JOB_FILE_HPP
+#define JOB_FILE_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "expected.hpp"
+
+#include "Json.hpp"
+#include "SlimeSimulation.hpp"
+
+using namespace nonstd;
+
+// Batch job files, see BatchRunner. A JSON object with the pool settings and the jobs, each job's members
+// merged over "defaults" (nested objects member by member):
+//   {
+//     "workers": 4, "retries": 1, "timeout": 600,
+//     "defaults": { "width": 512, "height": 512, "agents": 50000, "frames": 2000,
+//                   "outputs": { "metrics": "{name}.metrics.json" } },
+//     "jobs": [
+//       { "name": "angle-30", "seed": 1, "parameters": { "sensorAngle": 30 } },
+//       { "name": "angle-60", "seed": 1, "parameters": { "sensorAngle": 60 },
+//         "outputs": { "snapshot": "{name}.snapshot", "render": "{name}_{frame}.svti", "renderInterval": 1000 } }
+//     ]
+//   }
+// "parameters" takes the members of MemberParameters, "outputs" snapshot, trail (raw RGBA32F texels bottom row
+// first), render (a tiled image file name, {frame} is replaced by the frame), renderInterval (0 renders the last
+// frame), renderTileSize and metrics. {name} in paths is replaced by the job name. Unknown members are errors, so
+// a typo doesn't silently run the defaults. Paths are relative to the working directory, which the workers share
+// with the runner and which has to hold the shaders like for any run. Jobs run with race-free point deposits
+// (SimulationSettings::reproducible), so a job gives the same outputs every time it runs
+
+struct JobOutputs {
+	// empty ones aren't written
+	std::string snapshot;
+	std::string trail;
+	std::string render;
+	int renderInterval = 0;
+	int renderTileSize = 256;
+	std::string metrics;
+};
+
+struct JobSpec {
+	std::string name;
+	int width = 1000;
+	int height = 1000;
+	int agentCount = 100000;
+	unsigned int seed = 1;
+	int frames = 0;
+	// the defaults for those the job doesn't set
+	MemberParameters parameters;
+	JobOutputs outputs;
+	// the result manifest the runner writes and the log the worker's output goes to
+	std::string manifest;
+	std::string log;
+	// the job's members after merging the defaults, for the manifest
+	JsonValue source;
+};
+
+struct JobFile {
+	int workers = 1;
+	// attempts after the first failed one
+	int retries = 0;
+	// seconds an attempt may take before it is killed, 0 waits forever
+	double timeout = 0.0;
+	std::vector<JobSpec> jobs;
+};
+
+class JobReader {
+private:
+	std::string context;
+
+	expected<void, std::string> fail(const std::string& what) {
+		return make_unexpected(context + ": " + what + "\n");
+	}
+
+	expected<void, std::string> checkMembers(const JsonValue& object, const std::vector<std::string>& known) {
+		if (!object.isObject()) {
+			return fail("expected an object");
+		}
+		for (auto &member : object.members) {
+			if (std::find(known.begin(), known.end(), member.first) == known.end()) {
+				return fail("unknown member \"" + member.first + "\"");
+			}
+		}
+		return {};
+	}
+
+	expected<void, std::string> readNumber(const JsonValue& object, const std::string& name, double& value) {
+		auto member = object.find(name);
+		if (member == nullptr) {
+			return {};
+		}
+		if (member->type != JsonValue::Type::Number) {
+			return fail("\"" + name + "\" has to be a number");
+		}
+		value = member->number;
+		return {};
+	}
+
+	expected<void, std::string> readFloat(const JsonValue& object, const std::string& name, float& value) {
+		double number = value;
+		auto result = readNumber(object, name, number);
+		value = static_cast<float>(number);
+		return result;
+	}
+
+	expected<void, std::string> readInt(const JsonValue& object, const std::string& name, int& value, int minimum) {
+		double number = value;
+		auto result = readNumber(object, name, number);
+		if (!result) {
+			return result;
+		}
+		if (number != floor(number) || number < minimum || number > INT32_MAX) {
+			return fail("\"" + name + "\" has to be a whole number of at least " + std::to_string(minimum));
+		}
+		value = static_cast<int>(number);
+		return {};
+	}
+
+	expected<void, std::string> readString(const JsonValue& object, const std::string& name, std::string& value) {
+		auto member = object.find(name);
+		if (member == nullptr) {
+			return {};
+		}
+		if (member->type != JsonValue::Type::String) {
+			return fail("\"" + name + "\" has to be a string");
+		}
+		value = member->string;
+		return {};
+	}
+
+	std::string expandName(std::string path, const std::string& name) {
+		for (auto found = path.find("{name}"); found != std::string::npos; found = path.find("{name}", found + name.size())) {
+			path.replace(found, 6, name);
+		}
+		return path;
+	}
+
+public:
+	expected<JobFile, std::string> read(const std::string& path) {
+		std::ifstream stream (path);
+		if (!stream) {
+			return make_unexpected("failed to open job file " + path + "\n");
+		}
+		std::stringstream text;
+		text << stream.rdbuf();
+		auto root = parseJson(text.str());
+		if (!root) {
+			return make_unexpected(path + ": " + root.error());
+		}
+
+		JobFile file;
+		context = path;
+		expected<void, std::string> result;
+		if (!(result = checkMembers(*root, { "workers", "retries", "timeout", "defaults", "jobs" })) ||
+				!(result = readInt(*root, "workers", file.workers, 1)) || !(result = readInt(*root, "retries", file.retries, 0)) ||
+				!(result = readNumber(*root, "timeout", file.timeout))) {
+			return make_unexpected(result.error());
+		}
+		auto jobs = root->find("jobs");
+		if (jobs == nullptr || jobs->type != JsonValue::Type::Array || jobs->items.empty()) {
+			return make_unexpected(path + ": \"jobs\" has to be an array of jobs\n");
+		}
+		JsonValue defaults;
+		defaults.type = JsonValue::Type::Object;
+		if (root->find("defaults") != nullptr) {
+			defaults = *root->find("defaults");
+		}
+
+		for (size_t i = 0; i < jobs->items.size(); i++) {
+			auto source = defaults.merge(jobs->items[i]);
+			context = path + " job " + std::to_string(i);
+			JobSpec job;
+			job.source = source;
+			if (!(result = checkMembers(source, { "name", "width", "height", "agents", "seed", "frames", "parameters", "outputs" })) ||
+					!(result = readString(source, "name", job.name)) ||
+					!(result = readInt(source, "width", job.width, 1)) || !(result = readInt(source, "height", job.height, 1)) ||
+					!(result = readInt(source, "agents", job.agentCount, 1)) || !(result = readInt(source, "frames", job.frames, 1))) {
+				return make_unexpected(result.error());
+			}
+			// 0 would seed from the clock, which a job has to be reproducible without
+			auto seed = 1;
+			if (!(result = readInt(source, "seed", seed, 1))) {
+				return make_unexpected(result.error());
+			}
+			job.seed = static_cast<unsigned int>(seed);
+			if (job.name.empty() || source.find("frames") == nullptr) {
+				return make_unexpected(context + ": every job needs a name and a frame count\n");
+			}
+			if (std::any_of(file.jobs.begin(), file.jobs.end(), [&](const JobSpec& other) { return other.name == job.name; })) {
+				return make_unexpected(context + ": the name " + job.name + " is taken by an earlier job\n");
+			}
+
+			auto parameters = source.find("parameters");
+			if (parameters != nullptr) {
+				auto &values = job.parameters;
+				if (!(result = checkMembers(*parameters, { "sensorAngle", "sensorDistance", "turnSpeed", "moveSpeed", "diffuseWeight", "decay" })) ||
+						!(result = readFloat(*parameters, "sensorAngle", values.sensorAngle)) ||
+						!(result = readFloat(*parameters, "sensorDistance", values.sensorDistance)) ||
+						!(result = readFloat(*parameters, "turnSpeed", values.turnSpeed)) ||
+						!(result = readFloat(*parameters, "moveSpeed", values.moveSpeed)) ||
+						!(result = readFloat(*parameters, "diffuseWeight", values.diffuseWeight)) ||
+						!(result = readFloat(*parameters, "decay", values.decay))) {
+					return make_unexpected(result.error());
+				}
+			}
+
+			auto outputs = source.find("outputs");
+			if (outputs != nullptr) {
+				auto &values = job.outputs;
+				if (!(result = checkMembers(*outputs, { "snapshot", "trail", "render", "renderInterval", "renderTileSize", "metrics" })) ||
+						!(result = readString(*outputs, "snapshot", values.snapshot)) || !(result = readString(*outputs, "trail", values.trail)) ||
+						!(result = readString(*outputs, "render", values.render)) || !(result = readString(*outputs, "metrics", values.metrics)) ||
+						!(result = readInt(*outputs, "renderInterval", values.renderInterval, 0)) ||
+						!(result = readInt(*outputs, "renderTileSize", values.renderTileSize, 2))) {
+					return make_unexpected(result.error());
+				}
+				values.snapshot = expandName(values.snapshot, job.name);
+				values.trail = expandName(values.trail, job.name);
+				values.render = expandName(values.render, job.name);
+				values.metrics = expandName(values.metrics, job.name);
+			}
+			job.manifest = job.name + ".manifest.json";
+			job.log = job.name + ".log";
+			file.jobs.push_back(job);
+		}
+		return file;
+	}
+};
+
+expected<JobFile, std::string> readJobFile(const std::string& path) {
+	return JobReader().read(path);
+}
+
+#endif
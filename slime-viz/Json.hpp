@@ -0,0 +1,316 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// Just enough JSON for job files and result manifests: numbers are doubles, strings only escape what JSON
+// requires and \u escapes outside ASCII are kept as UTF-8. Object members keep their order
+struct JsonValue {
+	enum class Type {
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object
+	};
+
+	Type type = Type::Null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> items;
+	std::vector<std::pair<std::string, JsonValue>> members;
+
+	bool isObject() const {
+		return type == Type::Object;
+	}
+
+	// the member of an object, nullptr when there is none
+	const JsonValue* find(const std::string& name) const {
+		for (auto &member : members) {
+			if (member.first == name) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+
+	// the object with the members of overrides replacing its own, objects in both are merged the same way
+	JsonValue merge(const JsonValue& overrides) const {
+		if (!isObject() || !overrides.isObject()) {
+			return overrides;
+		}
+		auto merged = *this;
+		for (auto &member : overrides.members) {
+			auto found = std::find_if(merged.members.begin(), merged.members.end(),
+					[&](const std::pair<std::string, JsonValue>& existing) { return existing.first == member.first; });
+			if (found != merged.members.end()) {
+				found->second = found->second.merge(member.second);
+			}
+			else {
+				merged.members.push_back(member);
+			}
+		}
+		return merged;
+	}
+};
+
+class JsonParser {
+private:
+	const std::string& text;
+	size_t position;
+
+	void skipSpace() {
+		while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r')) {
+			position++;
+		}
+	}
+
+	expected<void, std::string> fail(const std::string& what) {
+		auto line = 1 + std::count(text.begin(), text.begin() + std::min(position, text.size()), '\n');
+		return make_unexpected(what + " in line " + std::to_string(line) + "\n");
+	}
+
+	bool consume(const char* literal) {
+		auto length = strlen(literal);
+		if (text.compare(position, length, literal) != 0) {
+			return false;
+		}
+		position += length;
+		return true;
+	}
+
+	void appendUtf8(std::string& out, unsigned int codePoint) {
+		if (codePoint < 0x80) {
+			out += static_cast<char>(codePoint);
+		}
+		else if (codePoint < 0x800) {
+			out += static_cast<char>(0xC0 | codePoint >> 6);
+			out += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+		else {
+			out += static_cast<char>(0xE0 | codePoint >> 12);
+			out += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+			out += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+	}
+
+	expected<void, std::string> parseString(std::string& out) {
+		position++;
+		while (position < text.size() && text[position] != '"') {
+			auto c = text[position++];
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (position >= text.size()) {
+				break;
+			}
+			auto escape = text[position++];
+			switch (escape) {
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			case 'r': out += '\r'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'u': {
+				if (position + 4 > text.size()) {
+					return fail("truncated \\u escape");
+				}
+				appendUtf8(out, static_cast<unsigned int>(strtoul(text.substr(position, 4).c_str(), nullptr, 16)));
+				position += 4;
+				break;
+			}
+			default: out += escape;
+			}
+		}
+		if (position >= text.size()) {
+			return fail("unterminated string");
+		}
+		position++;
+		return {};
+	}
+
+	expected<void, std::string> parseValue(JsonValue& value, int depth) {
+		skipSpace();
+		if (position >= text.size()) {
+			return fail("unexpected end");
+		}
+		if (depth > 64) {
+			return fail("too deeply nested value");
+		}
+		auto c = text[position];
+		if (c == '{') {
+			value.type = JsonValue::Type::Object;
+			position++;
+			skipSpace();
+			if (position < text.size() && text[position] == '}') {
+				position++;
+				return {};
+			}
+			while (true) {
+				skipSpace();
+				if (position >= text.size() || text[position] != '"') {
+					return fail("expected a member name");
+				}
+				std::string name;
+				auto nameResult = parseString(name);
+				if (!nameResult) {
+					return nameResult;
+				}
+				skipSpace();
+				if (!consume(":")) {
+					return fail("expected ':'");
+				}
+				JsonValue member;
+				auto memberResult = parseValue(member, depth + 1);
+				if (!memberResult) {
+					return memberResult;
+				}
+				value.members.emplace_back(name, std::move(member));
+				skipSpace();
+				if (consume("}")) {
+					return {};
+				}
+				if (!consume(",")) {
+					return fail("expected ',' or '}'");
+				}
+			}
+		}
+		if (c == '[') {
+			value.type = JsonValue::Type::Array;
+			position++;
+			skipSpace();
+			if (consume("]")) {
+				return {};
+			}
+			while (true) {
+				JsonValue item;
+				auto itemResult = parseValue(item, depth + 1);
+				if (!itemResult) {
+					return itemResult;
+				}
+				value.items.push_back(std::move(item));
+				skipSpace();
+				if (consume("]")) {
+					return {};
+				}
+				if (!consume(",")) {
+					return fail("expected ',' or ']'");
+				}
+			}
+		}
+		if (c == '"') {
+			value.type = JsonValue::Type::String;
+			return parseString(value.string);
+		}
+		if (consume("true")) {
+			value.type = JsonValue::Type::Bool;
+			value.boolean = true;
+			return {};
+		}
+		if (consume("false")) {
+			value.type = JsonValue::Type::Bool;
+			return {};
+		}
+		if (consume("null")) {
+			return {};
+		}
+		auto start = text.c_str() + position;
+		char* end;
+		value.number = strtod(start, &end);
+		if (end == start) {
+			return fail("unexpected character");
+		}
+		value.type = JsonValue::Type::Number;
+		position += end - start;
+		return {};
+	}
+
+public:
+	JsonParser(const std::string& text) : text(text) {
+		position = 0;
+	}
+
+	expected<JsonValue, std::string> parse() {
+		JsonValue value;
+		auto result = parseValue(value, 0);
+		if (!result) {
+			return make_unexpected(result.error());
+		}
+		skipSpace();
+		if (position != text.size()) {
+			auto trailing = fail("trailing characters");
+			return make_unexpected(trailing.error());
+		}
+		return value;
+	}
+};
+
+expected<JsonValue, std::string> parseJson(const std::string& text) {
+	return JsonParser(text).parse();
+}
+
+// the string as a JSON string literal
+std::string quoteJson(const std::string& text) {
+	std::string quoted = "\"";
+	for (auto c : text) {
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			quoted += escape;
+		}
+		else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+// compact JSON text of the value
+std::string toJson(const JsonValue& value) {
+	switch (value.type) {
+	case JsonValue::Type::Bool:
+		return value.boolean ? "true" : "false";
+	case JsonValue::Type::Number: {
+		char number[32];
+		snprintf(number, sizeof(number), "%.15g", value.number);
+		return number;
+	}
+	case JsonValue::Type::String:
+		return quoteJson(value.string);
+	case JsonValue::Type::Array: {
+		std::string text = "[";
+		for (size_t i = 0; i < value.items.size(); i++) {
+			text += (i > 0 ? ", " : "") + toJson(value.items[i]);
+		}
+		return text + "]";
+	}
+	case JsonValue::Type::Object: {
+		std::string text = "{";
+		for (size_t i = 0; i < value.members.size(); i++) {
+			text += (i > 0 ? ", " : "") + quoteJson(value.members[i].first) + ": " + toJson(value.members[i].second);
+		}
+		return text + "}";
+	}
+	default:
+		return "null";
+	}
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef QUALITY_CONTROLLER_HPP
+#define QUALITY_CONTROLLER_HPP
+
+#include <algorithm>
+#include <functional>
+
+struct QualityLevel {
+	int stepsPerFrame;
+	// fraction of the agents updated per step, the rest keep their state until their turn comes
+	float agentFraction;
+};
+
+// Adjusts simulation steps per frame and the fraction of agents updated per step so the measured
+// GPU time of a frame stays within a budget. When over budget, steps are dropped first and agents
+// after that; when well under budget, agents are restored first and steps after that.
+// Every change is reported to the listener.
+class QualityController {
+public:
+	using Listener = std::function<void(const QualityLevel& level, float gpuMilliseconds)>;
+
+private:
+	// measurements are smoothed, and changes wait a few frames so the effect of the last one shows up
+	static constexpr float SMOOTHING = 0.2f;
+	static constexpr int SETTLE_FRAMES = 8;
+	// below this share of the budget quality is raised again
+	static constexpr float HEADROOM = 0.75f;
+	static constexpr float MIN_AGENT_FRACTION = 0.1f;
+	static constexpr float AGENT_FRACTION_STEP = 0.1f;
+
+	float targetMilliseconds;
+	int maxStepsPerFrame;
+	QualityLevel level;
+	Listener listener;
+
+	float smoothedMilliseconds;
+	int framesSinceChange;
+
+	void change(const QualityLevel& newLevel) {
+		level = newLevel;
+		framesSinceChange = 0;
+		if (listener) {
+			listener(level, smoothedMilliseconds);
+		}
+	}
+
+public:
+	QualityController(float targetMilliseconds, int maxStepsPerFrame, Listener listener) {
+		this->targetMilliseconds = targetMilliseconds;
+		this->maxStepsPerFrame = maxStepsPerFrame;
+		this->listener = listener;
+		level = QualityLevel{ maxStepsPerFrame, 1.0f };
+		smoothedMilliseconds = -1.0f;
+		framesSinceChange = 0;
+	}
+
+	QualityLevel getLevel() {
+		return level;
+	}
+
+	// gpuMilliseconds is the GPU time of one frame at the current level, negative when there is no measurement yet
+	void submit(float gpuMilliseconds) {
+		if (gpuMilliseconds < 0.0f) {
+			return;
+		}
+		smoothedMilliseconds = smoothedMilliseconds < 0.0f
+			? gpuMilliseconds
+			: smoothedMilliseconds + (gpuMilliseconds - smoothedMilliseconds) * SMOOTHING;
+
+		framesSinceChange++;
+		if (framesSinceChange < SETTLE_FRAMES) {
+			return;
+		}
+
+		auto newLevel = level;
+		if (smoothedMilliseconds > targetMilliseconds) {
+			if (level.stepsPerFrame > 1) {
+				// GPU time scales roughly linearly with steps, so jump straight to the estimate
+				auto fittingSteps = static_cast<int>(level.stepsPerFrame * targetMilliseconds / smoothedMilliseconds);
+				newLevel.stepsPerFrame = std::max(1, std::min(level.stepsPerFrame - 1, fittingSteps));
+			}
+			else if (level.agentFraction > MIN_AGENT_FRACTION) {
+				newLevel.agentFraction = std::max(MIN_AGENT_FRACTION, level.agentFraction - AGENT_FRACTION_STEP);
+			}
+		}
+		else if (smoothedMilliseconds < targetMilliseconds * HEADROOM) {
+			if (level.agentFraction < 1.0f) {
+				newLevel.agentFraction = std::min(1.0f, level.agentFraction + AGENT_FRACTION_STEP);
+			}
+			else if (level.stepsPerFrame < maxStepsPerFrame) {
+				newLevel.stepsPerFrame = level.stepsPerFrame + 1;
+			}
+		}
+
+		if (newLevel.stepsPerFrame != level.stepsPerFrame || newLevel.agentFraction != level.agentFraction) {
+			change(newLevel);
+		}
+	}
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include <fstream>
 #include <sstream>
 #include <array>
+#include <vector>
+#include <string>
 
 #include "expected.hpp"
 
@@ -20,6 +22,47 @@ private:
 	std::array<unsigned int, SHADER_IDS_ARRAY_SIZE> shaderIDs;
 	int lastShaderIndex;
 
+	expected<std::string, std::string> readFile(const std::string& path) {
+		std::ifstream stream (path);
+		std::stringstream stringStream;
+		if (stream.is_open()) {
+			stringStream << stream.rdbuf();
+			return stringStream.str();
+		}
+		return make_unexpected("failed to open shader file " + path + "\n");
+	}
+
+	// replaces #include "file" lines with the file contents, one level deep.
+	// #line directives keep compiler messages pointing at the right file (by include index) and line
+	expected<std::string, std::string> expandIncludes(const std::string& source) {
+		std::istringstream lines (source);
+		std::string expanded;
+		std::string line;
+		int lineNumber = 0;
+		int includeIndex = 0;
+		while (std::getline(lines, line)) {
+			lineNumber++;
+			if (line.rfind("#include", 0) != 0) {
+				expanded += line + "\n";
+				continue;
+			}
+			auto nameStart = line.find('"');
+			auto nameEnd = line.rfind('"');
+			if (nameStart == std::string::npos || nameEnd == nameStart) {
+				return make_unexpected("malformed include: " + line + "\n");
+			}
+			auto included = readFile(line.substr(nameStart + 1, nameEnd - nameStart - 1));
+			if (!included) {
+				return included;
+			}
+			includeIndex++;
+			expanded += "#line 1 " + std::to_string(includeIndex) + "\n";
+			expanded += *included + "\n";
+			expanded += "#line " + std::to_string(lineNumber + 1) + " 0\n";
+		}
+		return expanded;
+	}
+
 public:
 	ShaderProgramBuilder() {
 		programID = 0;
@@ -29,20 +72,31 @@ public:
 		lastShaderIndex = 0;
 	}
 
-	expected<void, std::string> attachShader(GLenum shaderType, const std::string& path) {
+	// defines are inserted right after the #version line of the shader source
+	expected<void, std::string> attachShader(GLenum shaderType, const std::string& path,
+			const std::vector<std::string>& defines = {}) {
 		if (linked) {
-			make_unexpected("tried to attach shader after linking");
+			return make_unexpected("tried to attach shader after linking");
 		}
 
-		std::ifstream shaderStream (path);
-		std::stringstream shaderStringStream;
-		std::string shaderString;
-		if (shaderStream.is_open()) {
-			shaderStringStream << shaderStream.rdbuf();
-			shaderString = shaderStringStream.str();
+		auto source = readFile(path);
+		if (!source) {
+			return make_unexpected(source.error());
+		}
+		auto expandedSource = expandIncludes(*source);
+		if (!expandedSource) {
+			return make_unexpected(expandedSource.error());
+		}
+		std::string shaderString = *expandedSource;
+		if (!defines.empty()) {
+			auto versionEnd = shaderString.find('\n') + 1;
+			std::string defineLines;
+			for (auto const &define : defines) {
+				defineLines += "#define " + define + "\n";
+			}
+			defineLines += "#line 2\n";
+			shaderString.insert(versionEnd, defineLines);
 		}
-		else return make_unexpected("failed to open shader file\n");
-		shaderStream.close();
 		auto shaderCString = shaderString.c_str();
 
 		int success;
@@ -60,10 +114,12 @@ public:
 		}
 
 		if (lastShaderIndex >= shaderIDs.size()) {
-			make_unexpected("shaders IDs array is full");
+			return make_unexpected("shaders IDs array is full");
 		}
 		shaderIDs[lastShaderIndex] = shaderID;
 		lastShaderIndex++;
+
+		return {};
 	}
 
 	expected<unsigned int, std::string> getShaderProgram() {
@@ -0,0 +1,283 @@
+#ifndef SHARED_FRAME_RING_HPP
+#define SHARED_FRAME_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// Ring of frames in named shared memory, written by the simulation and mapped read-only by any number of
+// other processes. Layout: the ring header, then slotCount slots of slotStride bytes, each a slot header
+// followed by the frame data at a page-aligned offset, so readers can use frames in place.
+// Frame n goes to slot n % slotCount; a per-slot seqlock tells readers whether what they read was torn.
+
+constexpr uint32_t SHARED_RING_MAGIC = 0x47525653; // "SVRG"
+constexpr uint32_t SHARED_RING_VERSION = 1;
+constexpr size_t SHARED_RING_ALIGNMENT = 4096;
+
+enum class SharedFrameFormat : uint32_t {
+	// one float per texel, the trail intensity
+	R32f = 1,
+	Rgba8 = 2,
+	// planar 8-bit 4:2:0
+	Yuv420 = 3
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "the ring needs address-free atomics");
+
+struct SharedRingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slotCount;
+	uint32_t reserved;
+	uint64_t slotStride;
+	uint64_t slotCapacity;
+	// number of the newest complete frame plus one, 0 before the first frame
+	std::atomic<uint64_t> publishedFrames;
+	// frames that were larger than a slot
+	std::atomic<uint64_t> droppedFrames;
+};
+
+struct SharedSlotHeader {
+	// odd while the writer is inside the slot
+	std::atomic<uint32_t> sequence;
+	SharedFrameFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint64_t frame;
+	uint64_t dataSize;
+};
+
+size_t alignToPage(size_t size) {
+	return (size + SHARED_RING_ALIGNMENT - 1) / SHARED_RING_ALIGNMENT * SHARED_RING_ALIGNMENT;
+}
+
+class SharedFrameRing {
+private:
+	std::string name;
+	bool owner;
+	uint8_t* memory;
+	size_t size;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+	// writers of the same slot from different encoder threads take turns
+	std::unique_ptr<std::mutex[]> slotLocks;
+
+	uint8_t* getSlotMemory(int slot) {
+		return memory + SHARED_RING_ALIGNMENT + getHeader().slotStride * slot;
+	}
+
+	expected<void, std::string> map(bool create) {
+#ifdef _WIN32
+		if (create) {
+			mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+					static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), name.c_str());
+		}
+		else {
+			mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+		}
+		if (mapping == nullptr) {
+			return make_unexpected("failed to " + std::string(create ? "create" : "open") + " shared memory " + name + "\n");
+		}
+		memory = static_cast<uint8_t*>(MapViewOfFile(mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size));
+		if (memory == nullptr) {
+			return make_unexpected("failed to map shared memory " + name + "\n");
+		}
+#else
+		auto fd = shm_open(name.c_str(), create ? O_CREAT | O_RDWR : O_RDONLY, 0644);
+		if (fd < 0) {
+			return make_unexpected("failed to " + std::string(create ? "create" : "open") + " shared memory " + name + "\n");
+		}
+		if (create && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+			close(fd);
+			return make_unexpected("failed to size shared memory " + name + "\n");
+		}
+		if (!create) {
+			struct stat status;
+			fstat(fd, &status);
+			size = static_cast<size_t>(status.st_size);
+		}
+		auto address = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (address == MAP_FAILED) {
+			return make_unexpected("failed to map shared memory " + name + "\n");
+		}
+		memory = static_cast<uint8_t*>(address);
+#endif
+		return {};
+	}
+
+public:
+	SharedFrameRing() {
+		owner = false;
+		memory = nullptr;
+		size = 0;
+#ifdef _WIN32
+		mapping = nullptr;
+#endif
+	}
+
+	~SharedFrameRing() {
+		if (memory == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(memory);
+		CloseHandle(mapping);
+#else
+		munmap(memory, size);
+		if (owner) {
+			shm_unlink(name.c_str());
+		}
+#endif
+	}
+
+	SharedFrameRing(const SharedFrameRing&) = delete;
+	SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+	// writer side. name is "/name" for shm_open, on Windows a mapping name like "Local\name"
+	expected<void, std::string> create(const std::string& name, int slotCount, size_t slotCapacity) {
+		this->name = name;
+		owner = true;
+		auto slotStride = SHARED_RING_ALIGNMENT + alignToPage(slotCapacity);
+		size = SHARED_RING_ALIGNMENT + slotStride * slotCount;
+
+#ifndef _WIN32
+		// a ring left behind by a crashed run
+		shm_unlink(name.c_str());
+#endif
+		auto result = map(true);
+		if (!result) {
+			return result;
+		}
+
+		auto header = new (memory) SharedRingHeader{};
+		header->slotCount = slotCount;
+		header->slotStride = slotStride;
+		header->slotCapacity = slotCapacity;
+		header->publishedFrames.store(0);
+		header->droppedFrames.store(0);
+		for (int i = 0; i < slotCount; i++) {
+			new (getSlotMemory(i)) SharedSlotHeader{};
+		}
+		slotLocks = std::make_unique<std::mutex[]>(slotCount);
+
+		// readers check the magic last
+		header->version = SHARED_RING_VERSION;
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = SHARED_RING_MAGIC;
+		return {};
+	}
+
+	// reader side, maps the whole ring read-only
+	expected<void, std::string> open(const std::string& name) {
+		this->name = name;
+		owner = false;
+#ifdef _WIN32
+		// the view size is only known after mapping the header
+		size = SHARED_RING_ALIGNMENT;
+		auto headerResult = map(false);
+		if (!headerResult) {
+			return headerResult;
+		}
+		auto ringSize = SHARED_RING_ALIGNMENT + getHeader().slotStride * getHeader().slotCount;
+		UnmapViewOfFile(memory);
+		CloseHandle(mapping);
+		memory = nullptr;
+		size = ringSize;
+#endif
+		auto result = map(false);
+		if (!result) {
+			return result;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (size < SHARED_RING_ALIGNMENT || getHeader().magic != SHARED_RING_MAGIC) {
+			return make_unexpected(name + " is not a slime-viz frame ring\n");
+		}
+		if (getHeader().version != SHARED_RING_VERSION) {
+			return make_unexpected(name + " has ring version " + std::to_string(getHeader().version) +
+					", expected " + std::to_string(SHARED_RING_VERSION) + "\n");
+		}
+		return {};
+	}
+
+	SharedRingHeader& getHeader() {
+		return *reinterpret_cast<SharedRingHeader*>(memory);
+	}
+
+	int getSlotCount() {
+		return static_cast<int>(getHeader().slotCount);
+	}
+
+	SharedSlotHeader& getSlot(int slot) {
+		return *reinterpret_cast<SharedSlotHeader*>(getSlotMemory(slot));
+	}
+
+	const uint8_t* getSlotData(int slot) {
+		return getSlotMemory(slot) + SHARED_RING_ALIGNMENT;
+	}
+
+	// copies a frame into its slot, false when it doesn't fit
+	bool write(uint64_t frame, SharedFrameFormat format, int width, int height, const void* data, size_t dataSize) {
+		auto &header = getHeader();
+		if (dataSize > header.slotCapacity) {
+			header.droppedFrames.fetch_add(1);
+			return false;
+		}
+
+		auto slotIndex = static_cast<int>(frame % header.slotCount);
+		std::lock_guard<std::mutex> lock (slotLocks[slotIndex]);
+
+		auto &slot = getSlot(slotIndex);
+		auto sequence = slot.sequence.load(std::memory_order_relaxed);
+		slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.format = format;
+		slot.width = width;
+		slot.height = height;
+		slot.frame = frame;
+		slot.dataSize = dataSize;
+		memcpy(getSlotMemory(slotIndex) + SHARED_RING_ALIGNMENT, data, dataSize);
+
+		slot.sequence.store(sequence + 2, std::memory_order_release);
+
+		// encoders can finish out of order, the published count only moves forward
+		auto published = header.publishedFrames.load();
+		while (published < frame + 1 && !header.publishedFrames.compare_exchange_weak(published, frame + 1));
+		return true;
+	}
+
+	// reader side: read the slot between beginRead() and endRead(), and discard what was read unless
+	// endRead() returns true. beginRead() fails while the writer is inside the slot
+	bool beginRead(int slot, uint32_t& sequence) {
+		sequence = getSlot(slot).sequence.load(std::memory_order_acquire);
+		return (sequence & 1) == 0;
+	}
+
+	bool endRead(int slot, uint32_t sequence) {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return getSlot(slot).sequence.load(std::memory_order_relaxed) == sequence;
+	}
+};
+
+#endif
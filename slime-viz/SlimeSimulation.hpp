@@ -5,12 +5,27 @@
 
 #include <glad/glad.h>
 #include <cstdlib>
+#include <cstdint>
 #include <math.h>
+#include <algorithm>
 #include <vector>
+#include <array>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
 
 #include "expected.hpp"
 
 #include "ApplicationBase.hpp"
+#include "ShaderProgramBuilder.hpp"
+#include "GpuTimer.hpp"
+#include "TexturePool.hpp"
+#include "StagingBuffer.hpp"
+#include "Snapshot.hpp"
+#include "SparseTrail.hpp"
+#include "SubdomainExchange.hpp"
 
 using namespace nonstd;
 
@@ -22,143 +37,1969 @@ int randomInt(int lo, int hi) {
 	return rand() % (lo - hi + 1) + lo;
 }
 
+bool hasExtension(const char* name) {
+	int extensionCount;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (int i = 0; i < extensionCount; i++) {
+		if (std::string(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i))) == name) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// uncommitted pages have to read as zero, which only GL_ARB_sparse_texture2 guarantees
+bool supportsSparseTrail() {
+	return hasExtension("GL_ARB_sparse_texture") && hasExtension("GL_ARB_sparse_texture2");
+}
+
+// GL_KHR_shader_subgroup queries, not part of the 4.3 loader
+#ifndef GL_SUBGROUP_SUPPORTED_STAGES_KHR
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR 0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR 0x9534
+#define GL_SUBGROUP_FEATURE_BASIC_BIT_KHR 0x00000001
+#define GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR 0x00000008
+#endif
+
+bool supportsSubgroupDeposits() {
+	if (!hasExtension("GL_KHR_shader_subgroup")) {
+		return false;
+	}
+	int stages, features;
+	glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+	glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+	int requiredFeatures = GL_SUBGROUP_FEATURE_BASIC_BIT_KHR | GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR;
+	return (stages & GL_COMPUTE_SHADER_BIT) && (features & requiredFeatures) == requiredFeatures;
+}
+
+constexpr int UPDATE_GROUP_SIZE = 64;
+
+constexpr int TILE_SIZE = 32;
+// sensor distance 5 plus sensor radius 1, see sense() in agent_update.glsl
+constexpr int TILE_HALO = 6;
+constexpr int TILE_GROUP_SIZE = 256;
+// tiles of the diffuse and copy work groups, which DiffuseMode::ActiveTiles tracks the activity of
+constexpr int ACTIVE_TILE_SIZE = 16;
+
+// snapshots move through a ring of this many chunks of this size, so GPU copies overlap the file IO
+constexpr size_t SNAPSHOT_CHUNK_SIZE = 16 << 20;
+constexpr int SNAPSHOT_CHUNK_COUNT = 4;
+
+// a subdomain keeps the trail this far around its own texels: the sensor reach plus the texel diffuse reads
+// past the texels it processes
+constexpr int SUBDOMAIN_HALO = TILE_HALO + 1;
+// the counters in front of the agents in the migration buffer, see migrate_agents.comp
+constexpr size_t MIGRATION_HEADER_SIZE = 4 * sizeof(uint32_t);
+
 struct Agent {
 	float position[2];
 	float angle;
-	float padding;
+	// index of the agent in the whole run, see agents.glsl
+	uint32_t id;
+};
+
+enum class AgentLayout {
+	// one SSBO of Agent structs, 16 bytes per agent
+	Structure,
+	// separate position and heading streams, 6 bytes per agent: positions are 2x16-bit fixed point
+	// relative to the world size, headings a 16-bit fraction of a full turn.
+	// the update shader handles a pair of agents per invocation, so the agent count is rounded up to even
+	Packed,
+	// like Structure, but the position is two uint32 16.16 fixed point numbers of texels. A step then moves an
+	// agent by the same amount anywhere, where float positions lose bits of it on grids wider than about 16k
+	// texels. Grids are limited to 65535 texels a side
+	FixedPoint
+};
+
+enum class DepositMode {
+	// update.comp writes each agent's texel with imageStore
+	ImageStore,
+	// agents are drawn as GL_POINTS into the trail texture with additive blending
+	PointRaster,
+	// like ImageStore, but same-texel deposits are merged within a subgroup first.
+	// falls back to ImageStore when GL_KHR_shader_subgroup is not available
+	Subgroup
+};
+
+enum class UpdateMode {
+	// one invocation per agent (per pair of agents for the packed layout), sensing straight from the trail image
+	PerAgent,
+	// agents are binned into TILE_SIZE tiles with a counting sort every frame, then one work group per tile
+	// updates the tile's agents against a shared-memory copy of the tile and its sensor halo
+	TileBinned
+};
+
+enum class TrailStorage {
+	// the trail textures are allocated for the whole grid
+	Dense,
+	// the trail textures only hold memory for pages near trail or agents, see SparseTrail.hpp.
+	// falls back to Dense when sparse textures are not supported
+	Sparse
+};
+
+enum class DiffuseMode {
+	// diffuse every texel of the grid each step
+	Full,
+	// flags tiles where agents deposit or diffuse leaves trail, and diffuses only the flagged tiles and their
+	// neighbours through an indirect dispatch. Skipped tiles are all zeros, so the result is the same as Full
+	ActiveTiles
+};
+
+// Steering and trail parameters of an ensemble member, see parameters.glsl. The defaults are the constants a single
+// simulation runs with. Laid out like the std140 array elements of the uniform buffer
+struct MemberParameters {
+	// degrees between the forward and the side sensors
+	float sensorAngle = 45.0f;
+	// texels from the agent to its sensors
+	float sensorDistance = 5.0f;
+	// turns per step at full steering
+	float turnSpeed = 0.20f;
+	// texels per step
+	float moveSpeed = 1.0f;
+	// share of the blurred trail mixed into each texel
+	float diffuseWeight = 0.4f;
+	// trail lost per step
+	float decay = 0.010f;
+	float padding[2] = { 0.0f, 0.0f };
+};
+
+// the arguments of the MemberParameters constructor in parameters.glsl, for compiling them into a single simulation
+std::string getParameterArguments(const MemberParameters& parameters) {
+	char arguments[256];
+	snprintf(arguments, sizeof(arguments), "%.9e, %.9e, %.9e, %.9e, %.9e, %.9e", parameters.sensorAngle, parameters.sensorDistance,
+			parameters.turnSpeed, parameters.moveSpeed, parameters.diffuseWeight, parameters.decay);
+	return arguments;
+}
+
+struct SimulationSettings {
+	int width = 1000;
+	int height = 1000;
+	int agentCount = 100000;
+	AgentLayout agentLayout = AgentLayout::Structure;
+	DepositMode depositMode = DepositMode::ImageStore;
+	UpdateMode updateMode = UpdateMode::PerAgent;
+	DiffuseMode diffuseMode = DiffuseMode::Full;
+	TrailStorage trailStorage = TrailStorage::Dense;
+	// 0 keeps each trail buffer in one texture, which caps the grid at GL_MAX_TEXTURE_SIZE. Otherwise the grid
+	// is split into square domains of this size, the layers of an array texture (see trail.glsl), and the
+	// display is downscaled to fit a texture. Domains don't support point deposits, sparse storage, resizing
+	// and anything that reads the trail as one texture (checkpoints, keyframes, trail capture)
+	int domainSize = 0;
+	// Runs one subdomain of a distributed run, the grid size being the whole grid's, or nullptr for all of it. The
+	// agents are then generated only in this subdomain and steered by their id, so the result matches a single
+	// process. Needs point deposits, an unpacked agent layout and per agent updates, and doesn't support resizing,
+	// domains, snapshots or anything that reads the state as a whole
+	SubdomainExchange* exchange = nullptr;
+	// 0 runs one simulation. Otherwise this many independent simulations of the grid size, each with agentCount
+	// agents and the parameters of its entry in memberParameters (the defaults past its end), are advanced by the
+	// same dispatches: the members' trails are the layers of array textures and their agents follow each other
+	// in one buffer. Ensembles need image store deposits, per agent updates and full diffuse, and don't support
+	// domains, subdomains, resizing or anything that reads the trail as one texture. The display shows member 0
+	int ensembleSize = 0;
+	// a single simulation compiles the first entry into its shaders, or the defaults when there is none
+	std::vector<MemberParameters> memberParameters;
+	// number of display textures the copy pass can write into, see setDisplaySlot()
+	int displayBufferCount = 1;
+	// false leaves the agent buffers uninitialized for a snapshot loaded right after setup
+	bool randomAgents = true;
+	// replaying a step from the same state gives the same result, as keyframe seeking needs: deposits that race
+	// are replaced by point deposits and setAgentFraction() keeps every agent updating
+	bool reproducible = false;
 };
 
+// settings for the grid size, agent count and layout of a saved state, which setState() fills in after setup
+expected<SimulationSettings, std::string> getStateSettings(const SnapshotHeader& header, SimulationSettings settings) {
+	if (header.agentLayout > static_cast<uint32_t>(AgentLayout::FixedPoint)) {
+		return make_unexpected("the state has an unknown agent layout\n");
+	}
+	settings.width = static_cast<int>(header.width);
+	settings.height = static_cast<int>(header.height);
+	settings.agentCount = static_cast<int>(header.agentCount);
+	settings.agentLayout = static_cast<AgentLayout>(header.agentLayout);
+	settings.randomAgents = false;
+	return settings;
+}
+
+// settings for the grid size, agent count and layout of a snapshot, see SlimeSimulation::loadSnapshot()
+expected<SimulationSettings, std::string> readSnapshotSettings(const std::string& path, SimulationSettings settings) {
+	SnapshotFile file;
+	auto openResult = file.open(path);
+	if (!openResult) {
+		return make_unexpected(openResult.error());
+	}
+	auto result = getStateSettings(file.getHeader(), settings);
+	if (!result) {
+		return make_unexpected(path + ": " + result.error());
+	}
+	return result;
+}
+
+// 16.16 fixed point texels, see AgentLayout::FixedPoint
+uint32_t toFixedPoint(float texels) {
+	return static_cast<uint32_t>(texels) << 16 | static_cast<uint32_t>((texels - floorf(texels)) * 65536.0f);
+}
+
+// the texel of an agent stored in a buffer of the layout, for all but the packed one
+void getStoredAgentTexel(const uint8_t* agent, AgentLayout layout, int& texelX, int& texelY) {
+	if (layout == AgentLayout::FixedPoint) {
+		uint32_t position[2];
+		memcpy(position, agent, sizeof(position));
+		texelX = static_cast<int>(position[0] >> 16);
+		texelY = static_cast<int>(position[1] >> 16);
+	}
+	else {
+		float position[2];
+		memcpy(position, agent, sizeof(position));
+		texelX = static_cast<int>(position[0]);
+		texelY = static_cast<int>(position[1]);
+	}
+}
+
+// must match packPosition() in update.comp
+uint32_t packAgentPosition(float x, float y, int width, int height) {
+	auto packUnorm = [](float value) {
+		return static_cast<uint32_t>(roundf(fminf(fmaxf(value, 0.0f), 1.0f) * 65535.0f));
+	};
+	return packUnorm(x / width) | (packUnorm(y / height) << 16);
+}
+
+// must match packHeading() in update.comp
+uint32_t packAgentHeading(float angle) {
+	float turns = angle / static_cast<float>(M_PI * 2);
+	turns -= floorf(turns);
+	return static_cast<uint32_t>(turns * 65536.0f) & 0xFFFF;
+}
+
+using ColorMap = std::vector<std::array<uint8_t, 4>>;
+
+// black to yellow, the look of presenting the trail texture directly
+ColorMap defaultColorMap() {
+	ColorMap colorMap{};
+	for (int i = 0; i < 256; i++) {
+		colorMap.push_back({ static_cast<uint8_t>(i), static_cast<uint8_t>(i), 0, 255 });
+	}
+	return colorMap;
+}
+
 class SlimeSimulation : public ApplicationBase {
 private:
+	TexturePool texturePool;
 	unsigned int mainTexture;
+	unsigned int copyTexture;
+	std::vector<unsigned int> displayTextures;
+	int displaySlot;
+	unsigned int colorMapTexture;
 	expected<unsigned int, std::string> updateShaderProgram;
 	expected<unsigned int, std::string> diffuseShaderProgram;
 	expected<unsigned int, std::string> copyShaderProgram;
+	expected<unsigned int, std::string> depositShaderProgram;
+	expected<unsigned int, std::string> binCountShaderProgram;
+	expected<unsigned int, std::string> binScanShaderProgram;
+	expected<unsigned int, std::string> binScatterShaderProgram;
+	expected<unsigned int, std::string> updateTilesShaderProgram;
+	expected<unsigned int, std::string> resampleAgentsShaderProgram;
+	expected<unsigned int, std::string> yuvShaderProgram;
+	expected<unsigned int, std::string> sampleAgentsShaderProgram;
+	expected<unsigned int, std::string> renderTileShaderProgram;
+	expected<unsigned int, std::string> markTrailPagesShaderProgram;
+	expected<unsigned int, std::string> markAgentPagesShaderProgram;
+	expected<unsigned int, std::string> compactTilesShaderProgram;
+	expected<unsigned int, std::string> migrateAgentsShaderProgram;
 
 	int mainTextureWidth;
 	int mainTextureHeight;
 	int agentCount;
-public:
-	SlimeSimulation() {
-		mainTexture = 0;
-		mainTextureWidth = 1000;
-		mainTextureHeight = 1000;
-		agentCount = 100000;
+	AgentLayout agentLayout;
+	DepositMode depositMode;
+	UpdateMode updateMode;
+	DiffuseMode diffuseMode;
+	TrailStorage trailStorage;
+	int domainSize;
+	int ensembleSize;
+	int agentsPerMember;
+	std::vector<MemberParameters> memberParameters;
+	unsigned int memberParameterBuffer;
+	// grid texels per display pixel
+	int displayScale;
+	bool randomAgents;
+
+	SubdomainExchange* exchange;
+	// agents the agent and migration buffers of a subdomain have room for
+	int agentCapacity;
+	unsigned int migrationBuffer;
+	// the migration counters and leaving agents are copied here and read once a fence says they arrived
+	unsigned int migrationReadbackBuffer;
+	// the halos sent to the neighbours are read back through this in one go
+	unsigned int haloBuffer;
+
+	unsigned int agentBuffer;
+	unsigned int headingBuffer;
+
+	unsigned int tileCountBuffer;
+	unsigned int tileOffsetBuffer;
+	unsigned int tileCursorBuffer;
+	unsigned int sortedAgentBuffer;
+
+	unsigned int tileActivityBuffer;
+	unsigned int tileListBuffer;
+	// which half of the tile activity buffer the current step flags, see active_tiles.glsl
+	unsigned int activityParity;
+
+	unsigned int depositFramebuffer;
+	unsigned int depositVertexArray;
+
+	// read and draw framebuffers for resampling the trail texture on resize, the read one also saves snapshots
+	unsigned int resampleFramebuffers[2];
+
+	SparseTrail sparseTrail;
+	int stepsSincePageUpdate;
+
+	GpuTimer gpuTimer;
+	float agentFraction;
+	int agentOffset;
+	bool reproducible;
+
+	int getAgentsPerInvocation() {
+		return agentLayout == AgentLayout::Packed ? 2 : 1;
 	}
 
-	int getWindowWidth() override {
-		return mainTextureWidth;
+	int getUpdateInvocationCount() {
+		return agentCount / getAgentsPerInvocation();
 	}
 
-	int getWindowHeight() override {
-		return mainTextureHeight;
+	// agents updated per step, whole invocations so packed pairs stay together
+	int getActiveAgentCount() {
+		auto agentsPerInvocation = getAgentsPerInvocation();
+		auto activeAgents = static_cast<int>(ceilf(agentCount * agentFraction));
+		activeAgents = (activeAgents + agentsPerInvocation - 1) / agentsPerInvocation * agentsPerInvocation;
+		return std::max(agentsPerInvocation, std::min(agentCount, activeAgents));
 	}
 
-	void setupTextures() override {
-		glGenTextures(1, &mainTexture);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mainTexture);
+	std::vector<std::string> getShaderDefines() {
+		std::vector<std::string> defines{};
+		if (agentLayout == AgentLayout::Packed) {
+			defines.push_back("PACKED_AGENTS");
+		}
+		if (agentLayout == AgentLayout::FixedPoint) {
+			defines.push_back("FIXED_POINT_AGENTS");
+		}
+		if (depositMode == DepositMode::PointRaster) {
+			defines.push_back("POINT_DEPOSIT");
+		}
+		if (depositMode == DepositMode::Subgroup) {
+			defines.push_back("SUBGROUP_DEPOSIT");
+		}
+		if (diffuseMode == DiffuseMode::ActiveTiles) {
+			defines.push_back("ACTIVE_TILES");
+		}
+		defines.push_back("UPDATE_GROUP_SIZE " + std::to_string(UPDATE_GROUP_SIZE));
+		defines.push_back("TILE_SIZE " + std::to_string(TILE_SIZE));
+		defines.push_back("TILE_HALO " + std::to_string(TILE_HALO));
+		defines.push_back("TILE_GROUP_SIZE " + std::to_string(TILE_GROUP_SIZE));
+		defines.push_back("ACTIVE_TILE_SIZE " + std::to_string(ACTIVE_TILE_SIZE));
+		if (exchange != nullptr) {
+			defines.push_back("TRAIL_SUBDOMAIN");
+			defines.push_back("AGENT_IDS");
+		}
+		if (domainSize > 0) {
+			defines.push_back("TRAIL_DOMAINS");
+			defines.push_back("TRAIL_DOMAIN_SIZE " + std::to_string(domainSize));
+		}
+		if (ensembleSize > 0) {
+			defines.push_back("ENSEMBLE");
+			defines.push_back("ENSEMBLE_SIZE " + std::to_string(ensembleSize));
+		}
+		else if (!memberParameters.empty()) {
+			defines.push_back("MEMBER_PARAMETERS " + getParameterArguments(memberParameters[0]));
+		}
+		return defines;
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	int getTilesX() {
+		return (mainTextureWidth + TILE_SIZE - 1) / TILE_SIZE;
+	}
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mainTextureWidth, mainTextureHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
-		glBindImageTexture(0, mainTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	int getTilesY() {
+		return (mainTextureHeight + TILE_SIZE - 1) / TILE_SIZE;
+	}
 
-		unsigned int copyTexture;
-		glGenTextures(1, &copyTexture);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, copyTexture);
+	void setupTileBuffers() {
+		auto tileCount = getTilesX() * getTilesY();
+		unsigned int* buffers[] = { &tileCountBuffer, &tileOffsetBuffer, &tileCursorBuffer, &sortedAgentBuffer };
+		int sizes[] = { tileCount, tileCount, tileCount, agentCount };
+		for (int i = 0; i < 4; i++) {
+			if (*buffers[i] == 0) {
+				glGenBuffers(1, buffers[i]);
+			}
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * sizes[i], nullptr, GL_DYNAMIC_COPY);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4 + i, *buffers[i]);
+		}
+	}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	int getActiveTilesX() {
+		return (mainTextureWidth + ACTIVE_TILE_SIZE - 1) / ACTIVE_TILE_SIZE;
+	}
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mainTextureWidth, mainTextureHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
-		glBindImageTexture(2, copyTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	int getActiveTilesY() {
+		return (mainTextureHeight + ACTIVE_TILE_SIZE - 1) / ACTIVE_TILE_SIZE;
 	}
 
-	unsigned int getMainTexture() override {
-		return mainTexture;
+	// the activity flags of two steps and the indirect dispatch arguments followed by the tile list
+	void setupActiveTileBuffers() {
+		auto tileCount = getActiveTilesX() * getActiveTilesY();
+		if (tileActivityBuffer == 0) {
+			glGenBuffers(1, &tileActivityBuffer);
+			glGenBuffers(1, &tileListBuffer);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileActivityBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * 2 * tileCount, nullptr, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, tileActivityBuffer);
+
+		std::vector<uint32_t> list(3 + tileCount, 0);
+		list[1] = 1;
+		list[2] = 1;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileListBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * list.size(), list.data(), GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, tileListBuffer);
+
+		markAllTilesActive();
 	}
 
-	void setupSSBO() override {
-		unsigned int SSBO;
-		glGenBuffers(1, &SSBO);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
+	// after the trail was replaced from outside the diffuse pass, which then has to see all of it once
+	void markAllTilesActive() {
+		uint32_t active = 1;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileActivityBuffer);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &active);
+	}
+
+	// lists the tiles diffuse processes this step into the indirect dispatch arguments
+	void compactActiveTiles() {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileListBuffer);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+		// the update pass flagged the tiles of its deposits
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(*compactTilesShaderProgram);
+		glUniform1ui(glGetUniformLocation(*compactTilesShaderProgram, "activityParity"), activityParity);
+		glDispatchCompute((getActiveTilesX() * getActiveTilesY() + 63) / 64, 1, 1);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, tileListBuffer);
+	}
+
+	expected<void, std::string> setupTileBinnedPasses() {
+		expected<unsigned int, std::string>* programs[] = {
+			&binCountShaderProgram, &binScanShaderProgram, &binScatterShaderProgram, &updateTilesShaderProgram
+		};
+		const char* paths[] = { "bin_count.comp", "bin_scan.comp", "bin_scatter.comp", "update_tiles.comp" };
+		for (int i = 0; i < 4; i++) {
+			*programs[i] = buildComputeProgram(paths[i]);
+			if (!*programs[i]) {
+				return make_unexpected(programs[i]->error());
+			}
+		}
+		return {};
+	}
+
+	// counting sort of agent indices by tile: count, exclusive scan, scatter
+	void binAgents() {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileCountBuffer);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+		auto agentGroupCount = (agentCount + UPDATE_GROUP_SIZE - 1) / UPDATE_GROUP_SIZE;
+
+		glUseProgram(*binCountShaderProgram);
+		glDispatchCompute(agentGroupCount, 1, 1);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(*binScanShaderProgram);
+		glDispatchCompute(1, 1, 1);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(*binScatterShaderProgram);
+		glDispatchCompute(agentGroupCount, 1, 1);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	expected<void, std::string> setupDepositPass() {
+		auto builder = ShaderProgramBuilder();
+		auto vertexResult = builder.attachShader(GL_VERTEX_SHADER, "deposit.vert", getShaderDefines());
+		if (!vertexResult) {
+			return vertexResult;
+		}
+		auto fragmentResult = builder.attachShader(GL_FRAGMENT_SHADER, "deposit.frag", getShaderDefines());
+		if (!fragmentResult) {
+			return fragmentResult;
+		}
+		depositShaderProgram = builder.getShaderProgram();
+		if (!depositShaderProgram) {
+			return make_unexpected(depositShaderProgram.error());
+		}
+
+		glGenFramebuffers(1, &depositFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, depositFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTexture, 0);
+		auto framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE) {
+			return make_unexpected("deposit framebuffer is incomplete\n");
+		}
+
+		// the agent buffer is read directly as a vertex stream, only the positions are needed
+		glGenVertexArrays(1, &depositVertexArray);
+		glBindVertexArray(depositVertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, agentBuffer);
+		if (agentLayout == AgentLayout::Packed) {
+			glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+		}
+		else if (agentLayout == AgentLayout::FixedPoint) {
+			glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(Agent), (void*)0);
+		}
+		else {
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Agent), (void*)0);
+		}
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+
+		return {};
+	}
+
+	// draws agents [first, first + count)
+	void deposit(int first, int count) {
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		auto trail = getTrailRect();
+		glBindFramebuffer(GL_FRAMEBUFFER, depositFramebuffer);
+		glViewport(0, 0, trail.width, trail.height);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+
+		glUseProgram(*depositShaderProgram);
+		glBindVertexArray(depositVertexArray);
+		glDrawArrays(GL_POINTS, first, count);
+		glBindVertexArray(0);
+
+		glDisable(GL_BLEND);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	}
+
+	// the texels whose trail this process keeps, the subdomain and its halo in a distributed run
+	GridRect getTrailRect() {
+		return exchange != nullptr ? exchange->getTrailRect() : GridRect{ 0, 0, mainTextureWidth, mainTextureHeight };
+	}
+
+	// the texels this process simulates and displays
+	GridRect getOwnedRect() {
+		return exchange != nullptr ? exchange->getOwned() : GridRect{ 0, 0, mainTextureWidth, mainTextureHeight };
+	}
+
+	// the texels of rect whose diffuse neighbourhood is within it, rect itself along the grid edges where
+	// diffuse clamps its reads
+	GridRect insetFromNeighbours(const GridRect& rect) {
+		auto left = rect.x > 0 ? 1 : 0;
+		auto bottom = rect.y > 0 ? 1 : 0;
+		auto right = rect.x + rect.width < mainTextureWidth ? 1 : 0;
+		auto top = rect.y + rect.height < mainTextureHeight ? 1 : 0;
+		return { rect.x + left, rect.y + bottom, rect.width - left - right, rect.height - bottom - top };
+	}
+
+	int getMemberCount() {
+		return ensembleSize > 0 ? ensembleSize : 1;
+	}
+
+	// whether the trail textures are array textures
+	bool isLayered() {
+		return domainSize > 0 || ensembleSize > 0;
+	}
+
+	// one ACTIVE_TILE_SIZE work group per tile of region and ensemble member, for diffuse and copy with the program in use
+	void dispatchRegion(unsigned int program, const GridRect& region) {
+		if (region.isEmpty()) {
+			return;
+		}
+		glUniform4i(glGetUniformLocation(program, "region"), region.x, region.y, region.width, region.height);
+		glDispatchCompute((region.width + ACTIVE_TILE_SIZE - 1) / ACTIVE_TILE_SIZE, (region.height + ACTIVE_TILE_SIZE - 1) / ACTIVE_TILE_SIZE,
+				getMemberCount());
+	}
+
+	int getDomainsX() {
+		return (mainTextureWidth + domainSize - 1) / domainSize;
+	}
+
+	int getDomainsY() {
+		return (mainTextureHeight + domainSize - 1) / domainSize;
+	}
+
+	unsigned int createArrayTexture(int width, int height, int layers) {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA32F, width, height, layers);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return texture;
+	}
+
+	// the grid textures come from the pool, so a resize back to an earlier size reuses its textures
+	// (a sparse or domain split trail has its own textures, see reallocateGrid())
+	void acquireGridTextures() {
+		if (domainSize > 0) {
+			// every domain is a whole layer, also those at the right and bottom edges the grid only covers in part
+			mainTexture = createArrayTexture(domainSize, domainSize, getDomainsX() * getDomainsY());
+			copyTexture = createArrayTexture(domainSize, domainSize, getDomainsX() * getDomainsY());
+		}
+		else if (ensembleSize > 0) {
+			mainTexture = createArrayTexture(mainTextureWidth, mainTextureHeight, ensembleSize);
+			copyTexture = createArrayTexture(mainTextureWidth, mainTextureHeight, ensembleSize);
+		}
+		else if (trailStorage == TrailStorage::Sparse) {
+			mainTexture = sparseTrail.getTexture(0);
+			copyTexture = sparseTrail.getTexture(1);
+		}
+		else {
+			auto trail = getTrailRect();
+			mainTexture = texturePool.acquire(trail.width, trail.height, GL_RGBA32F);
+			copyTexture = texturePool.acquire(trail.width, trail.height, GL_RGBA32F);
+		}
+		auto layered = isLayered() ? GL_TRUE : GL_FALSE;
+		glBindImageTexture(0, mainTexture, 0, layered, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(2, copyTexture, 0, layered, 0, GL_READ_WRITE, GL_RGBA32F);
 
+		int maxTextureSize;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+		auto owned = getOwnedRect();
+		displayScale = (std::max(owned.width, owned.height) + maxTextureSize - 1) / maxTextureSize;
+
+		// image stores can't target sRGB formats, so the color map itself carries any gamma
+		for (auto &displayTexture : displayTextures) {
+			displayTexture = texturePool.acquire(getDisplayWidth(), getDisplayHeight(), GL_RGBA8);
+		}
+		setDisplaySlot(displaySlot);
+	}
+
+	// Calls copy for the parts of grid rows [firstRow, firstRow + rowCount) in each trail texture or domain
+	// they cross, with the rectangle within the domain's layer and the byte offset of its first texel in
+	// data holding those rows
+	void forEachTrailRect(int firstRow, int rowCount,
+			const std::function<void(int layer, int x, int y, int width, int height, size_t offset)>& copy) {
+		auto rowSize = static_cast<size_t>(mainTextureWidth) * 4 * sizeof(float);
+		if (domainSize == 0) {
+			copy(0, 0, firstRow, mainTextureWidth, rowCount, 0);
+			return;
+		}
+		for (auto row = firstRow; row < firstRow + rowCount;) {
+			auto domainY = row / domainSize;
+			auto rows = std::min(firstRow + rowCount, (domainY + 1) * domainSize) - row;
+			for (int domainX = 0; domainX < getDomainsX(); domainX++) {
+				auto x = domainX * domainSize;
+				copy(domainX + domainY * getDomainsX(), 0, row - domainY * domainSize, std::min(domainSize, mainTextureWidth - x), rows,
+						rowSize * (row - firstRow) + sizeof(float) * 4 * x);
+			}
+			row += rows;
+		}
+	}
+
+	// grid size and agent count uniforms of every built program, unused names are ignored by GL
+	void setSizeUniforms() {
+		expected<unsigned int, std::string>* programs[] = {
+			&updateShaderProgram, &diffuseShaderProgram, &copyShaderProgram, &depositShaderProgram,
+			&binCountShaderProgram, &binScanShaderProgram, &binScatterShaderProgram, &updateTilesShaderProgram,
+			&resampleAgentsShaderProgram, &markTrailPagesShaderProgram, &markAgentPagesShaderProgram, &compactTilesShaderProgram,
+			&migrateAgentsShaderProgram, &renderTileShaderProgram
+		};
+		auto trail = getTrailRect();
+		auto owned = getOwnedRect();
+		for (auto program : programs) {
+			if (!*program || **program == 0) {
+				continue;
+			}
+			glUseProgram(**program);
+			glUniform1i(glGetUniformLocation(**program, "width"), mainTextureWidth);
+			glUniform1i(glGetUniformLocation(**program, "height"), mainTextureHeight);
+			glUniform1ui(glGetUniformLocation(**program, "agentCount"), agentCount);
+			glUniform1ui(glGetUniformLocation(**program, "agentsPerMember"), agentsPerMember);
+			glUniform1ui(glGetUniformLocation(**program, "invocationCount"), getUpdateInvocationCount());
+			glUniform1ui(glGetUniformLocation(**program, "tileCount"), getTilesX() * getTilesY());
+			glUniform1ui(glGetUniformLocation(**program, "activeTileCount"), getActiveTilesX() * getActiveTilesY());
+			glUniform1i(glGetUniformLocation(**program, "displayScale"), displayScale);
+			glUniform2i(glGetUniformLocation(**program, "pageSize"), sparseTrail.getPageWidth(), sparseTrail.getPageHeight());
+			glUniform2i(glGetUniformLocation(**program, "trailOrigin"), trail.x, trail.y);
+			glUniform2i(glGetUniformLocation(**program, "trailSize"), trail.width, trail.height);
+			glUniform2i(glGetUniformLocation(**program, "displayOrigin"), owned.x, owned.y);
+			glUniform4i(glGetUniformLocation(**program, "ownedRect"), owned.x, owned.y, owned.width, owned.height);
+		}
+	}
+
+	// bilinear copy of the old trail texture into the current one
+	void resampleTrail(unsigned int sourceTexture, int sourceWidth, int sourceHeight) {
+		if (resampleFramebuffers[0] == 0) {
+			glGenFramebuffers(2, resampleFramebuffers);
+		}
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, resampleFramebuffers[0]);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sourceTexture, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resampleFramebuffers[1]);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTexture, 0);
+
+		glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, 0, 0, mainTextureWidth, mainTextureHeight,
+				GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	expected<void, std::string> validateGridSize(int width, int height) {
+		int maxTextureSize;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+		if (domainSize > 0) {
+			int maxLayers;
+			glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+			auto domains = static_cast<int64_t>((width + domainSize - 1) / domainSize) * ((height + domainSize - 1) / domainSize);
+			if (width < 1 || height < 1 || domainSize > maxTextureSize || domains > maxLayers) {
+				return make_unexpected("grid size " + std::to_string(width) + "x" + std::to_string(height) + " needs " +
+						std::to_string(domains) + " domains of " + std::to_string(domainSize) + " texels, the limit is " +
+						std::to_string(maxLayers) + " domains of " + std::to_string(maxTextureSize) + "\n");
+			}
+			return {};
+		}
+		if (agentLayout == AgentLayout::FixedPoint && (width > 65535 || height > 65535)) {
+			return make_unexpected("grid size " + std::to_string(width) + "x" + std::to_string(height) +
+					" exceeds the 65535 texels of fixed point agent positions\n");
+		}
+		if (width < 1 || height < 1 || width > maxTextureSize || height > maxTextureSize) {
+			return make_unexpected("grid size " + std::to_string(width) + "x" + std::to_string(height) +
+					" is not within 1.." + std::to_string(maxTextureSize) + "\n");
+		}
+		if (trailStorage == TrailStorage::Sparse && !sparseTrail.canCover(width, height)) {
+			return make_unexpected("grid size " + std::to_string(width) + "x" + std::to_string(height) +
+					" exceeds the sparse texture size\n");
+		}
+		return {};
+	}
+
+	// swaps the grid textures for ones of the new size, optionally resampling the trail into them
+	void reallocateGrid(int width, int height, bool keepTrail) {
+		auto oldWidth = mainTextureWidth;
+		auto oldHeight = mainTextureHeight;
+		auto oldMainTexture = mainTexture;
+		auto oldTextures = displayTextures;
+		oldTextures.push_back(mainTexture);
+		oldTextures.push_back(copyTexture);
+
+		std::array<unsigned int, 2> oldSparseTextures{};
+		if (trailStorage == TrailStorage::Sparse) {
+			oldSparseTextures = sparseTrail.reallocate(width, height, keepTrail);
+		}
+
+		// textures released by the previous resize have left the frame exchange by now
+		texturePool.trim(width, height);
+
+		mainTextureWidth = width;
+		mainTextureHeight = height;
+		acquireGridTextures();
+		if (keepTrail) {
+			resampleTrail(oldMainTexture, oldWidth, oldHeight);
+		}
+
+		for (auto const &texture : oldTextures) {
+			texturePool.release(texture);
+		}
+		if (trailStorage == TrailStorage::Sparse) {
+			glDeleteTextures(2, oldSparseTextures.data());
+		}
+		if (domainSize > 0) {
+			glDeleteTextures(1, &oldMainTexture);
+			glDeleteTextures(1, &oldTextures.back());
+		}
+
+		if (updateMode == UpdateMode::TileBinned) {
+			setupTileBuffers();
+		}
+		if (diffuseMode == DiffuseMode::ActiveTiles) {
+			setupActiveTileBuffers();
+		}
+
+		if (depositFramebuffer != 0) {
+			glBindFramebuffer(GL_FRAMEBUFFER, depositFramebuffer);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTexture, 0);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+
+		setSizeUniforms();
+	}
+
+	size_t getAgentBufferSize() {
+		return agentLayout == AgentLayout::Packed ? sizeof(uint32_t) * agentCount : sizeof(Agent) * agentCount;
+	}
+
+	// one uint32 per pair of agents
+	size_t getHeadingBufferSize() {
+		return sizeof(uint32_t) * (agentCount / 2);
+	}
+
+	size_t getTrailSize() {
+		return static_cast<size_t>(mainTextureWidth) * mainTextureHeight * 4 * sizeof(float);
+	}
+
+	void allocateAgentBuffers() {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, getAgentBufferSize(), nullptr, GL_DYNAMIC_COPY);
+		if (agentLayout == AgentLayout::Packed) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, headingBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, getHeadingBufferSize(), nullptr, GL_DYNAMIC_COPY);
+		}
+	}
+
+	// creates the sparse trail textures, without any pages committed yet
+	expected<void, std::string> setupSparseTrail() {
+		if (!supportsSparseTrail()) {
+			return make_unexpected("sparse textures are not supported\n");
+		}
+		auto result = sparseTrail.setup();
+		if (!result) {
+			return result;
+		}
+		if (!sparseTrail.canCover(mainTextureWidth, mainTextureHeight)) {
+			return make_unexpected("the grid exceeds the sparse texture size\n");
+		}
+		sparseTrail.reallocate(mainTextureWidth, mainTextureHeight, false);
+		return {};
+	}
+
+	// flags the sparse trail pages of the agents in data laid out like the agent buffer
+	void flagAgentPages(std::vector<uint8_t>& flags, const uint8_t* agents) {
+		for (int i = 0; i < agentCount; i++) {
+			float x, y;
+			if (agentLayout == AgentLayout::Packed) {
+				uint32_t position;
+				memcpy(&position, agents + sizeof(uint32_t) * i, sizeof(position));
+				x = (position & 0xFFFF) / 65535.0f * mainTextureWidth;
+				y = (position >> 16) / 65535.0f * mainTextureHeight;
+			}
+			else {
+				int texelX, texelY;
+				getStoredAgentTexel(agents + sizeof(Agent) * i, agentLayout, texelX, texelY);
+				x = static_cast<float>(texelX);
+				y = static_cast<float>(texelY);
+			}
+			flags[sparseTrail.getPageIndex(x, y)] = 1;
+		}
+	}
+
+	// flags the sparse trail pages with any trail in data laid out like the trail section
+	void flagTrailPages(std::vector<uint8_t>& flags, const uint8_t* trail) {
+		auto rowSize = static_cast<size_t>(mainTextureWidth) * 4 * sizeof(float);
+		auto pageWidth = sparseTrail.getPageWidth();
+		for (int y = 0; y < mainTextureHeight; y++) {
+			for (int x = 0; x < mainTextureWidth; x++) {
+				float texel[4];
+				memcpy(texel, trail + rowSize * y + sizeof(texel) * x, sizeof(texel));
+				if (texel[0] > 0.0f || texel[1] > 0.0f || texel[2] > 0.0f || texel[3] > 0.0f) {
+					flags[sparseTrail.getPageIndex(static_cast<float>(x), static_cast<float>(y))] = 1;
+					// on to the next page of the row
+					x = (x / pageWidth + 1) * pageWidth - 1;
+				}
+			}
+		}
+	}
+
+	// flags the pages holding trail or agents on the GPU and reads them back for the SparseTrail to apply
+	void markActivePages() {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, sparseTrail.getPageFlagBuffer());
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+		glUseProgram(*markTrailPagesShaderProgram);
+		glDispatchCompute(sparseTrail.getPagesX(), sparseTrail.getPagesY(), 1);
+
+		glUseProgram(*markAgentPagesShaderProgram);
+		glDispatchCompute((agentCount + UPDATE_GROUP_SIZE - 1) / UPDATE_GROUP_SIZE, 1, 1);
+
+		sparseTrail.readPageFlags();
+	}
+
+	// after every step. Once an interval has passed the page flags in flight are waited for, so the margin
+	// around the committed pages always holds, see SparseTrail::getUpdateInterval()
+	void updateSparseTrail() {
+		stepsSincePageUpdate++;
+		auto due = stepsSincePageUpdate >= sparseTrail.getUpdateInterval();
+		sparseTrail.update(due);
+		if (!due || sparseTrail.isReadingPageFlags()) {
+			return;
+		}
+		stepsSincePageUpdate = 0;
+		markActivePages();
+	}
+
+	void generateRandomAgents() {
 		std::vector<Agent> agents{};
 		for (int i = 0; i < agentCount; i++) {
-			Agent agent = { randomInt(0, mainTextureWidth), randomInt(0, mainTextureHeight), randomFloat(0.0f, M_PI * 2) };
+			Agent agent = { { randomInt(0, mainTextureWidth), randomInt(0, mainTextureHeight) }, randomFloat(0.0f, M_PI * 2),
+					static_cast<uint32_t>(i) };
 			//Agent agent = { randomInt((mainTextureWidth / 2) - mainTextureWidth / 16, (mainTextureWidth / 2) + mainTextureWidth / 16),
 		//					randomInt((mainTextureWidth / 2) - mainTextureWidth / 16, (mainTextureWidth / 2) + mainTextureWidth / 16),
 		//					randomFloat(0.0f, M_PI * 2) };
 			agents.push_back(agent);
 		}
-		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Agent) * agents.size(), agents.data(), GL_DYNAMIC_COPY);
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, SSBO);
+		// a subdomain keeps the agents a single process would have placed in it
+		if (exchange != nullptr) {
+			auto owned = getOwnedRect();
+			agents.erase(std::remove_if(agents.begin(), agents.end(), [&](const Agent& agent) {
+				return !owned.contains(static_cast<int>(agent.position[0]), static_cast<int>(agent.position[1]));
+			}), agents.end());
+			agentCount = static_cast<int>(agents.size());
+			agentCapacity = std::max(2 * agentCount, UPDATE_GROUP_SIZE);
+		}
+
+		if (trailStorage == TrailStorage::Sparse) {
+			auto flags = sparseTrail.createPageFlags();
+			for (auto const &agent : agents) {
+				flags[sparseTrail.getPageIndex(agent.position[0], agent.position[1])] = 1;
+			}
+			sparseTrail.setPages(flags);
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentBuffer);
+
+		if (agentLayout == AgentLayout::Packed) {
+			std::vector<uint32_t> positions{};
+			std::vector<uint32_t> headings{};
+			for (int i = 0; i < agentCount; i += 2) {
+				auto const &first = agents[i];
+				auto const &second = agents[i + 1];
+				positions.push_back(packAgentPosition(first.position[0], first.position[1], mainTextureWidth, mainTextureHeight));
+				positions.push_back(packAgentPosition(second.position[0], second.position[1], mainTextureWidth, mainTextureHeight));
+				headings.push_back(packAgentHeading(first.angle) | (packAgentHeading(second.angle) << 16));
+			}
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * positions.size(), positions.data(), GL_DYNAMIC_COPY);
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, headingBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * headings.size(), headings.data(), GL_DYNAMIC_COPY);
+		}
+		else {
+			// the same bytes, the positions become fixed point in place
+			if (agentLayout == AgentLayout::FixedPoint) {
+				for (auto &agent : agents) {
+					uint32_t position[2] = { toFixedPoint(agent.position[0]), toFixedPoint(agent.position[1]) };
+					memcpy(agent.position, position, sizeof(position));
+				}
+			}
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Agent) * std::max<size_t>(agentCapacity, agents.size()), nullptr, GL_DYNAMIC_COPY);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Agent) * agents.size(), agents.data());
+		}
+	}
+
+	// room for agentCapacity agents, with the counters reset
+	void allocateMigrationBuffer() {
+		uint32_t header[4] = { 0, 0, static_cast<uint32_t>(agentCapacity), 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, migrationBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, MIGRATION_HEADER_SIZE + sizeof(Agent) * agentCapacity, nullptr, GL_DYNAMIC_COPY);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), header);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, migrationReadbackBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, MIGRATION_HEADER_SIZE + sizeof(Agent) * agentCapacity, nullptr, GL_STREAM_READ);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// waits for the commands before the fence, those queued after it keep the GPU busy meanwhile
+	void waitForFence(GLsync fence) {
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fence);
+	}
+
+	void readMigration(size_t offset, size_t size, void* data) {
+		glBindBuffer(GL_COPY_READ_BUFFER, migrationReadbackBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, offset, size, data);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	// grows the agent and migration buffers to hold count agents, the kept ones are copied into the agent buffer
+	// again from the migration buffer
+	void reserveAgents(int count, int keptCount) {
+		if (count <= agentCapacity) {
+			return;
+		}
+		agentCapacity = std::max(count, 2 * agentCapacity);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Agent) * agentCapacity, nullptr, GL_DYNAMIC_COPY);
+		copyBufferRange(migrationBuffer, MIGRATION_HEADER_SIZE, agentBuffer, 0, sizeof(Agent) * keptCount);
+		allocateMigrationBuffer();
+	}
+
+	// Trades the agents that left the subdomain in the last update for those that entered it. The kept ones are
+	// deposited while the leaving ones are read back and the neighbours are waited for, blending makes the order
+	// of the deposits irrelevant. Only reading the counters waits for an idle GPU, as nothing can be queued
+	// before they are known
+	void migrateAgents(int time) {
+		uint32_t counters[2] = { 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, migrationBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glUseProgram(*migrateAgentsShaderProgram);
+		glDispatchCompute((agentCount + UPDATE_GROUP_SIZE - 1) / UPDATE_GROUP_SIZE, 1, 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		copyBufferRange(migrationBuffer, 0, migrationReadbackBuffer, 0, sizeof(counters));
+		waitForFence(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		readMigration(0, sizeof(counters), counters);
+		auto keptCount = static_cast<int>(counters[0]);
+		auto leavingCount = static_cast<int>(counters[1]);
+
+		auto leavingOffset = MIGRATION_HEADER_SIZE + sizeof(Agent) * (agentCapacity - leavingCount);
+		std::vector<uint8_t> leaving (sizeof(Agent) * leavingCount);
+		copyBufferRange(migrationBuffer, leavingOffset, migrationReadbackBuffer, leavingOffset, leaving.size());
+		auto leavingFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		copyBufferRange(migrationBuffer, MIGRATION_HEADER_SIZE, agentBuffer, 0, sizeof(Agent) * keptCount);
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+		deposit(0, keptCount);
+		waitForFence(leavingFence);
+		readMigration(leavingOffset, leaving.size(), leaving.data());
+
+		auto arrived = exchange->exchangeAgents(time, leaving.data(), leavingCount, sizeof(Agent),
+				[this](const uint8_t* agent, int& texelX, int& texelY) {
+			getStoredAgentTexel(agent, agentLayout, texelX, texelY);
+		});
+		auto arrivedCount = static_cast<int>(arrived.size() / sizeof(Agent));
+		reserveAgents(keptCount + arrivedCount, keptCount);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Agent) * keptCount, arrived.size(), arrived.data());
+
+		agentCount = keptCount + arrivedCount;
+		setSizeUniforms();
+		deposit(keptCount, arrivedCount);
+	}
+
+	// Sends the neighbours their halos and diffuses the interior of the subdomain, which only reads its own
+	// texels, while theirs arrive. The interior diffuse is queued behind the halo readback's fence, so it also
+	// runs while the halos are mapped and sent. The rest of the trail rectangle is diffused once theirs arrived;
+	// its outermost texels can't be, they are only read by diffuse
+	void exchangeHalos(int time, bool writeDisplay) {
+		auto trail = getTrailRect();
+		auto &neighbours = exchange->getNeighbours();
+
+		if (resampleFramebuffers[0] == 0) {
+			glGenFramebuffers(2, resampleFramebuffers);
+		}
+		glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, resampleFramebuffers[0]);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTexture, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, haloBuffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+		std::vector<size_t> offsets{};
+		size_t haloSize = 0;
+		for (auto neighbour : neighbours) {
+			offsets.push_back(haloSize);
+			haloSize += exchange->getHaloSent(neighbour).getArea() * 4 * sizeof(float);
+		}
+		glBufferData(GL_PIXEL_PACK_BUFFER, haloSize, nullptr, GL_STREAM_READ);
+		for (size_t i = 0; i < neighbours.size(); i++) {
+			auto rect = exchange->getHaloSent(neighbours[i]);
+			glReadPixels(rect.x - trail.x, rect.y - trail.y, rect.width, rect.height, GL_RGBA, GL_FLOAT, reinterpret_cast<void*>(offsets[i]));
+		}
+		auto haloFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		auto interior = insetFromNeighbours(getOwnedRect());
+		auto diffused = insetFromNeighbours(trail);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glUseProgram(*diffuseShaderProgram);
+		dispatchRegion(*diffuseShaderProgram, interior);
+
+		waitForFence(haloFence);
+		if (haloSize > 0) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, haloBuffer);
+			auto texels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, haloSize, GL_MAP_READ_BIT));
+			for (size_t i = 0; i < neighbours.size(); i++) {
+				exchange->sendHalo(time, neighbours[i], reinterpret_cast<const float*>(texels + offsets[i]));
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, mainTexture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		for (auto neighbour : neighbours) {
+			auto texels = exchange->receiveHalo(time, neighbour);
+			if (exchange->hasFailed()) {
+				break;
+			}
+			auto rect = exchange->getHaloReceived(neighbour);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x - trail.x, rect.y - trail.y, rect.width, rect.height, GL_RGBA, GL_FLOAT, texels.data());
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// the part of the diffused rectangle around the interior, in up to four strips
+		interior.width = std::max(0, interior.width);
+		interior.height = std::max(0, interior.height);
+		GridRect ring[] = {
+			{ diffused.x, diffused.y, diffused.width, interior.y - diffused.y },
+			{ diffused.x, interior.y + interior.height, diffused.width, diffused.y + diffused.height - interior.y - interior.height },
+			{ diffused.x, interior.y, interior.x - diffused.x, interior.height },
+			{ interior.x + interior.width, interior.y, diffused.x + diffused.width - interior.x - interior.width, interior.height }
+		};
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+		glUseProgram(*diffuseShaderProgram);
+		for (auto const &rect : ring) {
+			dispatchRegion(*diffuseShaderProgram, rect);
+		}
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		glUseProgram(*copyShaderProgram);
+		glUniform1i(glGetUniformLocation(*copyShaderProgram, "writeDisplay"), writeDisplay);
+		dispatchRegion(*copyShaderProgram, diffused);
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// Moves size bytes out of GL through the staging ring into the writer, in pieces of whole units.
+	// copy records the GL commands for one piece; pieces are written out a whole ring behind the copies
+	void downloadSection(StagingBuffer& staging, size_t size, size_t unit, SnapshotWriter& writer,
+			const std::function<void(size_t stagingOffset, size_t offset, size_t bytes)>& copy) {
+		auto pieceSize = staging.getChunkSize() / unit * unit;
+		std::deque<std::pair<int, size_t>> pending{};
+		auto writeOldest = [&]() {
+			auto chunk = pending.front().first;
+			staging.wait(chunk);
+			writer.write(staging.map(chunk), pending.front().second);
+			staging.unmap();
+			pending.pop_front();
+		};
+
+		for (size_t offset = 0; offset < size; offset += pieceSize) {
+			if (static_cast<int>(pending.size()) == staging.getChunkCount()) {
+				writeOldest();
+			}
+			auto bytes = std::min(pieceSize, size - offset);
+			auto chunk = staging.acquire();
+			copy(staging.getOffset(chunk), offset, bytes);
+			staging.fence(chunk);
+			pending.push_back({ chunk, bytes });
+		}
+		while (!pending.empty()) {
+			writeOldest();
+		}
+	}
+
+	// Moves size bytes from memory through the staging ring into GL, in pieces of whole units
+	void uploadSection(StagingBuffer& staging, const uint8_t* data, size_t size, size_t unit,
+			const std::function<void(size_t stagingOffset, size_t offset, size_t bytes)>& copy) {
+		auto pieceSize = staging.getChunkSize() / unit * unit;
+		for (size_t offset = 0; offset < size; offset += pieceSize) {
+			auto bytes = std::min(pieceSize, size - offset);
+			auto chunk = staging.acquire();
+			memcpy(staging.map(chunk), data + offset, bytes);
+			staging.unmap();
+			copy(staging.getOffset(chunk), offset, bytes);
+			staging.fence(chunk);
+		}
+	}
+
+	void copyBufferRange(unsigned int source, size_t sourceOffset, unsigned int target, size_t targetOffset, size_t bytes) {
+		glBindBuffer(GL_COPY_READ_BUFFER, source);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset, targetOffset, bytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	expected<unsigned int, std::string> buildComputeProgram(const std::string& path) {
+		auto builder = ShaderProgramBuilder();
+		auto result = builder.attachShader(GL_COMPUTE_SHADER, path, getShaderDefines());
+		if (!result) {
+			return make_unexpected(result.error());
+		}
+		return builder.getShaderProgram();
+	}
+public:
+	SlimeSimulation(const SimulationSettings& settings = SimulationSettings()) {
+		mainTexture = 0;
+		copyTexture = 0;
+		displayTextures = std::vector<unsigned int>(settings.displayBufferCount, 0);
+		displaySlot = 0;
+		colorMapTexture = 0;
+		mainTextureWidth = settings.width;
+		mainTextureHeight = settings.height;
+		agentCount = settings.agentCount;
+		agentLayout = settings.agentLayout;
+		depositMode = settings.depositMode;
+		updateMode = settings.updateMode;
+		diffuseMode = settings.diffuseMode;
+		trailStorage = settings.trailStorage;
+		domainSize = settings.domainSize;
+		ensembleSize = std::max(0, settings.ensembleSize);
+		agentsPerMember = agentCount;
+		memberParameters = settings.memberParameters;
+		memberParameterBuffer = 0;
+		displayScale = 1;
+		randomAgents = settings.randomAgents;
+		exchange = settings.exchange;
+		agentCapacity = 0;
+		migrationBuffer = 0;
+		migrationReadbackBuffer = 0;
+		haloBuffer = 0;
+		// ensembles don't support the packed layout, see setupTextures()
+		if (ensembleSize > 0) {
+			agentCount = agentsPerMember * ensembleSize;
+		}
+		else if (agentLayout == AgentLayout::Packed) {
+			agentCount += agentCount % 2;
+		}
+
+		agentBuffer = 0;
+		headingBuffer = 0;
+
+		tileCountBuffer = 0;
+		tileOffsetBuffer = 0;
+		tileCursorBuffer = 0;
+		sortedAgentBuffer = 0;
+
+		tileActivityBuffer = 0;
+		tileListBuffer = 0;
+		activityParity = 0;
+
+		depositFramebuffer = 0;
+		depositVertexArray = 0;
+
+		resampleFramebuffers[0] = 0;
+		resampleFramebuffers[1] = 0;
+
+		stepsSincePageUpdate = 0;
+
+		agentFraction = 1.0f;
+		agentOffset = 0;
+		reproducible = settings.reproducible;
+	}
+
+	int getGridWidth() override {
+		return mainTextureWidth;
+	}
+
+	int getGridHeight() override {
+		return mainTextureHeight;
+	}
+
+	int getDisplayWidth() override {
+		return (getOwnedRect().width + displayScale - 1) / displayScale;
+	}
+
+	int getDisplayHeight() override {
+		return (getOwnedRect().height + displayScale - 1) / displayScale;
+	}
+
+	void setupTextures() override {
+		if (agentLayout == AgentLayout::FixedPoint && (mainTextureWidth > 65535 || mainTextureHeight > 65535)) {
+			printf("fixed point agent positions only reach 65535 texels, using the structure agent layout\n");
+			agentLayout = AgentLayout::Structure;
+		}
+		// the agents of a subdomain move between processes, so only the parts of the simulation that neither
+		// depend on their order nor on the whole grid are supported
+		if (exchange != nullptr) {
+			if (domainSize > 0) {
+				printf("subdomains keep their trail in one texture, ignoring the domain size\n");
+				domainSize = 0;
+			}
+			if (agentLayout == AgentLayout::Packed) {
+				printf("subdomains need agent ids, using the structure agent layout\n");
+				agentLayout = AgentLayout::Structure;
+			}
+			if (depositMode != DepositMode::PointRaster) {
+				printf("subdomains deposit the agents after migrating them, using point deposits\n");
+				depositMode = DepositMode::PointRaster;
+			}
+			if (updateMode == UpdateMode::TileBinned) {
+				printf("subdomains don't support tile binned updates, updating per agent\n");
+				updateMode = UpdateMode::PerAgent;
+			}
+			if (diffuseMode == DiffuseMode::ActiveTiles) {
+				printf("subdomains diffuse their interior and halo separately, diffusing all tiles\n");
+				diffuseMode = DiffuseMode::Full;
+			}
+			if (trailStorage == TrailStorage::Sparse) {
+				printf("subdomains don't support sparse trail storage, allocating the whole trail instead\n");
+				trailStorage = TrailStorage::Dense;
+			}
+		}
+		// every pass works on all members at once, those that don't index the trail by member aren't supported
+		if (ensembleSize > 0) {
+			int maxLayers;
+			glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+			if (ensembleSize > maxLayers) {
+				printf("ensembles are limited to %i members\n", maxLayers);
+				ensembleSize = maxLayers;
+				agentCount = agentsPerMember * ensembleSize;
+			}
+			if (domainSize > 0) {
+				printf("ensemble members keep their trail in one layer, ignoring the domain size\n");
+				domainSize = 0;
+			}
+			if (agentLayout == AgentLayout::Packed) {
+				printf("ensembles don't support the packed agent layout, using the structure agent layout\n");
+				agentLayout = AgentLayout::Structure;
+			}
+			if (depositMode != DepositMode::ImageStore) {
+				printf("ensembles deposit into the member's layer, depositing with image stores instead\n");
+				depositMode = DepositMode::ImageStore;
+			}
+			if (updateMode == UpdateMode::TileBinned) {
+				printf("ensembles don't support tile binned updates, updating per agent\n");
+				updateMode = UpdateMode::PerAgent;
+			}
+			if (diffuseMode == DiffuseMode::ActiveTiles) {
+				printf("ensembles don't support active tiles, diffusing all tiles\n");
+				diffuseMode = DiffuseMode::Full;
+			}
+			if (trailStorage == TrailStorage::Sparse) {
+				printf("ensembles don't support sparse trail storage, allocating the whole trail instead\n");
+				trailStorage = TrailStorage::Dense;
+			}
+		}
+		// image store deposits of agents on the same texel overwrite each other in whatever order they run
+		if (reproducible && depositMode != DepositMode::PointRaster) {
+			printf("reproducible steps need race-free deposits, using point deposits\n");
+			depositMode = DepositMode::PointRaster;
+		}
+		if (domainSize > 0 && trailStorage == TrailStorage::Sparse) {
+			printf("sparse trail storage doesn't support domains, allocating the whole trail instead\n");
+			trailStorage = TrailStorage::Dense;
+		}
+		// point sprites are rasterized into a single layer
+		if (domainSize > 0 && depositMode == DepositMode::PointRaster) {
+			printf("point deposits don't support domains, depositing with image stores instead\n");
+			depositMode = DepositMode::ImageStore;
+		}
+		if (trailStorage == TrailStorage::Sparse) {
+			auto sparseResult = setupSparseTrail();
+			if (!sparseResult) {
+				printf("%sallocating the whole trail instead\n", sparseResult.error().c_str());
+				trailStorage = TrailStorage::Dense;
+			}
+		}
+		acquireGridTextures();
+
+		glGenTextures(1, &colorMapTexture);
+		setColorMap(defaultColorMap());
+	}
+
+	unsigned int getMainTexture() override {
+		return mainTexture;
+	}
+
+	unsigned int getDisplayTexture() override {
+		return displayTextures[displaySlot];
+	}
+
+	void setDisplaySlot(int slot) override {
+		displaySlot = slot;
+		glBindImageTexture(3, displayTextures[displaySlot], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	}
+
+	// lookup table from trail intensity (0..1) to display color, applied by the copy pass
+	void setColorMap(const ColorMap& colorMap) {
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_1D, colorMapTexture);
+
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, static_cast<int>(colorMap.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, colorMap.data());
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void setupSSBO() override {
+		glGenBuffers(1, &agentBuffer);
+		if (agentLayout == AgentLayout::Packed) {
+			glGenBuffers(1, &headingBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, headingBuffer);
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, agentBuffer);
+
+		// generating the agents of a large snapshot would take longer than loading it
+		if (randomAgents) {
+			generateRandomAgents();
+		}
+		else {
+			allocateAgentBuffers();
+		}
+
+		if (updateMode == UpdateMode::TileBinned) {
+			setupTileBuffers();
+		}
+		if (diffuseMode == DiffuseMode::ActiveTiles) {
+			setupActiveTileBuffers();
+		}
+		if (ensembleSize > 0) {
+			glGenBuffers(1, &memberParameterBuffer);
+			glBindBufferBase(GL_UNIFORM_BUFFER, 0, memberParameterBuffer);
+			setMemberParameters(memberParameters);
+		}
+		if (exchange != nullptr) {
+			glGenBuffers(1, &migrationBuffer);
+			glGenBuffers(1, &migrationReadbackBuffer);
+			allocateMigrationBuffer();
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, migrationBuffer);
+			glGenBuffers(1, &haloBuffer);
+		}
 	}
 
 	expected<void, std::string> setupShaders() override {
-		auto updateShaderProgramBuilder = ShaderProgramBuilder();
-		auto updateResult = updateShaderProgramBuilder.attachShader(GL_COMPUTE_SHADER, "update.comp");
-		if (!updateResult) {
-			return updateResult;
+		if (depositMode == DepositMode::Subgroup && !supportsSubgroupDeposits()) {
+			printf("subgroup ballot is not supported in compute shaders, using plain imageStore deposits\n");
+			depositMode = DepositMode::ImageStore;
 		}
-		updateShaderProgram = updateShaderProgramBuilder.getShaderProgram();
+
+		gpuTimer.setup();
+
+		updateShaderProgram = buildComputeProgram("update.comp");
 		if (!updateShaderProgram) {
 			return make_unexpected(updateShaderProgram.error());
 		}
 
-		auto diffuseShaderProgramBuilder = ShaderProgramBuilder();
-		auto diffuseResult = diffuseShaderProgramBuilder.attachShader(GL_COMPUTE_SHADER, "diffuse.comp");
-		if (!diffuseResult) {
-			return diffuseResult;
-		}
-		diffuseShaderProgram = diffuseShaderProgramBuilder.getShaderProgram();
+		diffuseShaderProgram = buildComputeProgram("diffuse.comp");
 		if (!diffuseShaderProgram) {
 			return make_unexpected(diffuseShaderProgram.error());
 		}
 
-		auto copyShaderProgramBuilder = ShaderProgramBuilder();
-		auto copyResult = copyShaderProgramBuilder.attachShader(GL_COMPUTE_SHADER, "copy.comp");
-		if (!copyResult) {
-			return copyResult;
-		}
-		copyShaderProgram = copyShaderProgramBuilder.getShaderProgram();
+		copyShaderProgram = buildComputeProgram("copy.comp");
 		if (!copyShaderProgram) {
 			return make_unexpected(copyShaderProgram.error());
 		}
 
-		glUseProgram(*updateShaderProgram);
-		glUniform1i(glGetUniformLocation(*updateShaderProgram, "width"), mainTextureWidth);
-		glUniform1i(glGetUniformLocation(*updateShaderProgram, "height"), mainTextureHeight);
+		yuvShaderProgram = buildComputeProgram("yuv420.comp");
+		if (!yuvShaderProgram) {
+			return make_unexpected(yuvShaderProgram.error());
+		}
 
-		glUseProgram(*diffuseShaderProgram);
-		glUniform1i(glGetUniformLocation(*diffuseShaderProgram, "width"), mainTextureWidth);
-		glUniform1i(glGetUniformLocation(*diffuseShaderProgram, "height"), mainTextureHeight);
+		sampleAgentsShaderProgram = buildComputeProgram("sample_agents.comp");
+		if (!sampleAgentsShaderProgram) {
+			return make_unexpected(sampleAgentsShaderProgram.error());
+		}
+
+		renderTileShaderProgram = buildComputeProgram("render_tile.comp");
+		if (!renderTileShaderProgram) {
+			return make_unexpected(renderTileShaderProgram.error());
+		}
+
+		if (diffuseMode == DiffuseMode::ActiveTiles) {
+			compactTilesShaderProgram = buildComputeProgram("compact_tiles.comp");
+			if (!compactTilesShaderProgram) {
+				return make_unexpected(compactTilesShaderProgram.error());
+			}
+		}
+
+		if (trailStorage == TrailStorage::Sparse) {
+			markTrailPagesShaderProgram = buildComputeProgram("mark_trail_pages.comp");
+			if (!markTrailPagesShaderProgram) {
+				return make_unexpected(markTrailPagesShaderProgram.error());
+			}
+			markAgentPagesShaderProgram = buildComputeProgram("mark_agent_pages.comp");
+			if (!markAgentPagesShaderProgram) {
+				return make_unexpected(markAgentPagesShaderProgram.error());
+			}
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, sparseTrail.getPageFlagBuffer());
+		}
+
+		// packed positions are relative to the grid and need no rescaling on resize
+		if (agentLayout != AgentLayout::Packed) {
+			resampleAgentsShaderProgram = buildComputeProgram("resample_agents.comp");
+			if (!resampleAgentsShaderProgram) {
+				return make_unexpected(resampleAgentsShaderProgram.error());
+			}
+		}
+
+		if (exchange != nullptr) {
+			migrateAgentsShaderProgram = buildComputeProgram("migrate_agents.comp");
+			if (!migrateAgentsShaderProgram) {
+				return make_unexpected(migrateAgentsShaderProgram.error());
+			}
+		}
+
+		if (updateMode == UpdateMode::TileBinned) {
+			auto tileResult = setupTileBinnedPasses();
+			if (!tileResult) {
+				return tileResult;
+			}
+		}
+
+		if (depositMode == DepositMode::PointRaster) {
+			auto depositResult = setupDepositPass();
+			if (!depositResult) {
+				return depositResult;
+			}
+		}
+
+		setSizeUniforms();
+		return {};
+	}
+
+	// changes the grid resolution, the trail is resampled and the agents keep their relative positions
+	expected<void, std::string> resizeGrid(int width, int height) override {
+		if (domainSize > 0) {
+			return make_unexpected("grids split into domains can't be resized\n");
+		}
+		if (ensembleSize > 0) {
+			return make_unexpected("ensembles can't be resized\n");
+		}
+		if (exchange != nullptr) {
+			return make_unexpected("subdomains can't be resized\n");
+		}
+		auto sizeResult = validateGridSize(width, height);
+		if (!sizeResult) {
+			return sizeResult;
+		}
+		if (width == mainTextureWidth && height == mainTextureHeight) {
+			return {};
+		}
+
+		auto oldWidth = mainTextureWidth;
+		auto oldHeight = mainTextureHeight;
+		reallocateGrid(width, height, true);
+
+		if (agentLayout != AgentLayout::Packed) {
+			glUseProgram(*resampleAgentsShaderProgram);
+			glUniform2f(glGetUniformLocation(*resampleAgentsShaderProgram, "scale"),
+					static_cast<float>(width) / oldWidth, static_cast<float>(height) / oldHeight);
+			glDispatchCompute((agentCount + UPDATE_GROUP_SIZE - 1) / UPDATE_GROUP_SIZE, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+		}
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+		return {};
+	}
+
+	// Writes the agents and the trail to a snapshot file. Only the main trail texture is saved, the copy pass
+	// leaves the other one equal to it after every step
+	expected<void, std::string> saveSnapshot(const std::string& path, int frame) override {
+		if (exchange != nullptr) {
+			return make_unexpected("subdomains can't save snapshots\n");
+		}
+		if (ensembleSize > 0) {
+			return make_unexpected("ensembles can't save snapshots\n");
+		}
+		auto header = getStateObjects().header;
+		header.frame = frame;
+
+		SnapshotWriter writer;
+		auto openResult = writer.open(path, header);
+		if (!openResult) {
+			return openResult;
+		}
+
+		StagingBuffer staging;
+		staging.setup(SNAPSHOT_CHUNK_SIZE, SNAPSHOT_CHUNK_COUNT, false, hasExtension("GL_ARB_buffer_storage"));
+
+		// the agents and the trail were last written by shaders
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+		auto downloadBuffer = [&](SnapshotSection section, unsigned int buffer, size_t size) {
+			writer.beginSection(section);
+			downloadSection(staging, size, 1, writer, [&](size_t stagingOffset, size_t offset, size_t bytes) {
+				copyBufferRange(buffer, offset, staging.getBuffer(), stagingOffset, bytes);
+			});
+			writer.endSection();
+		};
+		downloadBuffer(SnapshotSection::Agents, agentBuffer, getAgentBufferSize());
+		if (agentLayout == AgentLayout::Packed) {
+			downloadBuffer(SnapshotSection::Headings, headingBuffer, getHeadingBufferSize());
+		}
+
+		if (resampleFramebuffers[0] == 0) {
+			glGenFramebuffers(2, resampleFramebuffers);
+		}
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, resampleFramebuffers[0]);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, staging.getBuffer());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glPixelStorei(GL_PACK_ROW_LENGTH, mainTextureWidth);
+
+		auto rowSize = static_cast<size_t>(mainTextureWidth) * 4 * sizeof(float);
+		writer.beginSection(SnapshotSection::Trail);
+		downloadSection(staging, getTrailSize(), rowSize, writer, [&](size_t stagingOffset, size_t offset, size_t bytes) {
+			forEachTrailRect(static_cast<int>(offset / rowSize), static_cast<int>(bytes / rowSize),
+					[&](int layer, int x, int y, int width, int height, size_t dataOffset) {
+				if (domainSize > 0) {
+					glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mainTexture, 0, layer);
+				}
+				else {
+					glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTexture, 0);
+				}
+				glReadPixels(x, y, width, height, GL_RGBA, GL_FLOAT, reinterpret_cast<void*>(stagingOffset + dataOffset));
+			});
+		});
+		writer.endSection();
+
+		glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		return writer.finish();
+	}
+
+	StateObjects getStateObjects() override {
+		StateObjects objects{};
+		objects.header.width = mainTextureWidth;
+		objects.header.height = mainTextureHeight;
+		objects.header.agentCount = agentCount;
+		objects.header.agentLayout = static_cast<uint32_t>(agentLayout);
+		objects.header.depositMode = static_cast<uint32_t>(depositMode);
+		objects.header.updateMode = static_cast<uint32_t>(updateMode);
+		objects.header.agentOffset = agentOffset;
+		// a domain split or ensemble trail isn't one texture
+		objects.trailTexture = isLayered() ? 0 : mainTexture;
+		objects.agentBuffer = agentBuffer;
+		objects.agentBufferSize = getAgentBufferSize();
+		if (agentLayout == AgentLayout::Packed) {
+			objects.headingBuffer = headingBuffer;
+			objects.headingBufferSize = getHeadingBufferSize();
+		}
+		return objects;
+	}
+
+	// Uploads the data through a staging ring straight into the GL objects, reallocating them first when the
+	// grid size or agent count differ. headings is only read for the packed layout
+	expected<void, std::string> setState(const SnapshotHeader& header, const uint8_t* agents, const uint8_t* headings,
+			const uint8_t* trail) override {
+		if (exchange != nullptr) {
+			return make_unexpected("subdomains can't restore a state\n");
+		}
+		if (ensembleSize > 0) {
+			return make_unexpected("ensembles can't restore a state\n");
+		}
+		if (header.agentLayout != static_cast<uint32_t>(agentLayout)) {
+			return make_unexpected("the state was saved with another agent layout than this simulation runs\n");
+		}
+		auto sizeResult = validateGridSize(static_cast<int>(header.width), static_cast<int>(header.height));
+		if (!sizeResult) {
+			return sizeResult;
+		}
+		if (header.agentCount == 0 || header.agentCount > INT32_MAX || (agentLayout == AgentLayout::Packed && header.agentCount % 2 != 0)) {
+			return make_unexpected("the state has an invalid agent count\n");
+		}
+
+		auto width = static_cast<int>(header.width);
+		auto height = static_cast<int>(header.height);
+		auto count = static_cast<int>(header.agentCount);
+		if (width != mainTextureWidth || height != mainTextureHeight) {
+			reallocateGrid(width, height, false);
+		}
+		if (count != agentCount) {
+			agentCount = count;
+			allocateAgentBuffers();
+			if (updateMode == UpdateMode::TileBinned) {
+				setupTileBuffers();
+			}
+			setSizeUniforms();
+		}
+
+		// writes to uncommitted pages are dropped, so the pages of the new state are committed first
+		if (trailStorage == TrailStorage::Sparse) {
+			auto flags = sparseTrail.createPageFlags();
+			flagAgentPages(flags, agents);
+			flagTrailPages(flags, trail);
+			sparseTrail.setPages(flags);
+		}
+
+		StagingBuffer staging;
+		staging.setup(SNAPSHOT_CHUNK_SIZE, SNAPSHOT_CHUNK_COUNT, true, hasExtension("GL_ARB_buffer_storage"));
+
+		auto uploadBuffer = [&](const uint8_t* data, size_t size, unsigned int buffer) {
+			uploadSection(staging, data, size, 1, [&](size_t stagingOffset, size_t offset, size_t bytes) {
+				copyBufferRange(staging.getBuffer(), stagingOffset, buffer, offset, bytes);
+			});
+		};
+		uploadBuffer(agents, getAgentBufferSize(), agentBuffer);
+		if (agentLayout == AgentLayout::Packed) {
+			uploadBuffer(headings, getHeadingBufferSize(), headingBuffer);
+		}
+
+		auto target = domainSize > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.getBuffer());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+		glBindTexture(target, mainTexture);
+
+		auto rowSize = static_cast<size_t>(width) * 4 * sizeof(float);
+		uploadSection(staging, trail, getTrailSize(), rowSize, [&](size_t stagingOffset, size_t offset, size_t bytes) {
+			forEachTrailRect(static_cast<int>(offset / rowSize), static_cast<int>(bytes / rowSize),
+					[&](int layer, int x, int y, int rectWidth, int rectHeight, size_t dataOffset) {
+				auto pixels = reinterpret_cast<void*>(stagingOffset + dataOffset);
+				if (domainSize > 0) {
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, rectWidth, rectHeight, 1, GL_RGBA, GL_FLOAT, pixels);
+				}
+				else {
+					glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, rectWidth, rectHeight, GL_RGBA, GL_FLOAT, pixels);
+				}
+			});
+		});
+
+		glBindTexture(target, 0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (domainSize > 0) {
+			glCopyImageSubData(mainTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, copyTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+					domainSize, domainSize, getDomainsX() * getDomainsY());
+		}
+		else {
+			glCopyImageSubData(mainTexture, GL_TEXTURE_2D, 0, 0, 0, 0, copyTexture, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+		}
+
+		agentOffset = static_cast<int>(header.agentOffset % agentCount);
+		if (diffuseMode == DiffuseMode::ActiveTiles) {
+			markAllTilesActive();
+		}
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+				GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+		return {};
+	}
+
+	// Replaces the state with a snapshot's, uploading the sections from the mapped file. Returns the frame to continue from
+	expected<int, std::string> loadSnapshot(const std::string& path) override {
+		SnapshotFile file;
+		auto openResult = file.open(path);
+		if (!openResult) {
+			return make_unexpected(openResult.error());
+		}
+		auto &header = file.getHeader();
+		auto count = static_cast<size_t>(header.agentCount);
+		auto sectionMatches = [&](const SnapshotSectionEntry* section, size_t size) {
+			return section != nullptr && section->size == size;
+		};
+		auto agents = file.findSection(SnapshotSection::Agents);
+		auto headings = file.findSection(SnapshotSection::Headings);
+		auto trail = file.findSection(SnapshotSection::Trail);
+		auto packed = header.agentLayout == static_cast<uint32_t>(AgentLayout::Packed);
+		if (!sectionMatches(agents, packed ? sizeof(uint32_t) * count : sizeof(Agent) * count) ||
+				(packed && !sectionMatches(headings, sizeof(uint32_t) * (count / 2))) ||
+				!sectionMatches(trail, static_cast<size_t>(header.width) * header.height * 4 * sizeof(float))) {
+			return make_unexpected(path + " is missing sections or their sizes don't match its header\n");
+		}
+
+		auto result = setState(header, file.getData(*agents), packed ? file.getData(*headings) : nullptr, file.getData(*trail));
+		if (!result) {
+			return make_unexpected(path + ": " + result.error());
+		}
+		return static_cast<int>(header.frame);
 	}
 
-	void run(int frame) override {
-		glUseProgram(*updateShaderProgram);
-		glUniform1ui(glGetUniformLocation(*updateShaderProgram, "time"), frame);
-		glDispatchCompute(agentCount, 1, 1);
+	void updateAgents(int time) {
+		auto activeAgents = getActiveAgentCount();
+
+		if (updateMode == UpdateMode::TileBinned) {
+			binAgents();
+
+			glUseProgram(*updateTilesShaderProgram);
+			glUniform1ui(glGetUniformLocation(*updateTilesShaderProgram, "time"), time);
+			glUniform1ui(glGetUniformLocation(*updateTilesShaderProgram, "activityParity"), activityParity);
+			glUniform1ui(glGetUniformLocation(*updateTilesShaderProgram, "agentOffset"), agentOffset);
+			glUniform1ui(glGetUniformLocation(*updateTilesShaderProgram, "activeAgents"), activeAgents);
+			glDispatchCompute(getTilesX(), getTilesY(), 1);
+		}
+		else {
+			auto activeInvocations = activeAgents / getAgentsPerInvocation();
+
+			glUseProgram(*updateShaderProgram);
+			glUniform1ui(glGetUniformLocation(*updateShaderProgram, "time"), time);
+			glUniform1ui(glGetUniformLocation(*updateShaderProgram, "activityParity"), activityParity);
+			glUniform1ui(glGetUniformLocation(*updateShaderProgram, "invocationOffset"), agentOffset / getAgentsPerInvocation());
+			glUniform1ui(glGetUniformLocation(*updateShaderProgram, "activeInvocations"), activeInvocations);
+			glDispatchCompute((activeInvocations + UPDATE_GROUP_SIZE - 1) / UPDATE_GROUP_SIZE, 1, 1);
+		}
+		agentOffset = (agentOffset + activeAgents) % agentCount;
+	}
+
+	// the subdomain's own texels in a distributed run, the whole trail of every ensemble member otherwise
+	std::vector<float> readOwnedTrail() {
+		auto owned = getOwnedRect();
+		auto trail = getTrailRect();
+		std::vector<float> texels (owned.getArea() * 4 * getMemberCount());
+
+		if (resampleFramebuffers[0] == 0) {
+			glGenFramebuffers(2, resampleFramebuffers);
+		}
+		glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, resampleFramebuffers[0]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glPixelStorei(GL_PACK_ROW_LENGTH, owned.width);
+		if (domainSize > 0) {
+			forEachTrailRect(0, owned.height, [&](int layer, int x, int y, int width, int height, size_t offset) {
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mainTexture, 0, layer);
+				glReadPixels(x, y, width, height, GL_RGBA, GL_FLOAT, reinterpret_cast<uint8_t*>(texels.data()) + offset);
+			});
+		}
+		else if (ensembleSize > 0) {
+			for (int member = 0; member < ensembleSize; member++) {
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mainTexture, 0, member);
+				glReadPixels(0, 0, owned.width, owned.height, GL_RGBA, GL_FLOAT, texels.data() + owned.getArea() * 4 * member);
+			}
+		}
+		else {
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTexture, 0);
+			glReadPixels(owned.x - trail.x, owned.y - trail.y, owned.width, owned.height, GL_RGBA, GL_FLOAT, texels.data());
+		}
+		glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return texels;
+	}
+
+	// one update/diffuse/copy sequence; the display texture is only written when it will be presented
+	void step(int time, bool writeDisplay) {
+		// a subdomain can run out of agents for a while
+		if (agentCount > 0) {
+			updateAgents(time);
+		}
+		if (exchange != nullptr) {
+			migrateAgents(time);
+			exchangeHalos(time, writeDisplay);
+			return;
+		}
+
+		if (depositMode == DepositMode::PointRaster) {
+			glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+			deposit(0, agentCount);
+		}
+
+		auto activeTiles = diffuseMode == DiffuseMode::ActiveTiles;
+		if (activeTiles) {
+			compactActiveTiles();
+		}
 
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
 		glUseProgram(*diffuseShaderProgram);
-		glDispatchCompute(mainTextureWidth, mainTextureHeight, 1);
+		if (activeTiles) {
+			glUniform1ui(glGetUniformLocation(*diffuseShaderProgram, "activityParity"), activityParity);
+			glDispatchComputeIndirect(0);
+		}
+		else {
+			dispatchRegion(*diffuseShaderProgram, getTrailRect());
+		}
 
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
+		// the display shows every tile, so it is written from the whole grid
 		glUseProgram(*copyShaderProgram);
-		glDispatchCompute(mainTextureWidth, mainTextureHeight, 1);
+		glUniform1i(glGetUniformLocation(*copyShaderProgram, "writeDisplay"), writeDisplay);
+		glUniform1i(glGetUniformLocation(*copyShaderProgram, "listedTilesOnly"), activeTiles && !writeDisplay);
+		if (activeTiles && !writeDisplay) {
+			glDispatchComputeIndirect(0);
+		}
+		else {
+			dispatchRegion(*copyShaderProgram, getTrailRect());
+		}
 
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+		activityParity ^= 1;
+	}
+
+	// frame is the index of the first step, steps are recorded back to back without any CPU round trip
+	void run(int frame, int steps) override {
+		gpuTimer.begin();
+		for (int i = 0; i < steps; i++) {
+			step(frame + i, i == steps - 1);
+			if (trailStorage == TrailStorage::Sparse) {
+				updateSparseTrail();
+			}
+		}
+		gpuTimer.end();
+	}
+
+	std::vector<float> gatherTrail() override {
+		auto texels = readOwnedTrail();
+		if (exchange != nullptr) {
+			return exchange->gatherTrail(texels);
+		}
+		return texels;
+	}
+
+	float getGpuMilliseconds() override {
+		return gpuTimer.getMilliseconds();
+	}
+
+	// one entry per ensemble member, members past the end get the defaults. Takes effect with the next step, for
+	// a single simulation with the next setupShaders()
+	void setMemberParameters(const std::vector<MemberParameters>& parameters) {
+		memberParameters = parameters;
+		if (memberParameterBuffer == 0) {
+			return;
+		}
+		auto uploaded = parameters;
+		uploaded.resize(ensembleSize);
+		glBindBuffer(GL_UNIFORM_BUFFER, memberParameterBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, uploaded.size() * sizeof(MemberParameters), uploaded.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	int getEnsembleSize() {
+		return ensembleSize;
+	}
+
+	// share of the agents updated per step, for trading simulation accuracy against frame time
+	void setAgentFraction(float fraction) override {
+		if (reproducible) {
+			return;
+		}
+		agentFraction = std::max(0.0f, std::min(1.0f, fraction));
+	}
+
+	// a twelfth of the bytes of reading back the RGBA32F trail, converted before the data leaves the GPU
+	void convertDisplayToYuv420(unsigned int buffer, int cropX, int cropY, int cropWidth, int cropHeight,
+			int outputWidth, int outputHeight) override {
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, getDisplayTexture());
+		glActiveTexture(GL_TEXTURE0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, buffer);
+
+		glUseProgram(*yuvShaderProgram);
+		glUniform2i(glGetUniformLocation(*yuvShaderProgram, "outputSize"), outputWidth, outputHeight);
+		// the crop is in grid texels, the display may be downscaled from them
+		auto scale = static_cast<float>(displayScale);
+		glUniform2f(glGetUniformLocation(*yuvShaderProgram, "cropOrigin"), cropX / scale, cropY / scale);
+		glUniform2f(glGetUniformLocation(*yuvShaderProgram, "cropSize"), cropWidth / scale, cropHeight / scale);
+		glDispatchCompute((outputWidth / 8 + 7) / 8, (outputHeight / 2 + 7) / 8, 1);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, 0);
+	}
+
+	void sampleAgents(unsigned int buffer, int firstAgent, int agentStride, int sampleCount) override {
+		// the agents were last written by the update pass
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, buffer);
+
+		glUseProgram(*sampleAgentsShaderProgram);
+		glUniform1ui(glGetUniformLocation(*sampleAgentsShaderProgram, "agentCount"), agentCount);
+		glUniform1i(glGetUniformLocation(*sampleAgentsShaderProgram, "width"), mainTextureWidth);
+		glUniform1i(glGetUniformLocation(*sampleAgentsShaderProgram, "height"), mainTextureHeight);
+		glUniform1ui(glGetUniformLocation(*sampleAgentsShaderProgram, "firstAgent"), firstAgent);
+		glUniform1ui(glGetUniformLocation(*sampleAgentsShaderProgram, "agentStride"), agentStride);
+		glUniform1ui(glGetUniformLocation(*sampleAgentsShaderProgram, "sampleCount"), sampleCount);
+		glDispatchCompute((sampleCount + UPDATE_GROUP_SIZE - 1) / UPDATE_GROUP_SIZE, 1, 1);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, 0);
+	}
+
+	// reads the trail rather than the display, which may be downscaled
+	void renderTile(unsigned int buffer, int x, int y, int tileWidth, int tileHeight) override {
+		// the trail was last written by the copy pass
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, buffer);
+
+		glUseProgram(*renderTileShaderProgram);
+		glUniform4i(glGetUniformLocation(*renderTileShaderProgram, "region"), x, mainTextureHeight - y - tileHeight,
+				tileWidth, tileHeight);
+		glDispatchCompute((tileWidth + 15) / 16, (tileHeight + 15) / 16, 1);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, 0);
 	}
 };
 
@@ -0,0 +1,287 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// Snapshot file of the whole simulation state. The header fills the first page, every section starts on a
+// page boundary, so a loader can map the file and hand sections to the GPU straight from the mapping.
+// Sections hold the raw contents of the GPU objects: the agent buffer as the layout stores it, the packed
+// headings and the RGBA32F trail rows bottom first. All integers are little endian.
+
+constexpr uint32_t SNAPSHOT_MAGIC = 0x4E535653; // "SVSN"
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr size_t SNAPSHOT_ALIGNMENT = 4096;
+constexpr int SNAPSHOT_MAX_SECTIONS = 8;
+
+enum class SnapshotSection : uint32_t {
+	Agents = 1,
+	// AgentLayout::Packed only
+	Headings = 2,
+	Trail = 3
+};
+
+struct SnapshotSectionEntry {
+	SnapshotSection type;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t agentCount;
+	// AgentLayout, DepositMode and UpdateMode of the simulation that wrote it
+	uint32_t agentLayout;
+	uint32_t depositMode;
+	uint32_t updateMode;
+	// the next step; steering randomness is a hash of the step and the agent, so this and the
+	// agent offset are all the RNG state there is
+	uint64_t frame;
+	uint32_t agentOffset;
+	uint32_t sectionCount;
+	SnapshotSectionEntry sections[SNAPSHOT_MAX_SECTIONS];
+};
+
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_ALIGNMENT, "the snapshot header must fit its page");
+
+// Read-only mapping of a whole snapshot file
+class SnapshotFile {
+private:
+	uint8_t* memory;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+public:
+	SnapshotFile() {
+		memory = nullptr;
+		size = 0;
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+#endif
+	}
+
+	~SnapshotFile() {
+#ifdef _WIN32
+		if (memory != nullptr) {
+			UnmapViewOfFile(memory);
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+#else
+		if (memory != nullptr) {
+			munmap(memory, size);
+		}
+#endif
+	}
+
+	SnapshotFile(const SnapshotFile&) = delete;
+	SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+	expected<void, std::string> open(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return make_unexpected("failed to open snapshot " + path + "\n");
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = static_cast<size_t>(fileSize.QuadPart);
+		if (size < SNAPSHOT_ALIGNMENT) {
+			return make_unexpected(path + " is not a slime-viz snapshot\n");
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			return make_unexpected("failed to map snapshot " + path + "\n");
+		}
+		memory = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (memory == nullptr) {
+			return make_unexpected("failed to map snapshot " + path + "\n");
+		}
+#else
+		auto fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return make_unexpected("failed to open snapshot " + path + "\n");
+		}
+		struct stat status;
+		fstat(fd, &status);
+		size = static_cast<size_t>(status.st_size);
+		if (size < SNAPSHOT_ALIGNMENT) {
+			close(fd);
+			return make_unexpected(path + " is not a slime-viz snapshot\n");
+		}
+		auto address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (address == MAP_FAILED) {
+			return make_unexpected("failed to map snapshot " + path + "\n");
+		}
+		memory = static_cast<uint8_t*>(address);
+		// the sections are read front to back exactly once
+		madvise(memory, size, MADV_SEQUENTIAL);
+		madvise(memory, size, MADV_WILLNEED);
+#endif
+
+		auto &header = getHeader();
+		if (header.magic != SNAPSHOT_MAGIC) {
+			return make_unexpected(path + " is not a slime-viz snapshot\n");
+		}
+		if (header.version != SNAPSHOT_VERSION) {
+			return make_unexpected(path + " has snapshot version " + std::to_string(header.version) +
+					", expected " + std::to_string(SNAPSHOT_VERSION) + "\n");
+		}
+		if (header.sectionCount > SNAPSHOT_MAX_SECTIONS) {
+			return make_unexpected(path + " has a broken section table\n");
+		}
+		for (uint32_t i = 0; i < header.sectionCount; i++) {
+			auto const &section = header.sections[i];
+			if (section.offset % SNAPSHOT_ALIGNMENT != 0 || section.offset > size || section.size > size - section.offset) {
+				return make_unexpected(path + " is truncated or has a broken section table\n");
+			}
+		}
+		return {};
+	}
+
+	const SnapshotHeader& getHeader() {
+		return *reinterpret_cast<const SnapshotHeader*>(memory);
+	}
+
+	// nullptr when the snapshot has no such section
+	const SnapshotSectionEntry* findSection(SnapshotSection type) {
+		auto &header = getHeader();
+		for (uint32_t i = 0; i < header.sectionCount; i++) {
+			if (header.sections[i].type == type) {
+				return &header.sections[i];
+			}
+		}
+		return nullptr;
+	}
+
+	const uint8_t* getData(const SnapshotSectionEntry& section) {
+		return memory + section.offset;
+	}
+};
+
+// Writes a snapshot next to its final path and moves it there once complete, so a crash while saving
+// never leaves a truncated snapshot behind
+class SnapshotWriter {
+private:
+	std::string path;
+	std::string temporaryPath;
+	FILE* file;
+	SnapshotHeader header;
+	uint64_t offset;
+	bool failed;
+
+	void pad() {
+		static const uint8_t zeros[SNAPSHOT_ALIGNMENT] = {};
+		auto padding = (SNAPSHOT_ALIGNMENT - offset % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT;
+		failed |= fwrite(zeros, 1, padding, file) != padding;
+		offset += padding;
+	}
+
+public:
+	SnapshotWriter() {
+		file = nullptr;
+		header = SnapshotHeader{};
+		offset = 0;
+		failed = false;
+	}
+
+	~SnapshotWriter() {
+		if (file != nullptr) {
+			fclose(file);
+			remove(temporaryPath.c_str());
+		}
+	}
+
+	SnapshotWriter(const SnapshotWriter&) = delete;
+	SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+	// header fields other than the magic, version and sections are the caller's
+	expected<void, std::string> open(const std::string& path, const SnapshotHeader& header) {
+		this->path = path;
+		temporaryPath = path + ".partial";
+		file = fopen(temporaryPath.c_str(), "wb");
+		if (file == nullptr) {
+			return make_unexpected("failed to create snapshot " + temporaryPath + "\n");
+		}
+		this->header = header;
+		this->header.magic = SNAPSHOT_MAGIC;
+		this->header.version = SNAPSHOT_VERSION;
+		this->header.sectionCount = 0;
+
+		// the header is written again by finish(), once the section table is known
+		failed = fwrite(&this->header, sizeof(this->header), 1, file) != 1;
+		offset = sizeof(this->header);
+		pad();
+		return {};
+	}
+
+	void beginSection(SnapshotSection type) {
+		if (header.sectionCount == SNAPSHOT_MAX_SECTIONS) {
+			failed = true;
+			return;
+		}
+		auto &section = header.sections[header.sectionCount++];
+		section.type = type;
+		section.offset = offset;
+		section.size = 0;
+	}
+
+	void write(const void* data, size_t size) {
+		failed |= fwrite(data, 1, size, file) != size;
+		offset += size;
+		header.sections[header.sectionCount - 1].size += size;
+	}
+
+	void endSection() {
+		pad();
+	}
+
+	expected<void, std::string> finish() {
+		failed |= fseek(file, 0, SEEK_SET) != 0;
+		failed |= fwrite(&header, sizeof(header), 1, file) != 1;
+		failed |= fclose(file) != 0;
+		file = nullptr;
+		if (failed) {
+			remove(temporaryPath.c_str());
+			return make_unexpected("failed to write snapshot " + temporaryPath + "\n");
+		}
+		// rename doesn't replace an existing file on Windows
+		remove(path.c_str());
+		if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+			return make_unexpected("failed to move snapshot " + temporaryPath + " to " + path + "\n");
+		}
+		return {};
+	}
+};
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef SPARSE_TRAIL_HPP
+#define SPARSE_TRAIL_HPP
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// ARB_sparse_texture is past the 4.3 loader, its entry point is resolved by setup()
+#ifndef GL_TEXTURE_SPARSE_ARB
+#define GL_TEXTURE_SPARSE_ARB 0x91A6
+#define GL_NUM_VIRTUAL_PAGE_SIZES_ARB 0x91A8
+#define GL_VIRTUAL_PAGE_SIZE_X_ARB 0x9195
+#define GL_VIRTUAL_PAGE_SIZE_Y_ARB 0x9196
+#define GL_MAX_SPARSE_TEXTURE_SIZE_ARB 0x9198
+#endif
+
+typedef void (APIENTRYP TexPageCommitmentFunction)(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+		GLsizei width, GLsizei height, GLsizei depth, GLboolean commit);
+
+// The pair of RGBA32F trail textures (main and copy) as sparse textures (GL_ARB_sparse_texture), so memory
+// follows the area the slime covers instead of the grid size. The textures span the grid rounded up to whole
+// pages and a page table on the CPU tracks which pages are committed. Every few steps the simulation flags
+// the pages holding trail or agents into the page flag buffer, which is read back without waiting; the
+// flagged pages and their neighbours stay committed, all others are decommitted. Trail spreads and agents
+// move a texel per step at most, so that one page margin holds until the next update as long as updates
+// come more often than every half page of steps, see getUpdateInterval().
+// Shaders rely on uncommitted pages reading as zero and writes to them being dropped, which needs
+// GL_ARB_sparse_texture2 as well.
+class SparseTrail {
+private:
+	int pageWidth;
+	int pageHeight;
+	int width;
+	int height;
+	int pagesX;
+	int pagesY;
+	// main and copy texture
+	std::array<unsigned int, 2> textures;
+	std::vector<uint8_t> committed;
+	int committedCount;
+
+	// a page of zeros to clear newly committed pages from, their content is undefined
+	unsigned int zeroBuffer;
+	unsigned int pageFlagBuffer;
+	unsigned int readbackBuffer;
+	GLsync readbackFence;
+	TexPageCommitmentFunction texPageCommitment;
+
+	static constexpr size_t TEXEL_SIZE = 4 * sizeof(float);
+
+	unsigned int createTexture() {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, pagesX * pageWidth, pagesY * pageHeight);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+
+	// commits or decommits count pages of a row in both textures
+	void commitPages(int pageX, int pageY, int count, bool commit) {
+		for (auto texture : textures) {
+			glBindTexture(GL_TEXTURE_2D, texture);
+			texPageCommitment(GL_TEXTURE_2D, 0, pageX * pageWidth, pageY * pageHeight, 0,
+					count * pageWidth, pageHeight, 1, commit ? GL_TRUE : GL_FALSE);
+		}
+		// the diffuse pass writes every texel of the copy texture before anything reads it
+		if (commit) {
+			glBindTexture(GL_TEXTURE_2D, textures[0]);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, zeroBuffer);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			for (int i = 0; i < count; i++) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, (pageX + i) * pageWidth, pageY * pageHeight, pageWidth, pageHeight,
+						GL_RGBA, GL_FLOAT, nullptr);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		committedCount += commit ? count : -count;
+	}
+
+	// brings the page table to the wanted pages, a row's runs of pages changing the same way at once
+	void applyPages(const std::vector<uint8_t>& wanted) {
+		for (int y = 0; y < pagesY; y++) {
+			auto row = y * pagesX;
+			for (int x = 0; x < pagesX;) {
+				if (wanted[row + x] == committed[row + x]) {
+					x++;
+					continue;
+				}
+				auto commit = wanted[row + x] != 0;
+				auto end = x + 1;
+				while (end < pagesX && wanted[row + end] != committed[row + end] && (wanted[row + end] != 0) == commit) {
+					end++;
+				}
+				commitPages(x, y, end - x, commit);
+				std::fill(committed.begin() + row + x, committed.begin() + row + end, commit ? 1 : 0);
+				x = end;
+			}
+		}
+	}
+
+	void cancelReadback() {
+		if (readbackFence != nullptr) {
+			glDeleteSync(readbackFence);
+			readbackFence = nullptr;
+		}
+	}
+
+public:
+	SparseTrail() {
+		pageWidth = 0;
+		pageHeight = 0;
+		width = 0;
+		height = 0;
+		pagesX = 0;
+		pagesY = 0;
+		textures = { 0, 0 };
+		committedCount = 0;
+		zeroBuffer = 0;
+		pageFlagBuffer = 0;
+		readbackBuffer = 0;
+		readbackFence = nullptr;
+		texPageCommitment = nullptr;
+	}
+
+	// queries the page size, the textures are created by reallocate(). Needs GL_ARB_sparse_texture
+	expected<void, std::string> setup() {
+		texPageCommitment = reinterpret_cast<TexPageCommitmentFunction>(glfwGetProcAddress("glTexPageCommitmentARB"));
+		if (texPageCommitment == nullptr) {
+			return make_unexpected("glTexPageCommitmentARB is not available\n");
+		}
+		int pageSizeCount = 0;
+		glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA32F, GL_NUM_VIRTUAL_PAGE_SIZES_ARB, 1, &pageSizeCount);
+		if (pageSizeCount == 0) {
+			return make_unexpected("sparse RGBA32F textures are not supported\n");
+		}
+		// the first page size, which textures use unless told otherwise
+		glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA32F, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &pageWidth);
+		glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA32F, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &pageHeight);
+
+		std::vector<uint8_t> zeros(getPageBytes(), 0);
+		glGenBuffers(1, &zeroBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, zeroBuffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, zeros.size(), zeros.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		glGenBuffers(1, &pageFlagBuffer);
+		glGenBuffers(1, &readbackBuffer);
+		return {};
+	}
+
+	// whether the textures for a grid of this size stay within the size limit of sparse textures
+	bool canCover(int width, int height) {
+		int maxSize;
+		glGetIntegerv(GL_MAX_SPARSE_TEXTURE_SIZE_ARB, &maxSize);
+		return (width + pageWidth - 1) / pageWidth * pageWidth <= maxSize &&
+				(height + pageHeight - 1) / pageHeight * pageHeight <= maxSize;
+	}
+
+	// Creates textures for a grid of the given size and returns the previous ones, which the caller deletes
+	// (0 the first time). With keepPages the pages covering the committed area of the old grid, scaled to
+	// the new one, are committed, otherwise none are
+	std::array<unsigned int, 2> reallocate(int width, int height, bool keepPages) {
+		cancelReadback();
+		auto oldTextures = textures;
+		auto oldCommitted = committed;
+		auto oldWidth = this->width;
+		auto oldHeight = this->height;
+		auto oldPagesX = pagesX;
+
+		this->width = width;
+		this->height = height;
+		pagesX = (width + pageWidth - 1) / pageWidth;
+		pagesY = (height + pageHeight - 1) / pageHeight;
+		textures = { createTexture(), createTexture() };
+		committed = std::vector<uint8_t>(pagesX * pagesY, 0);
+		committedCount = 0;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, pageFlagBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * pagesX * pagesY, nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(uint32_t) * pagesX * pagesY, nullptr, GL_STREAM_READ);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		if (keepPages && !oldCommitted.empty()) {
+			auto scaleX = static_cast<float>(width) / oldWidth;
+			auto scaleY = static_cast<float>(height) / oldHeight;
+			auto flags = createPageFlags();
+			for (size_t i = 0; i < oldCommitted.size(); i++) {
+				if (oldCommitted[i] == 0) {
+					continue;
+				}
+				auto oldX = static_cast<int>(i % oldPagesX) * pageWidth;
+				auto oldY = static_cast<int>(i / oldPagesX) * pageHeight;
+				auto firstX = std::min(pagesX - 1, static_cast<int>(oldX * scaleX) / pageWidth);
+				auto firstY = std::min(pagesY - 1, static_cast<int>(oldY * scaleY) / pageHeight);
+				auto lastX = std::min(pagesX - 1, static_cast<int>((oldX + pageWidth) * scaleX) / pageWidth);
+				auto lastY = std::min(pagesY - 1, static_cast<int>((oldY + pageHeight) * scaleY) / pageHeight);
+				for (int y = firstY; y <= lastY; y++) {
+					for (int x = firstX; x <= lastX; x++) {
+						flags[x + y * pagesX] = 1;
+					}
+				}
+			}
+			setPages(flags);
+		}
+		return oldTextures;
+	}
+
+	unsigned int getTexture(int index) {
+		return textures[index];
+	}
+
+	// flags of every page, all cleared
+	std::vector<uint8_t> createPageFlags() {
+		return std::vector<uint8_t>(pagesX * pagesY, 0);
+	}
+
+	// index of the page holding a grid position, positions outside the grid are clamped to it
+	int getPageIndex(float x, float y) {
+		auto texelX = std::max(0, std::min(width - 1, static_cast<int>(x)));
+		auto texelY = std::max(0, std::min(height - 1, static_cast<int>(y)));
+		return texelX / pageWidth + texelY / pageHeight * pagesX;
+	}
+
+	// commits the flagged pages and their neighbours and decommits all others
+	void setPages(const std::vector<uint8_t>& flags) {
+		auto wanted = createPageFlags();
+		for (int y = 0; y < pagesY; y++) {
+			for (int x = 0; x < pagesX; x++) {
+				if (flags[x + y * pagesX] == 0) {
+					continue;
+				}
+				for (int neighbourY = std::max(0, y - 1); neighbourY <= std::min(pagesY - 1, y + 1); neighbourY++) {
+					for (int neighbourX = std::max(0, x - 1); neighbourX <= std::min(pagesX - 1, x + 1); neighbourX++) {
+						wanted[neighbourX + neighbourY * pagesX] = 1;
+					}
+				}
+			}
+		}
+		applyPages(wanted);
+	}
+
+	// one uint per page, cleared by the caller before flagging pages into it
+	unsigned int getPageFlagBuffer() {
+		return pageFlagBuffer;
+	}
+
+	// starts reading back the page flags, after the commands that write them
+	void readPageFlags() {
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, pageFlagBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(uint32_t) * pagesX * pagesY);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	bool isReadingPageFlags() {
+		return readbackFence != nullptr;
+	}
+
+	// applies the page flags read back, if they have arrived or when waiting for them
+	void update(bool wait) {
+		if (readbackFence == nullptr) {
+			return;
+		}
+		auto status = glClientWaitSync(readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return;
+		}
+		cancelReadback();
+
+		auto flags = createPageFlags();
+		glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+		auto data = static_cast<const uint32_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(uint32_t) * flags.size(), GL_MAP_READ_BIT));
+		for (size_t i = 0; i < flags.size(); i++) {
+			flags[i] = data[i] != 0 ? 1 : 0;
+		}
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		setPages(flags);
+	}
+
+	// steps between page updates: flags are applied up to one interval after they were taken and stay until
+	// the next update is applied another interval later, which must not be more than the one page margin
+	int getUpdateInterval() {
+		return std::max(1, std::min(pageWidth, pageHeight) / 4);
+	}
+
+	int getPageWidth() {
+		return pageWidth;
+	}
+
+	int getPageHeight() {
+		return pageHeight;
+	}
+
+	int getPagesX() {
+		return pagesX;
+	}
+
+	int getPagesY() {
+		return pagesY;
+	}
+
+	size_t getPageBytes() {
+		return static_cast<size_t>(pageWidth) * pageHeight * TEXEL_SIZE;
+	}
+
+	int getCommittedPageCount() {
+		return committedCount;
+	}
+
+	// memory of both textures
+	size_t getCommittedBytes() {
+		return getPageBytes() * committedCount * 2;
+	}
+};
+
+#endif
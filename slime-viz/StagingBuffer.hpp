@@ -0,0 +1,156 @@
+#ifndef STAGING_BUFFER_HPP
+#define STAGING_BUFFER_HPP
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <vector>
+
+// ARB_buffer_storage is past the 4.3 loader, its entry point is resolved when the extension is there
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+
+typedef void (APIENTRYP BufferStorageFunction)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// A ring of equally sized chunks in one buffer object for streaming large transfers between CPU memory
+// and GL objects. With ARB_buffer_storage the buffer stays mapped for its whole life, otherwise each chunk
+// is mapped while the CPU uses it. Every chunk gets a fence after the GL commands using it, so the CPU only
+// waits when it comes back to a chunk the GPU is still reading or writing.
+class StagingBuffer {
+private:
+	unsigned int buffer;
+	uint8_t* mapping;
+	size_t chunkSize;
+	int nextChunk;
+	std::vector<GLsync> fences;
+	bool persistent;
+	bool upload;
+
+public:
+	StagingBuffer() {
+		buffer = 0;
+		mapping = nullptr;
+		chunkSize = 0;
+		nextChunk = 0;
+		persistent = false;
+		upload = true;
+	}
+
+	~StagingBuffer() {
+		for (auto fence : fences) {
+			if (fence != nullptr) {
+				glDeleteSync(fence);
+			}
+		}
+		if (buffer != 0) {
+			if (mapping != nullptr) {
+				glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+				glUnmapBuffer(GL_COPY_READ_BUFFER);
+				glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &buffer);
+		}
+	}
+
+	StagingBuffer(const StagingBuffer&) = delete;
+	StagingBuffer& operator=(const StagingBuffer&) = delete;
+
+	// upload chunks are written by the CPU and read by GL, download chunks the other way around.
+	// persistent needs ARB_buffer_storage (core in 4.4), without its entry point the chunks are mapped one by one
+	void setup(size_t chunkSize, int chunkCount, bool upload, bool persistent) {
+		BufferStorageFunction bufferStorage = nullptr;
+		if (persistent) {
+			bufferStorage = reinterpret_cast<BufferStorageFunction>(glfwGetProcAddress("glBufferStorage"));
+		}
+		this->chunkSize = chunkSize;
+		this->upload = upload;
+		this->persistent = bufferStorage != nullptr;
+		fences = std::vector<GLsync>(chunkCount, nullptr);
+
+		auto size = chunkSize * chunkCount;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		if (this->persistent) {
+			GLbitfield access = (upload ? GL_MAP_WRITE_BIT : GL_MAP_READ_BIT) | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			bufferStorage(GL_COPY_READ_BUFFER, size, nullptr, access | (upload ? 0 : GL_CLIENT_STORAGE_BIT));
+			mapping = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, access));
+		}
+		else {
+			glBufferData(GL_COPY_READ_BUFFER, size, nullptr, upload ? GL_STREAM_DRAW : GL_STREAM_READ);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	unsigned int getBuffer() {
+		return buffer;
+	}
+
+	size_t getChunkSize() {
+		return chunkSize;
+	}
+
+	int getChunkCount() {
+		return static_cast<int>(fences.size());
+	}
+
+	size_t getOffset(int chunk) {
+		return chunkSize * chunk;
+	}
+
+	// the next chunk in the ring, once the GL commands of its last use have finished
+	int acquire() {
+		auto chunk = nextChunk;
+		nextChunk = (nextChunk + 1) % static_cast<int>(fences.size());
+		wait(chunk);
+		return chunk;
+	}
+
+	// waits for the GL commands issued before fence(chunk), e.g. to read a downloaded chunk
+	void wait(int chunk) {
+		auto &fence = fences[chunk];
+		if (fence == nullptr) {
+			return;
+		}
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	// CPU access to a chunk that isn't in use by GL, until unmap()
+	uint8_t* map(int chunk) {
+		if (persistent) {
+			return mapping + getOffset(chunk);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		GLbitfield access = upload ? GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT : GL_MAP_READ_BIT;
+		auto data = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, getOffset(chunk), chunkSize, access));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		return data;
+	}
+
+	void unmap() {
+		if (persistent) {
+			return;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	// after the GL commands that read or write the chunk
+	void fence(int chunk) {
+		fences[chunk] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// waits for every chunk
+	void finish() {
+		for (int i = 0; i < static_cast<int>(fences.size()); i++) {
+			wait(i);
+		}
+	}
+};
+
+#endif
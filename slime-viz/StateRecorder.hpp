@@ -0,0 +1,408 @@
+#ifndef STATE_RECORDER_HPP
+#define STATE_RECORDER_HPP
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include "expected.hpp"
+
+#include "ApplicationBase.hpp"
+#include "ShaderProgramBuilder.hpp"
+#include "ThreadPool.hpp"
+#include "Checkpoint.hpp"
+
+using namespace nonstd;
+
+// trail tiles compressed by one job
+constexpr int CHECKPOINT_TILES_PER_JOB = 32;
+
+// a finished record in the format of Checkpoint.hpp
+struct StateRecord {
+	CheckpointRecordHeader header;
+	// the blocks of every compression job, in order
+	std::vector<std::vector<uint8_t>> blocks;
+};
+
+// Turns the simulation state into checkpoint records in the background.
+// record() starts with GPU copies of the trail and agents, so the simulation can carry on right away.
+// For delta records a compute pass hashes the trail copy per tile and only the tiles whose hash differs
+// from the previous record's are read back. They are compressed on a thread pool and the finished record
+// goes to the callback. Each stage is polled from update() and never waits for the GPU or the workers.
+class StateRecorder {
+private:
+	enum class Stage {
+		Idle,
+		// copies, hash pass and agent readback in flight
+		Copying,
+		// trail tile readback in flight
+		ReadingTiles,
+		Compressing
+	};
+
+	struct CompressionJob {
+		SnapshotSection section;
+		// agent block index, or the first entry in dirtyTiles for trail jobs
+		uint32_t first;
+		uint32_t count;
+	};
+
+	int tileSize;
+	bool hashTiles;
+	std::function<void(StateRecord&&)> onRecord;
+	Stage stage;
+
+	unsigned int hashShaderProgram;
+	unsigned int trailCopy;
+	int copyWidth;
+	int copyHeight;
+	unsigned int readFramebuffer;
+	unsigned int hashBuffer;
+	size_t hashBufferSize;
+	unsigned int agentReadback;
+	size_t agentReadbackSize;
+	unsigned int tileReadback;
+	size_t tileReadbackSize;
+	GLsync fence;
+
+	// the record being made and its mapped readbacks while the jobs compress them
+	CheckpointRecordHeader header;
+	// of the previous record, empty when the next one can't be a delta
+	std::vector<uint64_t> tileHashes;
+	std::vector<uint32_t> dirtyTiles;
+	std::vector<size_t> dirtyTileOffsets;
+	const uint8_t* agentData;
+	const uint8_t* tileData;
+	std::vector<std::vector<uint8_t>> jobOutputs;
+	std::atomic<int> pendingJobs;
+
+	// declared last so its workers are joined before anything they use is destroyed
+	ThreadPool threadPool;
+
+	bool fencePassed(bool wait) {
+		auto status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+		return true;
+	}
+
+	static void resizeBuffer(GLenum target, unsigned int buffer, size_t& size, size_t requiredSize, GLenum usage) {
+		if (requiredSize <= size) {
+			return;
+		}
+		glBindBuffer(target, buffer);
+		glBufferData(target, requiredSize, nullptr, usage);
+		glBindBuffer(target, 0);
+		size = requiredSize;
+	}
+
+	// compares the tile hashes with the previous record's and reads back the tiles that differ
+	void readDirtyTiles() {
+		auto width = static_cast<int>(header.width);
+		auto height = static_cast<int>(header.height);
+		auto tileCount = getCheckpointTileCount(width, height, tileSize);
+
+		dirtyTiles.clear();
+		if (hashTiles) {
+			glBindBuffer(GL_COPY_READ_BUFFER, hashBuffer);
+			auto hashes = static_cast<const uint64_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, tileCount * sizeof(uint64_t), GL_MAP_READ_BIT));
+			for (int i = 0; i < tileCount; i++) {
+				if (header.full || hashes[i] != tileHashes[i]) {
+					dirtyTiles.push_back(i);
+				}
+			}
+			tileHashes.assign(hashes, hashes + tileCount);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		else {
+			for (int i = 0; i < tileCount; i++) {
+				dirtyTiles.push_back(i);
+			}
+		}
+
+		dirtyTileOffsets.clear();
+		size_t size = 0;
+		for (auto index : dirtyTiles) {
+			auto tile = getCheckpointTile(index, width, height, tileSize);
+			dirtyTileOffsets.push_back(size);
+			size += static_cast<size_t>(tile.width) * tile.height * 4 * sizeof(float);
+		}
+		resizeBuffer(GL_PIXEL_PACK_BUFFER, tileReadback, tileReadbackSize, size, GL_STREAM_READ);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, tileReadback);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		for (size_t i = 0; i < dirtyTiles.size(); i++) {
+			auto tile = getCheckpointTile(dirtyTiles[i], width, height, tileSize);
+			glReadPixels(tile.x, tile.y, tile.width, tile.height, GL_RGBA, GL_FLOAT, reinterpret_cast<void*>(dirtyTileOffsets[i]));
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		stage = Stage::ReadingTiles;
+	}
+
+	void compress(const CompressionJob& job, std::vector<uint8_t>& out) {
+		if (job.section == SnapshotSection::Trail) {
+			for (auto i = job.first; i < job.first + job.count; i++) {
+				auto tile = getCheckpointTile(dirtyTiles[i], header.width, header.height, tileSize);
+				appendCheckpointBlock(SnapshotSection::Trail, dirtyTiles[i], tileData + dirtyTileOffsets[i],
+						static_cast<size_t>(tile.width) * tile.height * 4 * sizeof(float), 4 * sizeof(float), out);
+			}
+			return;
+		}
+
+		auto agents = job.section == SnapshotSection::Agents;
+		auto data = agents ? agentData : agentData + header.agentBufferSize;
+		auto size = agents ? header.agentBufferSize : header.headingBufferSize;
+		auto offset = job.first * CHECKPOINT_AGENT_BLOCK_SIZE;
+		appendCheckpointBlock(job.section, job.first, data + offset, std::min<size_t>(CHECKPOINT_AGENT_BLOCK_SIZE, size - offset),
+				sizeof(uint32_t), out);
+	}
+
+	// maps the readbacks and hands them to the compression jobs
+	void startCompression() {
+		glBindBuffer(GL_COPY_READ_BUFFER, agentReadback);
+		agentData = static_cast<const uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+				header.agentBufferSize + header.headingBufferSize, GL_MAP_READ_BIT));
+		if (!dirtyTiles.empty()) {
+			glBindBuffer(GL_COPY_READ_BUFFER, tileReadback);
+			tileData = static_cast<const uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, tileReadbackSize, GL_MAP_READ_BIT));
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		std::vector<CompressionJob> jobs{};
+		auto addAgentJobs = [&](SnapshotSection section, size_t size) {
+			for (size_t offset = 0; offset < size; offset += CHECKPOINT_AGENT_BLOCK_SIZE) {
+				jobs.push_back({ section, static_cast<uint32_t>(offset / CHECKPOINT_AGENT_BLOCK_SIZE), 1 });
+			}
+		};
+		addAgentJobs(SnapshotSection::Agents, header.agentBufferSize);
+		addAgentJobs(SnapshotSection::Headings, header.headingBufferSize);
+		header.blockCount = static_cast<uint32_t>(jobs.size() + dirtyTiles.size());
+		for (size_t i = 0; i < dirtyTiles.size(); i += CHECKPOINT_TILES_PER_JOB) {
+			auto count = std::min<size_t>(CHECKPOINT_TILES_PER_JOB, dirtyTiles.size() - i);
+			jobs.push_back({ SnapshotSection::Trail, static_cast<uint32_t>(i), static_cast<uint32_t>(count) });
+		}
+
+		jobOutputs = std::vector<std::vector<uint8_t>>(jobs.size());
+		pendingJobs = static_cast<int>(jobs.size());
+		for (size_t i = 0; i < jobs.size(); i++) {
+			auto job = jobs[i];
+			threadPool.submit([this, job, i]() {
+				compress(job, jobOutputs[i]);
+				pendingJobs--;
+			});
+		}
+		stage = Stage::Compressing;
+	}
+
+	// unmaps the readbacks and hands over the record
+	void completeRecord() {
+		glBindBuffer(GL_COPY_READ_BUFFER, agentReadback);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		if (tileData != nullptr) {
+			glBindBuffer(GL_COPY_READ_BUFFER, tileReadback);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		agentData = nullptr;
+		tileData = nullptr;
+
+		StateRecord record;
+		header.recordSize = sizeof(header);
+		for (auto &output : jobOutputs) {
+			header.recordSize += output.size();
+		}
+		record.header = header;
+		record.blocks = std::move(jobOutputs);
+		jobOutputs.clear();
+		stage = Stage::Idle;
+		onRecord(std::move(record));
+	}
+
+public:
+	// hashTiles enables delta records, without it every record is full
+	StateRecorder(int tileSize, bool hashTiles, int threadCount, const std::function<void(StateRecord&&)>& onRecord)
+		: tileSize(tileSize), hashTiles(hashTiles), onRecord(onRecord), pendingJobs(0), threadPool(threadCount) {
+		stage = Stage::Idle;
+		hashShaderProgram = 0;
+		trailCopy = 0;
+		copyWidth = 0;
+		copyHeight = 0;
+		readFramebuffer = 0;
+		hashBuffer = 0;
+		hashBufferSize = 0;
+		agentReadback = 0;
+		agentReadbackSize = 0;
+		tileReadback = 0;
+		tileReadbackSize = 0;
+		fence = nullptr;
+		header = CheckpointRecordHeader{};
+		agentData = nullptr;
+		tileData = nullptr;
+	}
+
+	~StateRecorder() {
+		threadPool.wait();
+	}
+
+	StateRecorder(const StateRecorder&) = delete;
+	StateRecorder& operator=(const StateRecorder&) = delete;
+
+	// needs the GL context that record() and update() will be called from
+	expected<void, std::string> setup() {
+		if (hashTiles) {
+			auto builder = ShaderProgramBuilder();
+			auto result = builder.attachShader(GL_COMPUTE_SHADER, "tile_hash.comp");
+			if (!result) {
+				return result;
+			}
+			auto program = builder.getShaderProgram();
+			if (!program) {
+				return make_unexpected(program.error());
+			}
+			hashShaderProgram = *program;
+			glGenBuffers(1, &hashBuffer);
+		}
+
+		glGenFramebuffers(1, &readFramebuffer);
+		glGenBuffers(1, &agentReadback);
+		glGenBuffers(1, &tileReadback);
+		return {};
+	}
+
+	// false while the previous record is still being made
+	bool isIdle() {
+		return stage == Stage::Idle;
+	}
+
+	// starts a record of the state before the given frame. A delta only has the tiles that changed since the
+	// previous record, it becomes full when there is none or the grid size changed
+	void record(ApplicationBase& application, int frame, bool full) {
+		auto objects = application.getStateObjects();
+		auto width = static_cast<int>(objects.header.width);
+		auto height = static_cast<int>(objects.header.height);
+		if (width != copyWidth || height != copyHeight) {
+			tileHashes.clear();
+		}
+
+		header = CheckpointRecordHeader{};
+		header.magic = CHECKPOINT_MAGIC;
+		header.version = CHECKPOINT_VERSION;
+		header.frame = frame;
+		header.width = objects.header.width;
+		header.height = objects.header.height;
+		header.agentCount = objects.header.agentCount;
+		header.agentLayout = objects.header.agentLayout;
+		header.depositMode = objects.header.depositMode;
+		header.updateMode = objects.header.updateMode;
+		header.agentOffset = objects.header.agentOffset;
+		header.tileSize = tileSize;
+		header.agentBufferSize = objects.agentBufferSize;
+		header.headingBufferSize = objects.headingBufferSize;
+		header.full = full || !hashTiles || tileHashes.empty();
+
+		if (width != copyWidth || height != copyHeight) {
+			if (trailCopy != 0) {
+				glDeleteTextures(1, &trailCopy);
+			}
+			glGenTextures(1, &trailCopy);
+			glBindTexture(GL_TEXTURE_2D, trailCopy);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, trailCopy, 0);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+			copyWidth = width;
+			copyHeight = height;
+		}
+		resizeBuffer(GL_COPY_WRITE_BUFFER, agentReadback, agentReadbackSize,
+				objects.agentBufferSize + objects.headingBufferSize, GL_STREAM_READ);
+
+		// the trail and agents were last written by shaders
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		glCopyImageSubData(objects.trailTexture, GL_TEXTURE_2D, 0, 0, 0, 0, trailCopy, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, agentReadback);
+		glBindBuffer(GL_COPY_READ_BUFFER, objects.agentBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, objects.agentBufferSize);
+		if (objects.headingBufferSize > 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, objects.headingBuffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, objects.agentBufferSize, objects.headingBufferSize);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		if (hashTiles) {
+			auto tileCount = getCheckpointTileCount(width, height, tileSize);
+			resizeBuffer(GL_SHADER_STORAGE_BUFFER, hashBuffer, hashBufferSize, tileCount * sizeof(uint64_t), GL_DYNAMIC_READ);
+
+			glUseProgram(hashShaderProgram);
+			glUniform1i(glGetUniformLocation(hashShaderProgram, "tileSize"), tileSize);
+			glActiveTexture(GL_TEXTURE4);
+			glBindTexture(GL_TEXTURE_2D, trailCopy);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, hashBuffer);
+			glDispatchCompute((width + tileSize - 1) / tileSize, (height + tileSize - 1) / tileSize, 1);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, 0);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glActiveTexture(GL_TEXTURE0);
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		}
+
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		stage = Stage::Copying;
+	}
+
+	// moves the record in flight on as far as the GPU and the workers allow
+	void update() {
+		switch (stage) {
+		case Stage::Idle:
+			break;
+		case Stage::Copying:
+			if (fencePassed(false)) {
+				readDirtyTiles();
+			}
+			break;
+		case Stage::ReadingTiles:
+			if (fencePassed(false)) {
+				startCompression();
+			}
+			break;
+		case Stage::Compressing:
+			if (pendingJobs == 0) {
+				completeRecord();
+			}
+			break;
+		}
+	}
+
+	// completes the record in flight
+	void finish() {
+		if (stage == Stage::Copying) {
+			fencePassed(true);
+			readDirtyTiles();
+		}
+		if (stage == Stage::ReadingTiles) {
+			fencePassed(true);
+			startCompression();
+		}
+		if (stage == Stage::Compressing) {
+			threadPool.wait();
+			completeRecord();
+		}
+	}
+};
+
+#endif
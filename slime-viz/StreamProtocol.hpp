@@ -0,0 +1,224 @@
+#ifndef STREAM_PROTOCOL_HPP
+#define STREAM_PROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+using SocketHandle = SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+using SocketHandle = int;
+constexpr SocketHandle INVALID_SOCKET = -1;
+#endif
+
+#include "expected.hpp"
+
+#include "Compression.hpp"
+
+using namespace nonstd;
+
+// Wire format of the frame stream between StreamServer and slime-viz-viewer, all integers little endian.
+//
+// server to viewer, one message per frame:
+//   uint32 STREAM_FRAME_MAGIC, uint32 frame, uint16 width, uint16 height, uint32 tile count, uint32 payload bytes
+//   then per changed tile: uint16 tile x, uint16 tile y, uint32 encoded bytes, the tile's RLE coded pixels
+// viewer to server, once a frame is shown:
+//   uint32 STREAM_ACK_MAGIC, uint32 frame
+//
+// Pixels are RGBA8 in OpenGL row order (bottom row first), tiles are STREAM_TILE_SIZE squares clipped at the
+// right and top edges. The first frame after connecting or resizing carries every tile.
+
+constexpr uint32_t STREAM_FRAME_MAGIC = 0x53465653; // "SVFS"
+constexpr uint32_t STREAM_ACK_MAGIC = 0x4B415653; // "SVAK"
+constexpr int STREAM_TILE_SIZE = 32;
+constexpr size_t STREAM_FRAME_HEADER_SIZE = 20;
+constexpr size_t STREAM_TILE_HEADER_SIZE = 8;
+constexpr size_t STREAM_ACK_SIZE = 8;
+
+void appendU16(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back(static_cast<uint8_t>(value));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void appendU32(std::vector<uint8_t>& out, uint32_t value) {
+	appendU16(out, value & 0xFFFF);
+	appendU16(out, value >> 16);
+}
+
+void writeU32(uint8_t* out, uint32_t value) {
+	for (int i = 0; i < 4; i++) {
+		out[i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+}
+
+uint32_t readU16(const uint8_t* data) {
+	return data[0] | (data[1] << 8);
+}
+
+uint32_t readU32(const uint8_t* data) {
+	return readU16(data) | (readU16(data + 2) << 16);
+}
+
+// tiles are PackBits coded whole pixels, see appendPackBits()
+void encodeRle(const uint32_t* pixels, size_t count, std::vector<uint8_t>& out) {
+	appendPackBits(reinterpret_cast<const uint8_t*>(pixels), count, sizeof(uint32_t), out);
+}
+
+// false when the data doesn't decode to exactly count pixels
+bool decodeRle(const uint8_t* data, size_t size, uint32_t* pixels, size_t count) {
+	size_t in = 0;
+	return readPackBits(data, size, in, sizeof(uint32_t), reinterpret_cast<uint8_t*>(pixels), sizeof(uint32_t), count) &&
+		in == size;
+}
+
+bool initializeSockets() {
+#ifdef _WIN32
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+	return true;
+#endif
+}
+
+void closeSocket(SocketHandle socket) {
+#ifdef _WIN32
+	closesocket(socket);
+#else
+	close(socket);
+#endif
+}
+
+// wakes up a thread blocked receiving on the socket
+void shutdownSocket(SocketHandle socket) {
+#ifdef _WIN32
+	shutdown(socket, SD_BOTH);
+#else
+	shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+bool sendAll(SocketHandle socket, const uint8_t* data, size_t size) {
+	while (size > 0) {
+#ifdef _WIN32
+		auto sent = send(socket, reinterpret_cast<const char*>(data), static_cast<int>(size), 0);
+#else
+		auto sent = send(socket, data, size, MSG_NOSIGNAL);
+#endif
+		if (sent <= 0) {
+			return false;
+		}
+		data += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+bool receiveAll(SocketHandle socket, uint8_t* data, size_t size) {
+	while (size > 0) {
+		auto received = recv(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0);
+		if (received <= 0) {
+			return false;
+		}
+		data += received;
+		size -= received;
+	}
+	return true;
+}
+
+// true when the socket has data or was closed within timeoutMilliseconds
+bool waitReadable(SocketHandle socket, int timeoutMilliseconds) {
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(socket, &set);
+	timeval timeout = { timeoutMilliseconds / 1000, (timeoutMilliseconds % 1000) * 1000 };
+	return select(static_cast<int>(socket) + 1, &set, nullptr, nullptr, &timeout) > 0;
+}
+
+// "unix:/path" for a Unix domain socket (not on Windows), otherwise "port" or "host:port" over TCP
+bool isUnixSocketAddress(const std::string& address) {
+	return address.rfind("unix:", 0) == 0;
+}
+
+expected<SocketHandle, std::string> openSocket(const std::string& address, bool listening) {
+	if (isUnixSocketAddress(address)) {
+#ifdef _WIN32
+		return make_unexpected("Unix domain sockets are not supported on Windows, use a TCP port\n");
+#else
+		auto path = address.substr(5);
+		sockaddr_un socketAddress{};
+		socketAddress.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(socketAddress.sun_path)) {
+			return make_unexpected("socket path " + path + " is too long\n");
+		}
+		strcpy(socketAddress.sun_path, path.c_str());
+
+		auto handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listening) {
+			unlink(path.c_str());
+		}
+		auto failed = listening
+			? bind(handle, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0 || listen(handle, 1) != 0
+			: connect(handle, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0;
+		if (failed) {
+			closeSocket(handle);
+			return make_unexpected("failed to " + std::string(listening ? "listen on " : "connect to ") + address + "\n");
+		}
+		return handle;
+#endif
+	}
+
+	auto separator = address.rfind(':');
+	auto host = separator == std::string::npos ? std::string() : address.substr(0, separator);
+	auto port = separator == std::string::npos ? address : address.substr(separator + 1);
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	addrinfo* addresses = nullptr;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+		return make_unexpected("failed to resolve " + address + "\n");
+	}
+
+	auto handle = INVALID_SOCKET;
+	for (auto candidate = addresses; candidate != nullptr && handle == INVALID_SOCKET; candidate = candidate->ai_next) {
+		handle = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+		if (handle == INVALID_SOCKET) {
+			continue;
+		}
+		int enable = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enable), sizeof(enable));
+		// frames and acks are sent whole, waiting to coalesce them only adds latency
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+
+		auto failed = listening
+			? bind(handle, candidate->ai_addr, static_cast<int>(candidate->ai_addrlen)) != 0 || listen(handle, 1) != 0
+			: connect(handle, candidate->ai_addr, static_cast<int>(candidate->ai_addrlen)) != 0;
+		if (failed) {
+			closeSocket(handle);
+			handle = INVALID_SOCKET;
+		}
+	}
+	freeaddrinfo(addresses);
+
+	if (handle == INVALID_SOCKET) {
+		return make_unexpected("failed to " + std::string(listening ? "listen on " : "connect to ") + address + "\n");
+	}
+	return handle;
+}
+
+#endif
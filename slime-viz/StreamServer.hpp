@@ -0,0 +1,263 @@
+#ifndef STREAM_SERVER_HPP
+#define STREAM_SERVER_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "expected.hpp"
+
+#include "StreamProtocol.hpp"
+
+using namespace nonstd;
+
+// Streams frames to one viewer at a time as tile deltas, see StreamProtocol.hpp.
+// The server remembers what the viewer shows and only sends tiles where some channel differs from that by
+// more than the threshold, so slow drifts are still sent once they add up. The viewer acks every frame it
+// shows; frames submitted while maxFramesInFlight are unacked are skipped, which caps the frame rate at
+// whatever the viewer and the connection keep up with.
+class StreamServer {
+private:
+	int threshold;
+	int maxFramesInFlight;
+
+	SocketHandle listenSocket;
+	SocketHandle clientSocket;
+	std::thread networkThread;
+	std::atomic<bool> running;
+
+	std::mutex mutex;
+	// what the viewer has, RGBA8 pixels
+	std::vector<uint32_t> reference;
+	int referenceWidth;
+	int referenceHeight;
+	bool hasClient;
+	int lastSubmittedFrame;
+	std::deque<uint32_t> unackedFrames;
+	std::deque<std::vector<uint8_t>> outgoing;
+
+	uint64_t sentBytes;
+	uint64_t rawBytes;
+
+	// network thread: resets the stream state for a new viewer
+	void setClient(SocketHandle socket) {
+		std::lock_guard<std::mutex> lock (mutex);
+		clientSocket = socket;
+		hasClient = socket != INVALID_SOCKET;
+		referenceWidth = 0;
+		referenceHeight = 0;
+		unackedFrames.clear();
+		outgoing.clear();
+	}
+
+	void disconnect() {
+		closeSocket(clientSocket);
+		setClient(INVALID_SOCKET);
+		printf("stream viewer disconnected\n");
+	}
+
+	void receiveAcks() {
+		while (waitReadable(clientSocket, 0)) {
+			uint8_t ack[STREAM_ACK_SIZE];
+			if (!receiveAll(clientSocket, ack, sizeof(ack)) || readU32(ack) != STREAM_ACK_MAGIC) {
+				disconnect();
+				return;
+			}
+			auto frame = readU32(ack + 4);
+			std::lock_guard<std::mutex> lock (mutex);
+			while (!unackedFrames.empty() && unackedFrames.front() <= frame) {
+				unackedFrames.pop_front();
+			}
+		}
+	}
+
+	void serve() {
+		while (running) {
+			if (!hasClient) {
+				if (!waitReadable(listenSocket, 100)) {
+					continue;
+				}
+				auto socket = accept(listenSocket, nullptr, nullptr);
+				if (socket == INVALID_SOCKET) {
+					continue;
+				}
+				int enable = 1;
+				setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+				setClient(socket);
+				printf("stream viewer connected\n");
+				continue;
+			}
+
+			receiveAcks();
+			if (!hasClient) {
+				continue;
+			}
+
+			std::vector<uint8_t> message;
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+				if (!outgoing.empty()) {
+					message = std::move(outgoing.front());
+					outgoing.pop_front();
+				}
+			}
+			if (message.empty()) {
+				waitReadable(clientSocket, 5);
+			}
+			else if (!sendAll(clientSocket, message.data(), message.size())) {
+				disconnect();
+			}
+		}
+	}
+
+	// with the lock held: appends every tile that moved away from the reference and updates the reference
+	uint32_t appendChangedTiles(const uint32_t* pixels, int width, int height, bool allTiles, std::vector<uint8_t>& message) {
+		uint32_t tileCount = 0;
+		std::vector<uint32_t> tile{};
+		for (int tileY = 0; tileY * STREAM_TILE_SIZE < height; tileY++) {
+			for (int tileX = 0; tileX * STREAM_TILE_SIZE < width; tileX++) {
+				auto x0 = tileX * STREAM_TILE_SIZE;
+				auto y0 = tileY * STREAM_TILE_SIZE;
+				auto tileWidth = std::min(STREAM_TILE_SIZE, width - x0);
+				auto tileHeight = std::min(STREAM_TILE_SIZE, height - y0);
+
+				auto changed = allTiles;
+				for (int y = y0; y < y0 + tileHeight && !changed; y++) {
+					for (int x = x0; x < x0 + tileWidth && !changed; x++) {
+						auto index = static_cast<size_t>(y) * width + x;
+						changed = exceedsThreshold(pixels[index], reference[index]);
+					}
+				}
+				if (!changed) {
+					continue;
+				}
+
+				tile.clear();
+				for (int y = y0; y < y0 + tileHeight; y++) {
+					auto row = pixels + static_cast<size_t>(y) * width + x0;
+					tile.insert(tile.end(), row, row + tileWidth);
+					std::copy_n(row, tileWidth, reference.begin() + static_cast<size_t>(y) * width + x0);
+				}
+
+				appendU16(message, tileX);
+				appendU16(message, tileY);
+				auto sizeOffset = message.size();
+				appendU32(message, 0);
+				encodeRle(tile.data(), tile.size(), message);
+				writeU32(message.data() + sizeOffset, static_cast<uint32_t>(message.size() - sizeOffset - 4));
+				tileCount++;
+			}
+		}
+		return tileCount;
+	}
+
+	bool exceedsThreshold(uint32_t pixel, uint32_t referencePixel) {
+		for (int shift = 0; shift < 32; shift += 8) {
+			if (std::abs(static_cast<int>((pixel >> shift) & 0xFF) - static_cast<int>((referencePixel >> shift) & 0xFF)) > threshold) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	StreamServer(int threshold = 2, int maxFramesInFlight = 2) {
+		this->threshold = threshold;
+		this->maxFramesInFlight = maxFramesInFlight;
+		listenSocket = INVALID_SOCKET;
+		clientSocket = INVALID_SOCKET;
+		running = false;
+		referenceWidth = 0;
+		referenceHeight = 0;
+		hasClient = false;
+		lastSubmittedFrame = -1;
+		sentBytes = 0;
+		rawBytes = 0;
+	}
+
+	~StreamServer() {
+		stop();
+	}
+
+	StreamServer(const StreamServer&) = delete;
+	StreamServer& operator=(const StreamServer&) = delete;
+
+	expected<void, std::string> start(const std::string& address) {
+		if (!initializeSockets()) {
+			return make_unexpected("socket initialization failed\n");
+		}
+		auto socket = openSocket(address, true);
+		if (!socket) {
+			return make_unexpected(socket.error());
+		}
+		listenSocket = *socket;
+		running = true;
+		networkThread = std::thread(&StreamServer::serve, this);
+		return {};
+	}
+
+	void stop() {
+		if (!running) {
+			return;
+		}
+		running = false;
+		networkThread.join();
+		if (hasClient) {
+			closeSocket(clientSocket);
+		}
+		closeSocket(listenSocket);
+	}
+
+	// whether a frame submitted now would be sent, to skip the readback otherwise
+	bool canTakeFrame() {
+		std::lock_guard<std::mutex> lock (mutex);
+		return hasClient && static_cast<int>(unackedFrames.size()) < maxFramesInFlight;
+	}
+
+	// any thread. frames older than one already submitted are ignored
+	void submitFrame(int frame, const uint8_t* pixels, int width, int height) {
+		std::lock_guard<std::mutex> lock (mutex);
+		if (!hasClient || static_cast<int>(unackedFrames.size()) >= maxFramesInFlight || frame <= lastSubmittedFrame) {
+			return;
+		}
+		lastSubmittedFrame = frame;
+
+		auto keyframe = width != referenceWidth || height != referenceHeight;
+		if (keyframe) {
+			reference.assign(static_cast<size_t>(width) * height, 0);
+			referenceWidth = width;
+			referenceHeight = height;
+		}
+
+		std::vector<uint8_t> message{};
+		appendU32(message, STREAM_FRAME_MAGIC);
+		appendU32(message, frame);
+		appendU16(message, width);
+		appendU16(message, height);
+		appendU32(message, 0);
+		appendU32(message, 0);
+		auto tileCount = appendChangedTiles(reinterpret_cast<const uint32_t*>(pixels), width, height, keyframe, message);
+		writeU32(message.data() + 12, tileCount);
+		writeU32(message.data() + 16, static_cast<uint32_t>(message.size() - STREAM_FRAME_HEADER_SIZE));
+
+		sentBytes += message.size();
+		rawBytes += static_cast<uint64_t>(width) * height * 4;
+		unackedFrames.push_back(frame);
+		outgoing.push_back(std::move(message));
+	}
+
+	// bytes sent over bytes of the full frames they stand for
+	float getCompressionRatio() {
+		std::lock_guard<std::mutex> lock (mutex);
+		return rawBytes == 0 ? 1.0f : static_cast<float>(sentBytes) / rawBytes;
+	}
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef SUBDOMAIN_EXCHANGE_HPP
+#define SUBDOMAIN_EXCHANGE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "Subdomains.hpp"
+#include "Transport.hpp"
+
+// Messages between the subdomains of a distributed run, all integers little endian:
+//   uint32 SUBDOMAIN_MESSAGE_MAGIC, uint32 kind, uint32 step (0 for Trail), uint32 count, then count items
+// Every step each subdomain sends every neighbour one Agents message, the agents that moved into the
+// neighbour's subdomain, and then one Halo message, its texels in the neighbour's halo. Halo and Trail
+// messages carry rows of RGBA32F texels, bottom row first, of a rectangle both sides derive from the
+// SubdomainGrid, so only the texel count is sent along.
+
+constexpr uint32_t SUBDOMAIN_MESSAGE_MAGIC = 0x58535653; // "SVSX"
+constexpr size_t SUBDOMAIN_MESSAGE_HEADER_SIZE = 16;
+
+enum class SubdomainMessage : uint32_t {
+	Agents = 1,
+	Halo = 2,
+	// a subdomain's own texels, sent to rank 0 once at the end of a run
+	Trail = 3
+};
+
+// One process's side of a distributed run: which part of the grid it owns and what it trades with the
+// processes of the neighbouring subdomains. The first failure is kept and every later call does nothing,
+// the simulation keeps stepping on whatever it has until the caller notices
+class SubdomainExchange {
+private:
+	Transport& transport;
+	SubdomainGrid grid;
+	int rank;
+	std::vector<int> neighbours;
+	std::string error;
+
+	std::vector<uint8_t> createMessage(SubdomainMessage kind, int step, size_t count, const void* items, size_t itemSize) {
+		std::vector<uint8_t> message{};
+		message.reserve(SUBDOMAIN_MESSAGE_HEADER_SIZE + count * itemSize);
+		appendU32(message, SUBDOMAIN_MESSAGE_MAGIC);
+		appendU32(message, static_cast<uint32_t>(kind));
+		appendU32(message, step);
+		appendU32(message, static_cast<uint32_t>(count));
+		auto bytes = static_cast<const uint8_t*>(items);
+		message.insert(message.end(), bytes, bytes + count * itemSize);
+		return message;
+	}
+
+	// the items of the next message from peer, which has to be of this kind and step
+	bool receiveItems(int peer, SubdomainMessage kind, int step, size_t itemSize, std::vector<uint8_t>& items) {
+		if (hasFailed()) {
+			return false;
+		}
+		auto message = transport.receive(peer);
+		if (!message) {
+			error = message.error();
+			return false;
+		}
+		auto &data = *message;
+		if (data.size() < SUBDOMAIN_MESSAGE_HEADER_SIZE || readU32(data.data()) != SUBDOMAIN_MESSAGE_MAGIC ||
+				readU32(data.data() + 4) != static_cast<uint32_t>(kind) || readU32(data.data() + 8) != static_cast<uint32_t>(step) ||
+				data.size() != SUBDOMAIN_MESSAGE_HEADER_SIZE + readU32(data.data() + 12) * itemSize) {
+			error = "rank " + std::to_string(peer) + " sent an unexpected message at step " + std::to_string(step) + "\n";
+			return false;
+		}
+		items.assign(data.begin() + SUBDOMAIN_MESSAGE_HEADER_SIZE, data.end());
+		return true;
+	}
+
+public:
+	SubdomainExchange(Transport& transport, const SubdomainGrid& grid, int rank) : transport(transport), grid(grid) {
+		this->rank = rank;
+		neighbours = grid.getNeighbours(rank);
+	}
+
+	SubdomainExchange(const SubdomainExchange&) = delete;
+	SubdomainExchange& operator=(const SubdomainExchange&) = delete;
+
+	// waits for the neighbours, and for rank 0 which gathers the results
+	expected<void, std::string> connect() {
+		auto peers = neighbours;
+		for (int other = 0; other < grid.getCount(); other++) {
+			if (other != rank && (rank == 0 || other == 0) && std::find(peers.begin(), peers.end(), other) == peers.end()) {
+				peers.push_back(other);
+			}
+		}
+		std::sort(peers.begin(), peers.end());
+		return transport.connect(peers);
+	}
+
+	bool hasFailed() {
+		return !error.empty();
+	}
+
+	const std::string& getError() {
+		return error;
+	}
+
+	int getRank() {
+		return rank;
+	}
+
+	const SubdomainGrid& getGrid() {
+		return grid;
+	}
+
+	GridRect getOwned() {
+		return grid.getOwned(rank);
+	}
+
+	GridRect getTrailRect() {
+		return grid.getTrailRect(rank);
+	}
+
+	const std::vector<int>& getNeighbours() {
+		return neighbours;
+	}
+
+	// the texels of this subdomain the neighbour keeps in its halo
+	GridRect getHaloSent(int neighbour) {
+		return getOwned().intersect(grid.getTrailRect(neighbour));
+	}
+
+	// the neighbour's texels in this subdomain's halo
+	GridRect getHaloReceived(int neighbour) {
+		return grid.getOwned(neighbour).intersect(getTrailRect());
+	}
+
+	// Sends each neighbour the agents that moved into its subdomain, one message per neighbour even without any,
+	// and returns those that arrived from them. Agents are agentSize bytes, getTexel tells where one is
+	std::vector<uint8_t> exchangeAgents(int step, const uint8_t* agents, int count, size_t agentSize,
+			const std::function<void(const uint8_t* agent, int& texelX, int& texelY)>& getTexel) {
+		std::vector<std::vector<uint8_t>> leaving (neighbours.size());
+		for (int i = 0; i < count; i++) {
+			auto agent = agents + i * agentSize;
+			int texelX, texelY;
+			getTexel(agent, texelX, texelY);
+			auto owner = grid.getOwner(texelX, texelY);
+			auto neighbour = std::find(neighbours.begin(), neighbours.end(), owner);
+			if (neighbour == neighbours.end()) {
+				error = "an agent moved past the neighbouring subdomains at step " + std::to_string(step) + "\n";
+				return {};
+			}
+			auto &batch = leaving[neighbour - neighbours.begin()];
+			batch.insert(batch.end(), agent, agent + agentSize);
+		}
+		for (size_t i = 0; i < neighbours.size(); i++) {
+			transport.send(neighbours[i], createMessage(SubdomainMessage::Agents, step, leaving[i].size() / agentSize,
+					leaving[i].data(), agentSize));
+		}
+
+		std::vector<uint8_t> arrived{};
+		std::vector<uint8_t> items{};
+		for (auto neighbour : neighbours) {
+			if (!receiveItems(neighbour, SubdomainMessage::Agents, step, agentSize, items)) {
+				return {};
+			}
+			arrived.insert(arrived.end(), items.begin(), items.end());
+		}
+		return arrived;
+	}
+
+	// texels holds getHaloSent(neighbour)
+	void sendHalo(int step, int neighbour, const float* texels) {
+		if (hasFailed()) {
+			return;
+		}
+		transport.send(neighbour, createMessage(SubdomainMessage::Halo, step, getHaloSent(neighbour).getArea(), texels, 4 * sizeof(float)));
+	}
+
+	// the texels of getHaloReceived(neighbour), empty after a failure
+	std::vector<float> receiveHalo(int step, int neighbour) {
+		std::vector<uint8_t> items{};
+		if (!receiveItems(neighbour, SubdomainMessage::Halo, step, 4 * sizeof(float), items)) {
+			return {};
+		}
+		if (items.size() != getHaloReceived(neighbour).getArea() * 4 * sizeof(float)) {
+			error = "rank " + std::to_string(neighbour) + " sent a halo of the wrong size at step " + std::to_string(step) + "\n";
+			return {};
+		}
+		std::vector<float> texels (items.size() / sizeof(float));
+		memcpy(texels.data(), items.data(), items.size());
+		return texels;
+	}
+
+	// Collects every subdomain's own texels on rank 0, owned holding getOwned(). Returns the texels of the whole grid
+	// on rank 0, bottom row first, and an empty vector on the other ranks
+	std::vector<float> gatherTrail(const std::vector<float>& owned) {
+		if (rank != 0) {
+			transport.send(0, createMessage(SubdomainMessage::Trail, 0, owned.size() / 4, owned.data(), 4 * sizeof(float)));
+			return {};
+		}
+
+		auto whole = grid.getGrid();
+		std::vector<float> trail (whole.getArea() * 4);
+		std::vector<uint8_t> items{};
+		for (int other = 0; other < grid.getCount(); other++) {
+			auto rect = grid.getOwned(other);
+			auto source = owned.data();
+			if (other != 0) {
+				if (!receiveItems(other, SubdomainMessage::Trail, 0, 4 * sizeof(float), items) ||
+						items.size() != rect.getArea() * 4 * sizeof(float)) {
+					error = error.empty() ? "rank " + std::to_string(other) + " sent a trail of the wrong size\n" : error;
+					return {};
+				}
+				source = reinterpret_cast<const float*>(items.data());
+			}
+			for (int row = 0; row < rect.height; row++) {
+				std::copy_n(source + static_cast<size_t>(row) * rect.width * 4, static_cast<size_t>(rect.width) * 4,
+						trail.begin() + (static_cast<size_t>(rect.y + row) * whole.width + rect.x) * 4);
+			}
+		}
+		return trail;
+	}
+};
+
+#endif
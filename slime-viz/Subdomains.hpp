@@ -0,0 +1,113 @@
+#ifndef SUBDOMAINS_HPP
+#define SUBDOMAINS_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+// rectangle of grid texels
+struct GridRect {
+	int x;
+	int y;
+	int width;
+	int height;
+
+	bool isEmpty() const {
+		return width <= 0 || height <= 0;
+	}
+
+	bool contains(int texelX, int texelY) const {
+		return texelX >= x && texelX < x + width && texelY >= y && texelY < y + height;
+	}
+
+	size_t getArea() const {
+		return isEmpty() ? 0 : static_cast<size_t>(width) * height;
+	}
+
+	GridRect intersect(const GridRect& other) const {
+		auto left = std::max(x, other.x);
+		auto bottom = std::max(y, other.y);
+		auto right = std::min(x + width, other.x + other.width);
+		auto top = std::min(y + height, other.y + other.height);
+		return { left, bottom, std::max(0, right - left), std::max(0, top - bottom) };
+	}
+
+	// grown by margin texels on every side
+	GridRect expand(int margin) const {
+		return { x - margin, y - margin, width + 2 * margin, height + 2 * margin };
+	}
+};
+
+// Splits the grid into subdomainsX x subdomainsY rectangles of nearly equal size for a distributed run, numbered
+// row by row from the bottom left like the texture rows. Each subdomain keeps the trail of its own rectangle and
+// a halo of halo texels around it (clipped to the grid), copies of the texels its neighbours own
+class SubdomainGrid {
+private:
+	int gridWidth;
+	int gridHeight;
+	int subdomainsX;
+	int subdomainsY;
+	int halo;
+
+	static int getEdge(int index, int count, int size) {
+		return static_cast<int>(static_cast<int64_t>(size) * index / count);
+	}
+
+	// the column or row holding texel
+	static int getSlice(int texel, int count, int size) {
+		auto slice = 0;
+		while (slice < count - 1 && texel >= getEdge(slice + 1, count, size)) {
+			slice++;
+		}
+		return slice;
+	}
+
+public:
+	SubdomainGrid(int gridWidth, int gridHeight, int subdomainsX, int subdomainsY, int halo) {
+		this->gridWidth = gridWidth;
+		this->gridHeight = gridHeight;
+		this->subdomainsX = subdomainsX;
+		this->subdomainsY = subdomainsY;
+		this->halo = halo;
+	}
+
+	int getCount() const {
+		return subdomainsX * subdomainsY;
+	}
+
+	GridRect getGrid() const {
+		return { 0, 0, gridWidth, gridHeight };
+	}
+
+	GridRect getOwned(int rank) const {
+		auto column = rank % subdomainsX;
+		auto row = rank / subdomainsX;
+		auto x = getEdge(column, subdomainsX, gridWidth);
+		auto y = getEdge(row, subdomainsY, gridHeight);
+		return { x, y, getEdge(column + 1, subdomainsX, gridWidth) - x, getEdge(row + 1, subdomainsY, gridHeight) - y };
+	}
+
+	// the texels whose trail the subdomain keeps
+	GridRect getTrailRect(int rank) const {
+		return getOwned(rank).expand(halo).intersect(getGrid());
+	}
+
+	int getOwner(int texelX, int texelY) const {
+		return getSlice(texelX, subdomainsX, gridWidth) + getSlice(texelY, subdomainsY, gridHeight) * subdomainsX;
+	}
+
+	// the subdomains holding a copy of some of this one's texels, which are also the ones holding texels this
+	// one copies. Agents move less than a halo per step, so they only ever migrate to these
+	std::vector<int> getNeighbours(int rank) const {
+		std::vector<int> neighbours{};
+		auto owned = getOwned(rank);
+		for (int other = 0; other < getCount(); other++) {
+			if (other != rank && !owned.intersect(getTrailRect(other)).isEmpty()) {
+				neighbours.push_back(other);
+			}
+		}
+		return neighbours;
+	}
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TEXTURE_POOL_HPP
+#define TEXTURE_POOL_HPP
+
+#include <glad/glad.h>
+#include <vector>
+#include <algorithm>
+
+// Recycles 2D textures by size and format, so switching the grid between a few sizes
+// doesn't reallocate GPU memory every time
+class TexturePool {
+private:
+	struct Entry {
+		unsigned int texture;
+		int width;
+		int height;
+		GLenum internalFormat;
+		bool inUse;
+	};
+
+	std::vector<Entry> entries;
+
+	unsigned int createTexture(int width, int height, GLenum internalFormat) {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+
+public:
+	unsigned int acquire(int width, int height, GLenum internalFormat) {
+		for (auto &entry : entries) {
+			if (!entry.inUse && entry.width == width && entry.height == height && entry.internalFormat == internalFormat) {
+				entry.inUse = true;
+				return entry.texture;
+			}
+		}
+		entries.push_back(Entry{ createTexture(width, height, internalFormat), width, height, internalFormat, true });
+		return entries.back().texture;
+	}
+
+	void release(unsigned int texture) {
+		for (auto &entry : entries) {
+			if (entry.texture == texture) {
+				entry.inUse = false;
+			}
+		}
+	}
+
+	// deletes unused textures of every size except the given one
+	void trim(int keepWidth, int keepHeight) {
+		auto isStale = [&](const Entry& entry) {
+			return !entry.inUse && (entry.width != keepWidth || entry.height != keepHeight);
+		};
+		for (auto const &entry : entries) {
+			if (isStale(entry)) {
+				glDeleteTextures(1, &entry.texture);
+			}
+		}
+		entries.erase(std::remove_if(entries.begin(), entries.end(), isStale), entries.end());
+	}
+};
+
+#endif
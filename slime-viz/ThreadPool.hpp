@@ -0,0 +1,89 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads running submitted jobs in submission order
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobsDone;
+	int busyWorkers;
+	bool stopping;
+
+	void work() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				busyWorkers++;
+			}
+
+			job();
+
+			std::lock_guard<std::mutex> lock (mutex);
+			busyWorkers--;
+			if (busyWorkers == 0 && jobs.empty()) {
+				jobsDone.notify_all();
+			}
+		}
+	}
+
+public:
+	explicit ThreadPool(int threadCount) {
+		busyWorkers = 0;
+		stopping = false;
+		for (int i = 0; i < threadCount; i++) {
+			workers.emplace_back(&ThreadPool::work, this);
+		}
+	}
+
+	// runs the jobs still queued, then joins the workers
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			stopping = true;
+		}
+		jobAvailable.notify_all();
+		for (auto &worker : workers) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			jobs.push_back(std::move(job));
+		}
+		jobAvailable.notify_one();
+	}
+
+	// blocks until every submitted job has finished
+	void wait() {
+		std::unique_lock<std::mutex> lock (mutex);
+		jobsDone.wait(lock, [this]() { return busyWorkers == 0 && jobs.empty(); });
+	}
+
+	int getThreadCount() {
+		return static_cast<int>(workers.size());
+	}
+};
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef TILED_IMAGE_HPP
+#define TILED_IMAGE_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "expected.hpp"
+
+#include "Compression.hpp"
+#include "Trajectory.hpp"
+
+using namespace nonstd;
+
+// Tiled, pyramidal RGBA8 image file, see TiledRenderer. Level 0 is the full image, every further level half
+// the size of the one below (rounded up) down to a level that fits into a single tile. Tiles are tileSize
+// squares from the top left corner, clipped at the right and bottom edges of their level, and are stored
+// as rows of RGBA8 pixels, top row first, compressed with compressShuffled. A header is followed by the tiles
+// in the order they were finished and an index of all of them, written when the image is complete, so a
+// viewer reads a region of any level without touching the rest of the file. Little endian.
+
+constexpr uint32_t TILED_IMAGE_MAGIC = 0x49545653; // "SVTI"
+constexpr uint32_t TILED_IMAGE_VERSION = 1;
+
+struct TiledImageHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t levelCount;
+	// simulation step the image shows
+	uint32_t frame;
+	uint32_t reserved;
+	// 0 while writing
+	uint64_t indexOffset;
+	uint64_t tileCount;
+};
+
+struct TiledImageTile {
+	uint32_t level;
+	uint32_t tileX;
+	uint32_t tileY;
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved;
+	// of the compressed pixels in the file
+	uint64_t offset;
+	uint64_t size;
+};
+
+// width or height of a level
+int getTiledImageLevelSize(int size, int level) {
+	return static_cast<int>((static_cast<int64_t>(size) + (int64_t(1) << level) - 1) >> level);
+}
+
+int getTiledImageLevelCount(int width, int height, int tileSize) {
+	auto levels = 1;
+	while (getTiledImageLevelSize(width, levels - 1) > tileSize || getTiledImageLevelSize(height, levels - 1) > tileSize) {
+		levels++;
+	}
+	return levels;
+}
+
+// Writes a tiled image from its full resolution tiles alone, building the smaller levels on the way: each tile
+// is box filtered into a quarter of its parent, which is written once its last child arrived. Tiles have to
+// arrive in Morton order (see getMortonTile) so that only one parent per level is ever waiting, the memory
+// stays at a tile per level however large the image is.
+class TiledImageWriter {
+private:
+	struct PendingTile {
+		int tileX;
+		int tileY;
+		int childrenLeft;
+		std::vector<uint8_t> pixels;
+	};
+
+	std::string path;
+	FILE* file;
+	TiledImageHeader header;
+	std::vector<TiledImageTile> index;
+	uint64_t offset;
+	bool failed;
+	// the parent being assembled per level, unused for level 0
+	std::vector<PendingTile> pending;
+	std::vector<uint8_t> compressed;
+
+	int getTileSize() {
+		return static_cast<int>(header.tileSize);
+	}
+
+	int getTilesX(int level) {
+		return (getTiledImageLevelSize(header.width, level) + getTileSize() - 1) / getTileSize();
+	}
+
+	int getTilesY(int level) {
+		return (getTiledImageLevelSize(header.height, level) + getTileSize() - 1) / getTileSize();
+	}
+
+	int getTileWidth(int level, int tileX) {
+		return std::min(getTileSize(), getTiledImageLevelSize(header.width, level) - tileX * getTileSize());
+	}
+
+	int getTileHeight(int level, int tileY) {
+		return std::min(getTileSize(), getTiledImageLevelSize(header.height, level) - tileY * getTileSize());
+	}
+
+	void write(const void* data, size_t size) {
+		failed |= fwrite(data, 1, size, file) != size;
+		offset += size;
+	}
+
+	// averages the tile's 2x2 blocks into its quarter of the parent, blocks cut by the level's edge average fewer pixels
+	void reduceInto(PendingTile& parent, int level, int tileX, int tileY, const uint8_t* pixels) {
+		auto width = getTileWidth(level, tileX);
+		auto height = getTileHeight(level, tileY);
+		auto parentWidth = getTileWidth(level + 1, parent.tileX);
+		auto originX = tileX % 2 * getTileSize() / 2;
+		auto originY = tileY % 2 * getTileSize() / 2;
+		for (int y = 0; y < (height + 1) / 2; y++) {
+			for (int x = 0; x < (width + 1) / 2; x++) {
+				int sums[4] = { 0, 0, 0, 0 };
+				auto count = 0;
+				for (int sourceY = 2 * y; sourceY < std::min(2 * y + 2, height); sourceY++) {
+					for (int sourceX = 2 * x; sourceX < std::min(2 * x + 2, width); sourceX++) {
+						auto source = pixels + (static_cast<size_t>(sourceY) * width + sourceX) * 4;
+						for (int c = 0; c < 4; c++) {
+							sums[c] += source[c];
+						}
+						count++;
+					}
+				}
+				auto target = &parent.pixels[(static_cast<size_t>(originY + y) * parentWidth + originX + x) * 4];
+				for (int c = 0; c < 4; c++) {
+					target[c] = static_cast<uint8_t>((sums[c] + count / 2) / count);
+				}
+			}
+		}
+	}
+
+	void addTile(int level, int tileX, int tileY, const uint8_t* pixels) {
+		auto width = getTileWidth(level, tileX);
+		auto height = getTileHeight(level, tileY);
+		compressed.clear();
+		compressShuffled(pixels, static_cast<size_t>(width) * height * 4, 4, compressed);
+		index.push_back({ static_cast<uint32_t>(level), static_cast<uint32_t>(tileX), static_cast<uint32_t>(tileY),
+				static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, offset, compressed.size() });
+		write(compressed.data(), compressed.size());
+
+		if (level + 1 == static_cast<int>(header.levelCount)) {
+			return;
+		}
+		auto &parent = pending[level + 1];
+		if (parent.childrenLeft == 0) {
+			parent.tileX = tileX / 2;
+			parent.tileY = tileY / 2;
+			// children past the right or bottom edge of the level don't exist
+			parent.childrenLeft = (std::min(tileX / 2 * 2 + 2, getTilesX(level)) - tileX / 2 * 2) *
+					(std::min(tileY / 2 * 2 + 2, getTilesY(level)) - tileY / 2 * 2);
+			parent.pixels.assign(static_cast<size_t>(getTileWidth(level + 1, parent.tileX)) *
+					getTileHeight(level + 1, parent.tileY) * 4, 0);
+		}
+		reduceInto(parent, level, tileX, tileY, pixels);
+		if (--parent.childrenLeft == 0) {
+			auto finished = std::move(parent.pixels);
+			addTile(level + 1, parent.tileX, parent.tileY, finished.data());
+		}
+	}
+
+public:
+	TiledImageWriter() {
+		file = nullptr;
+		header = TiledImageHeader{};
+		offset = 0;
+		failed = false;
+	}
+
+	~TiledImageWriter() {
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	TiledImageWriter(const TiledImageWriter&) = delete;
+	TiledImageWriter& operator=(const TiledImageWriter&) = delete;
+
+	// tileSize has to be even so that a tile reduces into exactly a quarter of its parent
+	expected<void, std::string> open(const std::string& path, int width, int height, int tileSize, int frame) {
+		if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize % 2 != 0) {
+			return make_unexpected("tiled images need a size and an even tile size\n");
+		}
+		this->path = path;
+		file = fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			return make_unexpected("failed to create tiled image " + path + "\n");
+		}
+		header.magic = TILED_IMAGE_MAGIC;
+		header.version = TILED_IMAGE_VERSION;
+		header.width = width;
+		header.height = height;
+		header.tileSize = tileSize;
+		header.levelCount = getTiledImageLevelCount(width, height, tileSize);
+		header.frame = frame;
+		write(&header, sizeof(header));
+		pending = std::vector<PendingTile>(header.levelCount, PendingTile{ 0, 0, 0, {} });
+		return {};
+	}
+
+	const TiledImageHeader& getHeader() {
+		return header;
+	}
+
+	// the level 0 tiles in the order addTile() takes them
+	int getMortonTileCount() {
+		auto side = 1;
+		while (side < getTilesX(0) || side < getTilesY(0)) {
+			side *= 2;
+		}
+		return side * side;
+	}
+
+	// tile of index i of the Morton order over a power of two square of tiles, false for tiles outside the image
+	bool getMortonTile(int i, int& tileX, int& tileY) {
+		tileX = 0;
+		tileY = 0;
+		for (int bit = 0; bit < 16; bit++) {
+			tileX |= (i >> (2 * bit) & 1) << bit;
+			tileY |= (i >> (2 * bit + 1) & 1) << bit;
+		}
+		return tileX < getTilesX(0) && tileY < getTilesY(0);
+	}
+
+	// a full resolution tile, its clipped width times height RGBA8 pixels with the top row first
+	void addTile(int tileX, int tileY, const uint8_t* pixels) {
+		addTile(0, tileX, tileY, pixels);
+	}
+
+	// writes the index and closes the file, every tile has to have been added
+	expected<void, std::string> finish() {
+		header.indexOffset = offset;
+		header.tileCount = index.size();
+		write(index.data(), index.size() * sizeof(TiledImageTile));
+		failed |= seekFile(file, 0) != 0;
+		failed |= fwrite(&header, sizeof(header), 1, file) != 1;
+		failed |= fclose(file) != 0;
+		file = nullptr;
+		if (failed) {
+			return make_unexpected("failed to write tiled image " + path + "\n");
+		}
+		return {};
+	}
+};
+
+class TiledImageReader {
+private:
+	FILE* file;
+	TiledImageHeader header;
+	std::vector<TiledImageTile> tiles;
+
+public:
+	TiledImageReader() {
+		file = nullptr;
+		header = TiledImageHeader{};
+	}
+
+	~TiledImageReader() {
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	TiledImageReader(const TiledImageReader&) = delete;
+	TiledImageReader& operator=(const TiledImageReader&) = delete;
+
+	expected<void, std::string> open(const std::string& path) {
+		file = fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			return make_unexpected("failed to open tiled image " + path + "\n");
+		}
+		if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TILED_IMAGE_MAGIC) {
+			return make_unexpected(path + " is not a slime-viz tiled image\n");
+		}
+		if (header.version != TILED_IMAGE_VERSION) {
+			return make_unexpected(path + " has tiled image version " + std::to_string(header.version) +
+					", expected " + std::to_string(TILED_IMAGE_VERSION) + "\n");
+		}
+		if (header.indexOffset == 0) {
+			return make_unexpected(path + " was not finished\n");
+		}
+		tiles.resize(header.tileCount);
+		if (seekFile(file, header.indexOffset) != 0 ||
+				fread(tiles.data(), sizeof(TiledImageTile), tiles.size(), file) != tiles.size()) {
+			return make_unexpected(path + " has a truncated tile index\n");
+		}
+		return {};
+	}
+
+	const TiledImageHeader& getHeader() {
+		return header;
+	}
+
+	const std::vector<TiledImageTile>& getTiles() {
+		return tiles;
+	}
+
+	// the tile's RGBA8 pixels, top row first
+	expected<std::vector<uint8_t>, std::string> readTile(int level, int tileX, int tileY) {
+		auto tile = std::find_if(tiles.begin(), tiles.end(), [&](const TiledImageTile& entry) {
+			return entry.level == static_cast<uint32_t>(level) && entry.tileX == static_cast<uint32_t>(tileX) &&
+					entry.tileY == static_cast<uint32_t>(tileY);
+		});
+		if (tile == tiles.end()) {
+			return make_unexpected("the tiled image has no tile " + std::to_string(tileX) + ", " + std::to_string(tileY) +
+					" on level " + std::to_string(level) + "\n");
+		}
+		std::vector<uint8_t> data (tile->size);
+		std::vector<uint8_t> pixels (static_cast<size_t>(tile->width) * tile->height * 4);
+		if (seekFile(file, tile->offset) != 0 || fread(data.data(), 1, data.size(), file) != data.size() ||
+				!decompressShuffled(data.data(), data.size(), 4, pixels.data(), pixels.size())) {
+			return make_unexpected("failed to read the tiled image tile at " + std::to_string(tile->offset) + "\n");
+		}
+		return pixels;
+	}
+};
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef TILED_RENDERER_HPP
+#define TILED_RENDERER_HPP
+
+#include <glad/glad.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "expected.hpp"
+
+#include "ApplicationBase.hpp"
+#include "TiledImage.hpp"
+
+using namespace nonstd;
+
+struct RenderSettings {
+	// file names, {frame} is replaced by the frame padded to six digits
+	std::string path = "render_{frame}.svti";
+	// frames between renders, which are taken at the multiples of it
+	int frameInterval = 1000;
+	// even, see TiledImageWriter
+	int tileSize = 256;
+	// tile readbacks in flight
+	int ringSize = 8;
+	// tiles waiting for the writer before rendering waits for it
+	int queuedTiles = 32;
+};
+
+// Renders the colormapped trail at full grid resolution every few frames into a tiled image file
+// (TiledImage.hpp), for grids far larger than anything that could be presented or read back at once. The tiles
+// are rendered in Morton order into a ring of buffers and mapped once their fence has passed, so only the oldest
+// readback is ever waited for while the GPU works on the next ones. A writer thread compresses them and builds
+// the smaller levels. Memory stays at the ring, the queue and a tile per level whatever the grid size.
+class TiledRenderer {
+private:
+	struct Slot {
+		unsigned int buffer;
+		int tileX;
+		int tileY;
+		GLsync fence;
+	};
+
+	// a tile of an image, no pixels once the image is complete
+	struct Job {
+		std::shared_ptr<TiledImageWriter> image;
+		int tileX;
+		int tileY;
+		std::vector<uint8_t> pixels;
+	};
+
+	RenderSettings settings;
+	std::vector<Slot> slots;
+	int nextSlot;
+	int oldestSlot;
+	// -1 until the first update()
+	int nextRenderFrame;
+	std::shared_ptr<TiledImageWriter> image;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable jobQueued;
+	std::condition_variable jobWritten;
+	std::deque<Job> jobs;
+	bool stopping;
+
+	size_t getTileBytes() {
+		return static_cast<size_t>(settings.tileSize) * settings.tileSize * 4;
+	}
+
+	void writeTiles() {
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				jobQueued.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty()) {
+					break;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			jobWritten.notify_all();
+
+			if (!job.pixels.empty()) {
+				job.image->addTile(job.tileX, job.tileY, job.pixels.data());
+				continue;
+			}
+			auto finished = job.image->finish();
+			if (!finished) {
+				fprintf(stderr, "%s", finished.error().c_str());
+			}
+		}
+	}
+
+	// hands the job to the writer, waiting while it is too far behind
+	void queueJob(Job job) {
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			jobWritten.wait(lock, [this]() { return static_cast<int>(jobs.size()) < settings.queuedTiles; });
+			jobs.push_back(std::move(job));
+		}
+		jobQueued.notify_one();
+	}
+
+	// queues the oldest readback, false when there is none
+	bool collectOldest() {
+		auto &slot = slots[oldestSlot];
+		if (slot.fence == nullptr) {
+			return false;
+		}
+		glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+
+		auto &header = image->getHeader();
+		auto width = std::min<int>(settings.tileSize, header.width - slot.tileX * settings.tileSize);
+		auto height = std::min<int>(settings.tileSize, header.height - slot.tileY * settings.tileSize);
+		auto size = static_cast<size_t>(width) * height * 4;
+		glBindBuffer(GL_COPY_READ_BUFFER, slot.buffer);
+		auto data = static_cast<const uint8_t*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT));
+		Job job{ image, slot.tileX, slot.tileY, std::vector<uint8_t>(data, data + size) };
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		queueJob(std::move(job));
+
+		oldestSlot = (oldestSlot + 1) % static_cast<int>(slots.size());
+		return true;
+	}
+
+public:
+	TiledRenderer(const RenderSettings& settings = RenderSettings()) : settings(settings) {
+		slots = std::vector<Slot>(settings.ringSize, Slot{ 0, 0, 0, nullptr });
+		nextSlot = 0;
+		oldestSlot = 0;
+		nextRenderFrame = -1;
+		stopping = false;
+	}
+
+	// finishes the images rendered so far
+	~TiledRenderer() {
+		if (writer.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+				stopping = true;
+			}
+			jobQueued.notify_all();
+			writer.join();
+		}
+	}
+
+	TiledRenderer(const TiledRenderer&) = delete;
+	TiledRenderer& operator=(const TiledRenderer&) = delete;
+
+	// needs the GL context that update() will be called from
+	expected<void, std::string> setup() {
+		if (settings.tileSize <= 0 || settings.tileSize % 2 != 0) {
+			return make_unexpected("the render tile size has to be even\n");
+		}
+		for (auto &slot : slots) {
+			glGenBuffers(1, &slot.buffer);
+			glBindBuffer(GL_COPY_READ_BUFFER, slot.buffer);
+			glBufferData(GL_COPY_READ_BUFFER, getTileBytes(), nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		writer = std::thread(&TiledRenderer::writeTiles, this);
+		return {};
+	}
+
+	std::string getPath(int frame) {
+		char number[16];
+		snprintf(number, sizeof(number), "%06d", frame);
+		auto path = settings.path;
+		for (auto found = path.find("{frame}"); found != std::string::npos; found = path.find("{frame}", found + strlen(number))) {
+			path.replace(found, 7, number);
+		}
+		return path;
+	}
+
+	// steps that can be run from frame without passing the next render, for ending a frame's steps there
+	int getFramesToNextRender(int frame) {
+		return settings.frameInterval - frame % settings.frameInterval;
+	}
+
+	// after run(), frame being the next step to run. Renders once the run reached the next multiple of frameInterval,
+	// late when a frame's steps ran past it, and returns once every tile has been read back, the writer may still be
+	// busy with them
+	void update(ApplicationBase& application, int frame) {
+		// the first update, or the run went back to an earlier state
+		if (nextRenderFrame < 0 || frame < nextRenderFrame - settings.frameInterval) {
+			nextRenderFrame = (frame + settings.frameInterval - 1) / settings.frameInterval * settings.frameInterval;
+		}
+		if (frame < nextRenderFrame) {
+			return;
+		}
+		nextRenderFrame = (frame / settings.frameInterval + 1) * settings.frameInterval;
+
+		auto path = getPath(frame);
+		image = std::make_shared<TiledImageWriter>();
+		auto opened = image->open(path, application.getGridWidth(), application.getGridHeight(), settings.tileSize, frame);
+		if (!opened) {
+			fprintf(stderr, "%s", opened.error().c_str());
+			image.reset();
+			return;
+		}
+
+		for (int i = 0; i < image->getMortonTileCount(); i++) {
+			int tileX, tileY;
+			if (!image->getMortonTile(i, tileX, tileY)) {
+				continue;
+			}
+			// the ring is full, this only waits for its oldest readback
+			auto &slot = slots[nextSlot];
+			if (slot.fence != nullptr) {
+				collectOldest();
+			}
+			auto x = tileX * settings.tileSize;
+			auto y = tileY * settings.tileSize;
+			application.renderTile(slot.buffer, x, y, std::min(settings.tileSize, application.getGridWidth() - x),
+					std::min(settings.tileSize, application.getGridHeight() - y));
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			slot.tileX = tileX;
+			slot.tileY = tileY;
+			slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			nextSlot = (nextSlot + 1) % static_cast<int>(slots.size());
+		}
+		while (collectOldest());
+		queueJob(Job{ image, 0, 0, {} });
+		image.reset();
+	}
+
+	// waits for the writer to finish every image rendered
+	void finish() {
+		if (!writer.joinable()) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			stopping = true;
+		}
+		jobQueued.notify_all();
+		writer.join();
+	}
+};
+
+#endif
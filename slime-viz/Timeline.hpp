@@ -0,0 +1,268 @@
+#ifndef TIMELINE_HPP
+#define TIMELINE_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "expected.hpp"
+
+#include "ApplicationBase.hpp"
+#include "Checkpoint.hpp"
+#include "StateRecorder.hpp"
+
+using namespace nonstd;
+
+struct TimelineSettings {
+	// frames between keyframes, doubled whenever the keyframes outgrow both budgets
+	int keyframeInterval = 256;
+	// compressed bytes of keyframes kept in memory
+	size_t memoryBudget = static_cast<size_t>(1) << 30;
+	// keyframes that do not fit in memory go to files named diskPath plus the frame, up to diskBudget bytes
+	// (0 keeps them in memory only)
+	std::string diskPath = "slime-viz.keyframe.";
+	size_t diskBudget = static_cast<size_t>(8) << 30;
+	int threadCount = 4;
+};
+
+// Keyframes of the run so far for seeking to any frame. A step only depends on the state before it and
+// the frame number (steering randomness is a hash of both), so seeking restores the nearest keyframe at
+// or before the target and simulates forward from it without presenting. That holds as long as the
+// agent fraction stays the same and the deposit mode has no races, which the simulation has to be set up
+// for with SimulationSettings::reproducible, or a replay drifts from the original run.
+// Keyframes are full checkpoint records (see Checkpoint.hpp) made in the background by a StateRecorder.
+// Once they exceed the memory budget the oldest ones move to disk, and once that budget is used up too
+// every second one is dropped and the interval doubles. The keyframes always cover the whole run, and a
+// seek reads at most one keyframe back from disk and replays less than one interval: with the defaults
+// and about 20 MB per keyframe that is over 400 keyframes before the interval first doubles.
+class Timeline {
+private:
+	struct Keyframe {
+		CheckpointRecordHeader header;
+		// the blocks following the header, empty once the keyframe is on disk
+		std::vector<uint8_t> data;
+		size_t size;
+		bool onDisk;
+	};
+
+	TimelineSettings settings;
+	int interval;
+	std::map<int, Keyframe> keyframes;
+	size_t keyframeBytes;
+	size_t diskBytes;
+	bool diskFailed;
+	// bumped by discardAfter() so that the keyframe in flight is dropped too
+	int generation;
+	int recordGeneration;
+
+	// declared last so its compression jobs finish before anything they use is destroyed
+	StateRecorder recorder;
+
+	void addKeyframe(StateRecord&& record) {
+		if (recordGeneration != generation) {
+			return;
+		}
+		Keyframe keyframe;
+		keyframe.header = record.header;
+		for (auto &block : record.blocks) {
+			keyframe.data.insert(keyframe.data.end(), block.begin(), block.end());
+		}
+		keyframe.size = keyframe.data.size();
+		keyframe.onDisk = false;
+		keyframeBytes += keyframe.size;
+		keyframes[static_cast<int>(record.header.frame)] = std::move(keyframe);
+
+		while (keyframeBytes > settings.memoryBudget && keyframes.size() > 1) {
+			if (!spillOldest()) {
+				thin();
+			}
+		}
+	}
+
+	std::string getDiskPath(int frame) {
+		char number[16];
+		snprintf(number, sizeof(number), "%06d", frame);
+		return settings.diskPath + number;
+	}
+
+	// moves the oldest keyframe still in memory to disk, false if it does not fit the disk budget
+	bool spillOldest() {
+		auto it = keyframes.begin();
+		while (it != keyframes.end() && it->second.onDisk) {
+			++it;
+		}
+		if (it == keyframes.end() || diskFailed || diskBytes + it->second.size > settings.diskBudget) {
+			return false;
+		}
+
+		auto path = getDiskPath(it->first);
+		auto file = fopen(path.c_str(), "wb");
+		auto failed = file == nullptr;
+		if (file != nullptr) {
+			failed |= fwrite(it->second.data.data(), 1, it->second.size, file) != it->second.size;
+			failed |= fclose(file) != 0;
+		}
+		if (failed) {
+			remove(path.c_str());
+			printf("could not write keyframe %s, keeping keyframes in memory only\n", path.c_str());
+			diskFailed = true;
+			return false;
+		}
+
+		keyframeBytes -= it->second.size;
+		diskBytes += it->second.size;
+		it->second.onDisk = true;
+		std::vector<uint8_t>().swap(it->second.data);
+		return true;
+	}
+
+	std::map<int, Keyframe>::iterator erase(std::map<int, Keyframe>::iterator it) {
+		if (it->second.onDisk) {
+			remove(getDiskPath(it->first).c_str());
+			diskBytes -= it->second.size;
+		}
+		else {
+			keyframeBytes -= it->second.size;
+		}
+		return keyframes.erase(it);
+	}
+
+	// drops every second keyframe after the first and doubles the interval
+	void thin() {
+		interval *= 2;
+		auto keep = true;
+		for (auto it = keyframes.begin(); it != keyframes.end();) {
+			if (keep) {
+				++it;
+			}
+			else {
+				it = erase(it);
+			}
+			keep = !keep;
+		}
+	}
+
+	expected<std::vector<uint8_t>, std::string> readKeyframe(int frame, const Keyframe& keyframe) {
+		if (!keyframe.onDisk) {
+			return keyframe.data;
+		}
+		auto path = getDiskPath(frame);
+		std::vector<uint8_t> data(keyframe.size);
+		auto file = fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			return make_unexpected("could not open keyframe " + path + "\n");
+		}
+		auto read = fread(data.data(), 1, data.size(), file);
+		fclose(file);
+		if (read != data.size()) {
+			return make_unexpected("could not read keyframe " + path + "\n");
+		}
+		return data;
+	}
+
+	// no keyframe yet in the interval the frame belongs to
+	bool isKeyframeDue(int frame) {
+		auto next = keyframes.lower_bound(frame / interval * interval);
+		return next == keyframes.end() || next->first > frame;
+	}
+
+public:
+	Timeline(const TimelineSettings& settings = TimelineSettings())
+		: settings(settings), recorder(CHECKPOINT_TILE_SIZE, false, settings.threadCount,
+				[this](StateRecord&& record) { addKeyframe(std::move(record)); }) {
+		interval = settings.keyframeInterval;
+		keyframeBytes = 0;
+		diskBytes = 0;
+		diskFailed = settings.diskBudget == 0;
+		generation = 0;
+		recordGeneration = 0;
+	}
+
+	// the keyframe files only serve this run
+	~Timeline() {
+		for (auto it = keyframes.begin(); it != keyframes.end();) {
+			it = erase(it);
+		}
+	}
+
+	Timeline(const Timeline&) = delete;
+	Timeline& operator=(const Timeline&) = delete;
+
+	// needs the GL context that update() and seek() will be called from
+	expected<void, std::string> setup() {
+		return recorder.setup();
+	}
+
+	// after run(), frame being the next step to run. Records a keyframe when one is due and otherwise moves
+	// the one in flight on as far as the GPU and the workers allow
+	void update(ApplicationBase& application, int frame) {
+		recorder.update();
+		if (recorder.isIdle() && isKeyframeDue(frame)) {
+			recordGeneration = generation;
+			recorder.record(application, frame, true);
+		}
+	}
+
+	// forgets the keyframes after a frame, when the run took another course from there, e.g. after the grid
+	// was resized or a snapshot loaded (-1 forgets all of them)
+	void discardAfter(int frame) {
+		generation++;
+		for (auto it = keyframes.upper_bound(frame); it != keyframes.end();) {
+			it = erase(it);
+		}
+	}
+
+	// Moves the simulation to the given frame, or the first keyframe if that is later. Returns the frame
+	// reached, which is the next step to run
+	expected<int, std::string> seek(ApplicationBase& application, int frame) {
+		if (keyframes.empty()) {
+			return make_unexpected("there is no keyframe to seek from yet\n");
+		}
+		auto keyframe = keyframes.upper_bound(frame);
+		if (keyframe != keyframes.begin()) {
+			--keyframe;
+		}
+
+		auto data = readKeyframe(keyframe->first, keyframe->second);
+		if (!data) {
+			return make_unexpected(data.error());
+		}
+		CheckpointState state{};
+		auto decodeResult = applyCheckpointRecord(keyframe->second.header, *data, state);
+		if (!decodeResult) {
+			return make_unexpected(decodeResult.error());
+		}
+		auto result = application.setState(state.header, state.agents.data(), state.headings.data(), state.trail.data());
+		if (!result) {
+			return make_unexpected(result.error());
+		}
+
+		auto keyframeFrame = keyframe->first;
+		if (frame > keyframeFrame) {
+			application.run(keyframeFrame, frame - keyframeFrame);
+			return frame;
+		}
+		return keyframeFrame;
+	}
+
+	// completes the keyframe in flight
+	void finish() {
+		recorder.finish();
+	}
+
+	int getKeyframeCount() {
+		return static_cast<int>(keyframes.size());
+	}
+
+	size_t getKeyframeBytes() {
+		return keyframeBytes;
+	}
+
+	size_t getDiskBytes() {
+		return diskBytes;
+	}
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// Trajectory file of sampled agents, see TrajectoryRecorder. A header is followed by chunks, each holding
+// a range of samples (frames) for a range of sampled agents, and finally an index of all chunk headers.
+// A chunk is its header, the frame numbers of its samples and then the x, y and heading columns. Columns
+// are agent-major, every agent's samples follow each other. Chunk headers carry the frame and position
+// ranges of their data, so readers pick chunks from the index without touching the rest of the file.
+// The index is written when recording ends; without one (a crash) the chunk headers can be walked instead.
+// Positions are in grid texels, headings in radians, NaN for agents that didn't exist. Little endian.
+
+constexpr uint32_t TRAJECTORY_MAGIC = 0x52545653; // "SVTR"
+constexpr uint32_t TRAJECTORY_VERSION = 1;
+constexpr uint32_t TRAJECTORY_CHUNK_MAGIC = 0x4B484354; // "TCHK"
+
+struct TrajectoryHeader {
+	uint32_t magic;
+	uint32_t version;
+	// agents firstAgent, firstAgent + agentStride, ... are sampled, agentCount of them. Agent ranges in
+	// chunks count these sampled agents from 0
+	uint32_t firstAgent;
+	uint32_t agentStride;
+	uint32_t agentCount;
+	// frames between samples as configured, the chunks hold the frame each sample was actually taken at
+	uint32_t frameInterval;
+	// 0 while recording
+	uint64_t indexOffset;
+	uint64_t chunkCount;
+};
+
+// also the index entries
+struct TrajectoryChunkHeader {
+	uint32_t magic;
+	uint32_t sampleCount;
+	uint32_t firstAgent;
+	uint32_t agentCount;
+	// of this header in the file, and the size of the whole chunk
+	uint64_t offset;
+	uint64_t size;
+	uint32_t firstFrame;
+	uint32_t lastFrame;
+	// bounds of the positions in the chunk, NaN when all of them are
+	float minX;
+	float maxX;
+	float minY;
+	float maxY;
+};
+
+int seekFile(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+	return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+struct TrajectoryChunk {
+	TrajectoryChunkHeader header;
+	std::vector<uint32_t> frames;
+	// sample s of the chunk's agent a is at [a * header.sampleCount + s]
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> heading;
+};
+
+class TrajectoryReader {
+private:
+	FILE* file;
+	TrajectoryHeader header;
+	std::vector<TrajectoryChunkHeader> chunks;
+
+	// reads chunk headers one after the other up to the first incomplete chunk
+	void walkChunks() {
+		uint64_t offset = sizeof(header);
+		TrajectoryChunkHeader chunk;
+		uint8_t lastByte;
+		while (seekFile(file, offset) == 0 && fread(&chunk, sizeof(chunk), 1, file) == 1 &&
+				chunk.magic == TRAJECTORY_CHUNK_MAGIC && chunk.size > sizeof(chunk) &&
+				seekFile(file, offset + chunk.size - 1) == 0 && fread(&lastByte, 1, 1, file) == 1) {
+			chunks.push_back(chunk);
+			offset += chunk.size;
+		}
+	}
+
+public:
+	TrajectoryReader() {
+		file = nullptr;
+		header = TrajectoryHeader{};
+	}
+
+	~TrajectoryReader() {
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	TrajectoryReader(const TrajectoryReader&) = delete;
+	TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+	expected<void, std::string> open(const std::string& path) {
+		file = fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			return make_unexpected("failed to open trajectory " + path + "\n");
+		}
+		if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRAJECTORY_MAGIC) {
+			return make_unexpected(path + " is not a slime-viz trajectory\n");
+		}
+		if (header.version != TRAJECTORY_VERSION) {
+			return make_unexpected(path + " has trajectory version " + std::to_string(header.version) +
+					", expected " + std::to_string(TRAJECTORY_VERSION) + "\n");
+		}
+
+		if (header.indexOffset == 0) {
+			walkChunks();
+			return {};
+		}
+		chunks.resize(header.chunkCount);
+		if (seekFile(file, header.indexOffset) != 0 ||
+				fread(chunks.data(), sizeof(TrajectoryChunkHeader), chunks.size(), file) != chunks.size()) {
+			return make_unexpected(path + " has a truncated chunk index\n");
+		}
+		return {};
+	}
+
+	const TrajectoryHeader& getHeader() {
+		return header;
+	}
+
+	const std::vector<TrajectoryChunkHeader>& getChunks() {
+		return chunks;
+	}
+
+	// chunks overlapping the frame range and the range of sampled agents, both inclusive
+	std::vector<TrajectoryChunkHeader> findChunks(uint32_t firstFrame, uint32_t lastFrame, uint32_t firstAgent, uint32_t lastAgent) {
+		std::vector<TrajectoryChunkHeader> found{};
+		for (auto &chunk : chunks) {
+			if (chunk.firstFrame <= lastFrame && chunk.lastFrame >= firstFrame &&
+					chunk.firstAgent <= lastAgent && chunk.firstAgent + chunk.agentCount > firstAgent) {
+				found.push_back(chunk);
+			}
+		}
+		return found;
+	}
+
+	expected<TrajectoryChunk, std::string> readChunk(const TrajectoryChunkHeader& chunkHeader) {
+		TrajectoryChunk chunk;
+		auto values = static_cast<size_t>(chunkHeader.sampleCount) * chunkHeader.agentCount;
+		chunk.frames.resize(chunkHeader.sampleCount);
+		chunk.x.resize(values);
+		chunk.y.resize(values);
+		chunk.heading.resize(values);
+		if (seekFile(file, chunkHeader.offset) != 0 || fread(&chunk.header, sizeof(chunk.header), 1, file) != 1 ||
+				chunk.header.magic != TRAJECTORY_CHUNK_MAGIC ||
+				fread(chunk.frames.data(), sizeof(uint32_t), chunk.frames.size(), file) != chunk.frames.size() ||
+				fread(chunk.x.data(), sizeof(float), values, file) != values ||
+				fread(chunk.y.data(), sizeof(float), values, file) != values ||
+				fread(chunk.heading.data(), sizeof(float), values, file) != values) {
+			return make_unexpected("failed to read the trajectory chunk at " + std::to_string(chunkHeader.offset) + "\n");
+		}
+		return chunk;
+	}
+};
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef TRAJECTORY_RECORDER_HPP
+#define TRAJECTORY_RECORDER_HPP
+
+#include <glad/glad.h>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "expected.hpp"
+
+#include "ApplicationBase.hpp"
+#include "Trajectory.hpp"
+
+using namespace nonstd;
+
+struct TrajectorySettings {
+	std::string path = "slime-viz.trajectory";
+	// agents firstAgent, firstAgent + agentStride, ... are sampled, agentCount of them
+	int firstAgent = 0;
+	int agentStride = 100;
+	int agentCount = 10000;
+	// frames between samples, which are taken at the multiples of it
+	int frameInterval = 10;
+	// samples per chunk, fewer when that many would exceed chunkBytes
+	int chunkSamples = 256;
+	size_t chunkBytes = 64 << 20;
+	// sampled agents per chunk in the file, the granularity of agent range reads
+	int chunkAgents = 65536;
+	// sample readbacks in flight
+	int ringSize = 4;
+	// chunks waiting for the writer before sampling waits for it
+	int queuedChunks = 2;
+};
+
+// Samples a subset of the agents every few frames and streams them to a trajectory file (Trajectory.hpp).
+// A compute pass gathers the sampled agents into a ring of buffers, which are mapped once their fence has
+// passed, so update() never waits for the GPU. Samples are collected into chunks as they arrive; a writer
+// thread splits full chunks by agent range, transposes them into columns and appends them. Memory stays at
+// a few chunks however long the recording runs: sampling waits for the writer when it falls behind.
+class TrajectoryRecorder {
+private:
+	struct Slot {
+		unsigned int buffer;
+		int frame;
+		GLsync fence;
+	};
+
+	// samples as they were read back, frame-major: the x, y and heading columns of one sample after another
+	struct Chunk {
+		std::vector<uint32_t> frames;
+		std::vector<float> samples;
+	};
+
+	TrajectorySettings settings;
+	int chunkSamples;
+	std::vector<Slot> slots;
+	int nextSlot;
+	int oldestSlot;
+	Chunk chunk;
+	// -1 until the first update()
+	int nextSampleFrame;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable chunkQueued;
+	std::condition_variable chunkWritten;
+	std::deque<Chunk> chunks;
+	bool stopping;
+
+	// owned by the writer thread once it runs
+	FILE* file;
+	TrajectoryHeader header;
+	std::vector<TrajectoryChunkHeader> index;
+	uint64_t offset;
+	bool failed;
+
+	size_t getSampleSize() {
+		return static_cast<size_t>(settings.agentCount) * 3 * sizeof(float);
+	}
+
+	void write(const void* data, size_t size) {
+		failed |= fwrite(data, 1, size, file) != size;
+		offset += size;
+	}
+
+	// appends the samples of agents [firstAgent, firstAgent + agentCount) as one chunk in the file
+	void writeChunk(const Chunk& samples, int firstAgent, int agentCount) {
+		auto sampleCount = static_cast<int>(samples.frames.size());
+		auto sampledAgents = static_cast<size_t>(settings.agentCount);
+		std::vector<float> columns[3];
+		float minimum[3];
+		float maximum[3];
+		for (int c = 0; c < 3; c++) {
+			columns[c].resize(static_cast<size_t>(agentCount) * sampleCount);
+			minimum[c] = INFINITY;
+			maximum[c] = -INFINITY;
+			for (int s = 0; s < sampleCount; s++) {
+				auto source = &samples.samples[(s * 3 + c) * sampledAgents + firstAgent];
+				for (int a = 0; a < agentCount; a++) {
+					auto value = source[a];
+					columns[c][static_cast<size_t>(a) * sampleCount + s] = value;
+					// comparisons with NaN are false, so missing agents don't widen the bounds
+					minimum[c] = value < minimum[c] ? value : minimum[c];
+					maximum[c] = value > maximum[c] ? value : maximum[c];
+				}
+			}
+		}
+
+		TrajectoryChunkHeader chunkHeader{};
+		chunkHeader.magic = TRAJECTORY_CHUNK_MAGIC;
+		chunkHeader.sampleCount = sampleCount;
+		chunkHeader.firstAgent = firstAgent;
+		chunkHeader.agentCount = agentCount;
+		chunkHeader.offset = offset;
+		chunkHeader.size = sizeof(chunkHeader) + sampleCount * sizeof(uint32_t) + columns[0].size() * sizeof(float) * 3;
+		chunkHeader.firstFrame = samples.frames.front();
+		chunkHeader.lastFrame = samples.frames.back();
+		auto hasPositions = minimum[0] <= maximum[0];
+		chunkHeader.minX = hasPositions ? minimum[0] : NAN;
+		chunkHeader.maxX = hasPositions ? maximum[0] : NAN;
+		chunkHeader.minY = hasPositions ? minimum[1] : NAN;
+		chunkHeader.maxY = hasPositions ? maximum[1] : NAN;
+		index.push_back(chunkHeader);
+
+		write(&chunkHeader, sizeof(chunkHeader));
+		write(samples.frames.data(), sampleCount * sizeof(uint32_t));
+		for (auto &column : columns) {
+			write(column.data(), column.size() * sizeof(float));
+		}
+	}
+
+	void writeChunks() {
+		while (true) {
+			Chunk samples;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				chunkQueued.wait(lock, [this]() { return stopping || !chunks.empty(); });
+				if (chunks.empty()) {
+					break;
+				}
+				samples = std::move(chunks.front());
+				chunks.pop_front();
+			}
+			chunkWritten.notify_all();
+
+			for (int first = 0; first < settings.agentCount; first += settings.chunkAgents) {
+				writeChunk(samples, first, std::min(settings.chunkAgents, settings.agentCount - first));
+			}
+			failed |= fflush(file) != 0;
+		}
+
+		header.indexOffset = offset;
+		header.chunkCount = index.size();
+		write(index.data(), index.size() * sizeof(TrajectoryChunkHeader));
+		failed |= seekFile(file, 0) != 0;
+		failed |= fwrite(&header, sizeof(header), 1, file) != 1;
+		failed |= fclose(file) != 0;
+		file = nullptr;
+		if (failed) {
+			fprintf(stderr, "failed to write trajectory %s\n", settings.path.c_str());
+		}
+	}
+
+	// hands the chunk to the writer, waiting while it is too far behind
+	void queueChunk() {
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			chunkWritten.wait(lock, [this]() { return static_cast<int>(chunks.size()) < settings.queuedChunks; });
+			chunks.push_back(std::move(chunk));
+		}
+		chunkQueued.notify_one();
+
+		chunk = Chunk{};
+		chunk.frames.reserve(chunkSamples);
+		chunk.samples.reserve(chunkSamples * getSampleSize() / sizeof(float));
+	}
+
+	// adds the oldest readback to the chunk, false when there is none or it hasn't finished
+	bool collectOldest(bool wait) {
+		auto &slot = slots[oldestSlot];
+		if (slot.fence == nullptr) {
+			return false;
+		}
+		auto status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, slot.buffer);
+		auto data = static_cast<const float*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, getSampleSize(), GL_MAP_READ_BIT));
+		chunk.samples.insert(chunk.samples.end(), data, data + getSampleSize() / sizeof(float));
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		chunk.frames.push_back(slot.frame);
+
+		if (static_cast<int>(chunk.frames.size()) == chunkSamples) {
+			queueChunk();
+		}
+		oldestSlot = (oldestSlot + 1) % static_cast<int>(slots.size());
+		return true;
+	}
+
+public:
+	TrajectoryRecorder(const TrajectorySettings& settings = TrajectorySettings()) : settings(settings) {
+		chunkSamples = static_cast<int>(std::max<size_t>(1, std::min<size_t>(settings.chunkSamples, settings.chunkBytes / getSampleSize())));
+		slots = std::vector<Slot>(settings.ringSize, Slot{ 0, 0, nullptr });
+		nextSlot = 0;
+		oldestSlot = 0;
+		nextSampleFrame = -1;
+		stopping = false;
+		file = nullptr;
+		header = TrajectoryHeader{};
+		offset = 0;
+		failed = false;
+	}
+
+	// writes what was sampled so far
+	~TrajectoryRecorder() {
+		if (writer.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock (mutex);
+				stopping = true;
+			}
+			chunkQueued.notify_all();
+			writer.join();
+		}
+	}
+
+	TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+	TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+	// creates the file, needs the GL context that update() will be called from
+	expected<void, std::string> setup() {
+		file = fopen(settings.path.c_str(), "wb");
+		if (file == nullptr) {
+			return make_unexpected("failed to create trajectory " + settings.path + "\n");
+		}
+		header.magic = TRAJECTORY_MAGIC;
+		header.version = TRAJECTORY_VERSION;
+		header.firstAgent = settings.firstAgent;
+		header.agentStride = settings.agentStride;
+		header.agentCount = settings.agentCount;
+		header.frameInterval = settings.frameInterval;
+		write(&header, sizeof(header));
+
+		for (auto &slot : slots) {
+			glGenBuffers(1, &slot.buffer);
+			glBindBuffer(GL_COPY_READ_BUFFER, slot.buffer);
+			glBufferData(GL_COPY_READ_BUFFER, getSampleSize(), nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		chunk.frames.reserve(chunkSamples);
+		chunk.samples.reserve(chunkSamples * getSampleSize() / sizeof(float));
+		writer = std::thread(&TrajectoryRecorder::writeChunks, this);
+		return {};
+	}
+
+	// steps that can be run from frame without passing the next sample, for ending a frame's steps there
+	int getFramesToNextSample(int frame) {
+		return settings.frameInterval - frame % settings.frameInterval;
+	}
+
+	// after run(), frame being the next step to run. Collects finished samples and takes one once the run reached
+	// the next multiple of frameInterval; a sample that a frame's steps ran past is taken late, with its own frame
+	void update(ApplicationBase& application, int frame) {
+		// readbacks finish in order
+		while (collectOldest(false));
+		// the first update, or the run went back to an earlier state
+		if (nextSampleFrame < 0 || frame < nextSampleFrame - settings.frameInterval) {
+			nextSampleFrame = (frame + settings.frameInterval - 1) / settings.frameInterval * settings.frameInterval;
+		}
+		if (frame < nextSampleFrame) {
+			return;
+		}
+		nextSampleFrame = (frame / settings.frameInterval + 1) * settings.frameInterval;
+
+		// the ring is full, this only waits for its oldest readback
+		auto &slot = slots[nextSlot];
+		if (slot.fence != nullptr) {
+			collectOldest(true);
+		}
+		application.sampleAgents(slot.buffer, settings.firstAgent, settings.agentStride, settings.agentCount);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		slot.frame = frame;
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextSlot = (nextSlot + 1) % static_cast<int>(slots.size());
+	}
+
+	// writes every sample taken, the chunk index and closes the file
+	void finish() {
+		if (!writer.joinable()) {
+			return;
+		}
+		while (collectOldest(true));
+		if (!chunk.frames.empty()) {
+			queueChunk();
+		}
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			stopping = true;
+		}
+		chunkQueued.notify_all();
+		writer.join();
+	}
+};
+
+#endif
@@ -0,0 +1,508 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
+#include <new>
+
+// before windows.h, which would pull in the old winsock
+#include "StreamProtocol.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#include "expected.hpp"
+
+using namespace nonstd;
+
+// connecting waits this long for the peers to start, receiving this long for a message
+constexpr int TRANSPORT_TIMEOUT_SECONDS = 60;
+
+enum class TransportKind {
+	// rings in named shared memory, for processes on one machine
+	SharedMemory,
+	// TCP between machines, or Unix domain sockets on one
+	Socket
+};
+
+// Moves messages between the processes of a distributed run, see SubdomainExchange. Messages from one process
+// to another arrive whole and in the order they were sent. send() only queues a message for the sender thread,
+// so two processes sending to each other before receiving can't block each other, and the caller can get on
+// with its work while the message goes out. Implementations stop the sender in their destructor.
+class Transport {
+private:
+	struct Outgoing {
+		int peer;
+		std::vector<uint8_t> message;
+	};
+
+	std::thread sender;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::deque<Outgoing> outgoing;
+	bool stopping;
+	std::string sendError;
+
+	void sendQueued() {
+		while (true) {
+			Outgoing next;
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				queued.wait(lock, [this]() { return stopping || !outgoing.empty(); });
+				if (outgoing.empty()) {
+					return;
+				}
+				next = std::move(outgoing.front());
+				outgoing.pop_front();
+			}
+			if (!deliver(next.peer, next.message)) {
+				std::lock_guard<std::mutex> lock (mutex);
+				sendError = "lost the connection to rank " + std::to_string(next.peer) + "\n";
+				outgoing.clear();
+				return;
+			}
+		}
+	}
+
+protected:
+	int rank;
+
+	// sender thread: writes one whole message to the peer, false when the connection broke
+	virtual bool deliver(int peer, const std::vector<uint8_t>& message) = 0;
+	// reads the next whole message from the peer
+	virtual expected<void, std::string> collect(int peer, std::vector<uint8_t>& message) = 0;
+
+	void startSender() {
+		stopping = false;
+		sender = std::thread(&Transport::sendQueued, this);
+	}
+
+	// sends what is still queued first
+	void stopSender() {
+		if (!sender.joinable()) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			stopping = true;
+		}
+		queued.notify_all();
+		sender.join();
+	}
+
+public:
+	Transport(int rank) {
+		this->rank = rank;
+		stopping = false;
+	}
+
+	virtual ~Transport() {}
+
+	Transport(const Transport&) = delete;
+	Transport& operator=(const Transport&) = delete;
+
+	// waits until every peer is connected
+	virtual expected<void, std::string> connect(const std::vector<int>& peers) = 0;
+
+	void send(int peer, std::vector<uint8_t> message) {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			if (!sendError.empty()) {
+				return;
+			}
+			outgoing.push_back({ peer, std::move(message) });
+		}
+		queued.notify_one();
+	}
+
+	// blocks until the next message from peer has arrived
+	expected<std::vector<uint8_t>, std::string> receive(int peer) {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			if (!sendError.empty()) {
+				return make_unexpected(sendError);
+			}
+		}
+		std::vector<uint8_t> message{};
+		auto result = collect(peer, message);
+		if (!result) {
+			return make_unexpected(result.error());
+		}
+		return message;
+	}
+};
+
+// Each message is its uint32 size followed by its bytes. Rank r listens on addresses[r] and connects to the
+// lower ranks among its peers, sending its rank first, and accepts the higher ones
+class SocketTransport : public Transport {
+private:
+	std::vector<std::string> addresses;
+	std::vector<SocketHandle> sockets;
+
+	bool deliver(int peer, const std::vector<uint8_t>& message) override {
+		uint8_t header[4];
+		writeU32(header, static_cast<uint32_t>(message.size()));
+		return sendAll(sockets[peer], header, sizeof(header)) && sendAll(sockets[peer], message.data(), message.size());
+	}
+
+	expected<void, std::string> collect(int peer, std::vector<uint8_t>& message) override {
+		uint8_t header[4];
+		if (!waitReadable(sockets[peer], TRANSPORT_TIMEOUT_SECONDS * 1000)) {
+			return make_unexpected("no message from rank " + std::to_string(peer) + " in " + std::to_string(TRANSPORT_TIMEOUT_SECONDS) + " s\n");
+		}
+		if (!receiveAll(sockets[peer], header, sizeof(header))) {
+			return make_unexpected("lost the connection to rank " + std::to_string(peer) + "\n");
+		}
+		message.resize(readU32(header));
+		if (!receiveAll(sockets[peer], message.data(), message.size())) {
+			return make_unexpected("lost the connection to rank " + std::to_string(peer) + "\n");
+		}
+		return {};
+	}
+
+	// the peer may not be listening yet
+	expected<SocketHandle, std::string> connectToPeer(int peer) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(TRANSPORT_TIMEOUT_SECONDS);
+		while (true) {
+			auto socket = openSocket(addresses[peer], false);
+			if (socket || std::chrono::steady_clock::now() > deadline) {
+				return socket;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+
+public:
+	// one address per rank, "port", "host:port" or "unix:/path"
+	SocketTransport(int rank, const std::vector<std::string>& addresses) : Transport(rank) {
+		this->addresses = addresses;
+		sockets = std::vector<SocketHandle>(addresses.size(), INVALID_SOCKET);
+	}
+
+	~SocketTransport() {
+		stopSender();
+		for (auto socket : sockets) {
+			if (socket != INVALID_SOCKET) {
+				closeSocket(socket);
+			}
+		}
+	}
+
+	expected<void, std::string> connect(const std::vector<int>& peers) override {
+		if (!initializeSockets()) {
+			return make_unexpected("socket initialization failed\n");
+		}
+		for (auto peer : peers) {
+			if (peer < 0 || peer >= static_cast<int>(addresses.size())) {
+				return make_unexpected("there is no address for rank " + std::to_string(peer) + "\n");
+			}
+		}
+
+		// listening first, so lower ranks can connect while this one connects to the ones below it
+		auto higherPeers = static_cast<int>(std::count_if(peers.begin(), peers.end(), [this](int peer) { return peer > rank; }));
+		auto listenSocket = INVALID_SOCKET;
+		if (higherPeers > 0) {
+			auto socket = openSocket(addresses[rank], true);
+			if (!socket) {
+				return make_unexpected(socket.error());
+			}
+			listenSocket = *socket;
+		}
+
+		for (auto peer : peers) {
+			if (peer > rank) {
+				continue;
+			}
+			auto socket = connectToPeer(peer);
+			if (!socket) {
+				closeSocket(listenSocket);
+				return make_unexpected(socket.error());
+			}
+			uint8_t hello[4];
+			writeU32(hello, rank);
+			sendAll(*socket, hello, sizeof(hello));
+			sockets[peer] = *socket;
+		}
+
+		for (int accepted = 0; accepted < higherPeers; accepted++) {
+			if (!waitReadable(listenSocket, TRANSPORT_TIMEOUT_SECONDS * 1000)) {
+				closeSocket(listenSocket);
+				return make_unexpected("not every rank connected to " + addresses[rank] + "\n");
+			}
+			auto socket = accept(listenSocket, nullptr, nullptr);
+			uint8_t hello[4];
+			if (socket == INVALID_SOCKET || !receiveAll(socket, hello, sizeof(hello)) ||
+					readU32(hello) >= addresses.size() || sockets[readU32(hello)] != INVALID_SOCKET) {
+				closeSocket(listenSocket);
+				return make_unexpected("unexpected connection on " + addresses[rank] + "\n");
+			}
+			int enable = 1;
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+			sockets[readU32(hello)] = socket;
+		}
+		if (listenSocket != INVALID_SOCKET) {
+			closeSocket(listenSocket);
+		}
+
+		startSender();
+		return {};
+	}
+};
+
+constexpr uint32_t MESSAGE_RING_MAGIC = 0x474D5653; // "SVMG"
+constexpr size_t MESSAGE_RING_CAPACITY = 16 << 20;
+
+// byte counters on their own cache lines, the writer only advances written and the reader only read
+struct MessageRingHeader {
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t capacity;
+	alignas(64) std::atomic<uint64_t> written;
+	alignas(64) std::atomic<uint64_t> read;
+};
+
+// Named shared memory mapped read-write, one byte ring per direction between two processes
+class SharedMemoryMapping {
+private:
+	std::string name;
+	bool owner;
+	uint8_t* memory;
+	size_t size;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+
+public:
+	SharedMemoryMapping() {
+		owner = false;
+		memory = nullptr;
+		size = 0;
+#ifdef _WIN32
+		mapping = nullptr;
+#endif
+	}
+
+	~SharedMemoryMapping() {
+		if (memory == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(memory);
+		CloseHandle(mapping);
+#else
+		munmap(memory, size);
+		if (owner) {
+			shm_unlink(name.c_str());
+		}
+#endif
+	}
+
+	SharedMemoryMapping(const SharedMemoryMapping&) = delete;
+	SharedMemoryMapping& operator=(const SharedMemoryMapping&) = delete;
+
+	// opening fails until the owner has created it
+	bool map(const std::string& name, size_t size, bool create) {
+		this->name = name;
+		this->size = size;
+		owner = create;
+#ifdef _WIN32
+		mapping = create
+			? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+				static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), name.c_str())
+			: OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+		if (mapping == nullptr) {
+			return false;
+		}
+		memory = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+		return memory != nullptr;
+#else
+		if (create) {
+			// a ring left behind by a crashed run
+			shm_unlink(name.c_str());
+		}
+		auto fd = shm_open(name.c_str(), create ? O_CREAT | O_RDWR : O_RDWR, 0600);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat status;
+		if ((create && ftruncate(fd, static_cast<off_t>(size)) != 0) || (!create && (fstat(fd, &status) != 0 ||
+				static_cast<size_t>(status.st_size) < size))) {
+			close(fd);
+			return false;
+		}
+		auto address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (address == MAP_FAILED) {
+			return false;
+		}
+		memory = static_cast<uint8_t*>(address);
+		return true;
+#endif
+	}
+
+	uint8_t* getMemory() {
+		return memory;
+	}
+};
+
+// Each message is its uint32 size followed by its bytes, streamed through a ring in shared memory per direction
+// and pair of ranks, named prefix-from-to. The receiving rank creates the rings, senders wait for them to appear.
+// Messages larger than a ring pass through it in pieces
+class SharedMemoryTransport : public Transport {
+private:
+	std::string prefix;
+	std::vector<std::unique_ptr<SharedMemoryMapping>> inbound;
+	std::vector<std::unique_ptr<SharedMemoryMapping>> outbound;
+
+	static MessageRingHeader& getHeader(SharedMemoryMapping& ring) {
+		return *reinterpret_cast<MessageRingHeader*>(ring.getMemory());
+	}
+
+	static uint8_t* getData(SharedMemoryMapping& ring) {
+		return ring.getMemory() + sizeof(MessageRingHeader);
+	}
+
+	std::string getName(int from, int to) {
+		return prefix + "-" + std::to_string(from) + "-" + std::to_string(to);
+	}
+
+	// spins briefly for the low latency of neighbours in lockstep, then sleeps; false on timeout
+	template <typename Ready>
+	bool waitFor(Ready ready) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(TRANSPORT_TIMEOUT_SECONDS);
+		for (int spin = 0; !ready(); spin++) {
+			if (spin < 1000) {
+				std::this_thread::yield();
+				continue;
+			}
+			if (std::chrono::steady_clock::now() > deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return true;
+	}
+
+	bool write(SharedMemoryMapping& ring, const uint8_t* data, size_t size) {
+		auto &header = getHeader(ring);
+		auto written = header.written.load(std::memory_order_relaxed);
+		while (size > 0) {
+			uint64_t read = 0;
+			if (!waitFor([&]() { read = header.read.load(std::memory_order_acquire); return written - read < header.capacity; })) {
+				return false;
+			}
+			auto offset = written % header.capacity;
+			auto bytes = std::min<uint64_t>({ size, header.capacity - (written - read), header.capacity - offset });
+			memcpy(getData(ring) + offset, data, bytes);
+			written += bytes;
+			header.written.store(written, std::memory_order_release);
+			data += bytes;
+			size -= bytes;
+		}
+		return true;
+	}
+
+	bool read(SharedMemoryMapping& ring, uint8_t* data, size_t size) {
+		auto &header = getHeader(ring);
+		auto read = header.read.load(std::memory_order_relaxed);
+		while (size > 0) {
+			uint64_t written = 0;
+			if (!waitFor([&]() { written = header.written.load(std::memory_order_acquire); return written > read; })) {
+				return false;
+			}
+			auto offset = read % header.capacity;
+			auto bytes = std::min<uint64_t>({ size, written - read, header.capacity - offset });
+			memcpy(data, getData(ring) + offset, bytes);
+			read += bytes;
+			header.read.store(read, std::memory_order_release);
+			data += bytes;
+			size -= bytes;
+		}
+		return true;
+	}
+
+	bool deliver(int peer, const std::vector<uint8_t>& message) override {
+		uint8_t header[4];
+		writeU32(header, static_cast<uint32_t>(message.size()));
+		return write(*outbound[peer], header, sizeof(header)) && write(*outbound[peer], message.data(), message.size());
+	}
+
+	expected<void, std::string> collect(int peer, std::vector<uint8_t>& message) override {
+		uint8_t header[4];
+		if (!read(*inbound[peer], header, sizeof(header))) {
+			return make_unexpected("no message from rank " + std::to_string(peer) + " in " + std::to_string(TRANSPORT_TIMEOUT_SECONDS) + " s\n");
+		}
+		message.resize(readU32(header));
+		if (!read(*inbound[peer], message.data(), message.size())) {
+			return make_unexpected("rank " + std::to_string(peer) + " stopped in the middle of a message\n");
+		}
+		return {};
+	}
+
+public:
+	// prefix is "/name" for shm_open, on Windows a mapping name like "Local\name"
+	SharedMemoryTransport(int rank, int rankCount, const std::string& prefix) : Transport(rank) {
+		this->prefix = prefix;
+		inbound.resize(rankCount);
+		outbound.resize(rankCount);
+	}
+
+	~SharedMemoryTransport() {
+		stopSender();
+	}
+
+	expected<void, std::string> connect(const std::vector<int>& peers) override {
+		auto size = sizeof(MessageRingHeader) + MESSAGE_RING_CAPACITY;
+		for (auto peer : peers) {
+			if (peer < 0 || peer >= static_cast<int>(inbound.size())) {
+				return make_unexpected("rank " + std::to_string(peer) + " is not part of the run\n");
+			}
+			inbound[peer] = std::make_unique<SharedMemoryMapping>();
+			if (!inbound[peer]->map(getName(peer, rank), size, true)) {
+				return make_unexpected("failed to create shared memory " + getName(peer, rank) + "\n");
+			}
+			auto header = new (inbound[peer]->getMemory()) MessageRingHeader{};
+			header->capacity = MESSAGE_RING_CAPACITY;
+			header->written.store(0);
+			header->read.store(0);
+			// senders check the magic last
+			std::atomic_thread_fence(std::memory_order_release);
+			header->magic = MESSAGE_RING_MAGIC;
+		}
+
+		for (auto peer : peers) {
+			outbound[peer] = std::make_unique<SharedMemoryMapping>();
+			auto ready = waitFor([&]() {
+				if (outbound[peer]->getMemory() == nullptr && !outbound[peer]->map(getName(rank, peer), size, false)) {
+					return false;
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return getHeader(*outbound[peer]).magic == MESSAGE_RING_MAGIC;
+			});
+			if (!ready) {
+				return make_unexpected("rank " + std::to_string(peer) + " didn't create " + getName(rank, peer) + "\n");
+			}
+		}
+
+		startSender();
+		return {};
+	}
+};
+
+#endif
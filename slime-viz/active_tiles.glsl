@@ -0,0 +1,46 @@
+// Active tile tracking shared by the update passes, diffuse.comp, copy.comp and compact_tiles.comp,
+// see DiffuseMode::ActiveTiles. The including shader declares the width and height uniforms.
+
+// a flag per ACTIVE_TILE_SIZE tile for each of two steps: set by deposits and by diffuse output that isn't
+// zero, read by the compaction of the following step. activityParity picks the current step's half
+layout (std430, binding = 12) buffer TileActivitySSBO {
+	uint tileActivity[];
+};
+
+// indirect dispatch arguments for one work group per listed tile, followed by the listed tiles
+layout (std430, binding = 13) buffer TileListSSBO {
+	uint listedTileCount;
+	uint listGroupsY;
+	uint listGroupsZ;
+	uint listedTiles[];
+};
+
+uniform uint activeTileCount;
+uniform uint activityParity;
+
+int getActiveTilesX() {
+	return (width + ACTIVE_TILE_SIZE - 1) / ACTIVE_TILE_SIZE;
+}
+
+int getActiveTilesY() {
+	return (height + ACTIVE_TILE_SIZE - 1) / ACTIVE_TILE_SIZE;
+}
+
+uint getCurrentActivity() {
+	return activityParity * activeTileCount;
+}
+
+uint getNextActivity() {
+	return (1u - activityParity) * activeTileCount;
+}
+
+uint activeTileIndex(ivec2 texel) {
+	ivec2 tile = texel / ACTIVE_TILE_SIZE;
+	return uint(tile.x + tile.y * getActiveTilesX());
+}
+
+// first texel of a listed tile
+ivec2 listedTileOrigin(uint slot) {
+	uint tile = listedTiles[slot];
+	return ivec2(tile % uint(getActiveTilesX()), tile / uint(getActiveTilesX())) * ACTIVE_TILE_SIZE;
+}
@@ -0,0 +1,105 @@
+// Agent steering and deposit shared by update.comp and update_tiles.comp.
+// The including shader includes trail.glsl and parameters.glsl, declares the time uniform and
+// float sampleTrail(ivec2 texel), which returns the summed trail channels at a texel.
+// With ACTIVE_TILES it includes active_tiles.glsl as well.
+
+// Hash function www.cs.ubc.ca/~rbridson/docs/schechter-sca08-turbulence.pdf
+uint hash(uint state) {
+    state ^= 2747636419u;
+    state *= 2654435769u;
+    state ^= state >> 16;
+    state *= 2654435769u;
+    state ^= state >> 16;
+    state *= 2654435769u;
+    return state;
+}
+
+float scaleToRange01(uint state) {
+    return float(state) / 4294967295.0;
+}
+
+float sense(Agent agent, float sensorAngleOffset) {
+    MemberParameters parameters = getMemberParameters();
+    int sensorSize = 1;
+    float sensorAngle = agent.angle + sensorAngleOffset;
+    vec2 sensorDir = vec2(cos(sensorAngle), sin(sensorAngle));
+
+    vec2 sensorPos = agent.position + sensorDir * parameters.sensorDistance;
+    int sensorCenterX = int(sensorPos.x);
+    int sensorCenterY = int(sensorPos.y);
+
+    float sum = 0;
+
+    for (int offsetX = -sensorSize; offsetX <= sensorSize; offsetX++) {
+        for (int offsetY = -sensorSize; offsetY <= sensorSize; offsetY++) {
+            int sampleX = min(width - 1, max(0, sensorCenterX + offsetX));
+            int sampleY = min(height - 1, max(0, sensorCenterY + offsetY));
+            sum += sampleTrail(ivec2(sampleX, sampleY));
+        }
+    }
+
+    return sum;
+}
+
+void deposit(ivec2 texel) {
+#ifdef SUBGROUP_DEPOSIT
+    // agents crowd into the same few trails, so lanes of a subgroup often hit the same texel.
+    // each pass of the loop picks the first remaining lane's texel and lets a single lane write it
+    uint key = uint(texel.x) + uint(texel.y) * uint(width);
+    bool pending = true;
+    while (pending) {
+        if (key == subgroupBroadcastFirst(key)) {
+            if (subgroupElect()) {
+                storeTrail(texel, vec4(1.0, 1.0, 0.0, 1.0));
+            }
+            pending = false;
+        }
+    }
+#else
+    storeTrail(texel, vec4(1.0, 1.0, 0.0, 1.0));
+#endif
+}
+
+Agent updateAgent(Agent agent, uint ID) {
+#ifdef AGENT_IDS
+    // agents move between the buffers of subdomains, see SubdomainExchange
+    ID = agent.id;
+#endif
+    uint random = hash(time * 100000 + uint(agent.position.x + agent.position.y * width) + ID);
+
+    MemberParameters parameters = getMemberParameters();
+    float sensorAngleRad = parameters.sensorAngle * (PI / 180.0);
+    float weightForward = sense(agent, 0);
+    float weightLeft = sense(agent, sensorAngleRad);
+    float weightRight = sense(agent, -sensorAngleRad);
+
+    float randomSteerStrength = scaleToRange01(random);
+    float turnSpeed = parameters.turnSpeed * 2.0 * PI;
+
+    if (weightForward < weightLeft && weightForward < weightRight) {
+        agent.angle += (randomSteerStrength - 0.5) * 2.0 * turnSpeed;
+    }
+    else if (weightRight > weightLeft) {
+        agent.angle -= randomSteerStrength * turnSpeed;
+    }
+    else if (weightLeft > weightRight) {
+        agent.angle += randomSteerStrength * turnSpeed;
+    }
+
+    vec2 direction = vec2(cos(agent.angle), sin(agent.angle)) * parameters.moveSpeed;
+
+    if (moveAgent(agent, direction)) {
+        agent.angle = scaleToRange01(random) * PI * 2;
+    }
+
+#ifndef POINT_DEPOSIT
+    deposit(agentTexel(agent));
+#endif
+#ifdef ACTIVE_TILES
+    // the deposit, whichever pass makes it, lands in this tile
+    tileActivity[getCurrentActivity() + activeTileIndex(agentTexel(agent))] = 1u;
+#endif
+
+    return agent;
+}
+
@@ -0,0 +1,160 @@
+// Agent storage shared by every shader that touches agents.
+// The including shader declares the width and height uniforms.
+
+const float PI = 3.1415926535897932384626433832795;
+const float PI_2 = 1.57079632679489661923;
+
+struct Agent {
+	vec2 position;
+    float angle;
+    // the agent's index in the whole run, which with AGENT_IDS seeds its steering instead of its index in the
+    // buffer. Fills the padding of the struct, so the packed layout has no room for it
+    uint id;
+#ifdef FIXED_POINT_AGENTS
+    // the stored position, which position is rounded from
+    uvec2 fixedPosition;
+#endif
+};
+
+#ifdef PACKED_AGENTS
+// each element holds a pair of agents, see AgentLayout::Packed
+layout (std430, binding = 1) buffer PositionSSBO {
+	uvec2 positions[];
+};
+
+layout (std430, binding = 3) buffer HeadingSSBO {
+	uint headings[];
+};
+
+uint packPosition(vec2 position) {
+    return packUnorm2x16(position / vec2(width, height));
+}
+
+uint packHeading(float angle) {
+    return uint(fract(angle / (2.0 * PI)) * 65536.0) & 0xFFFFu;
+}
+
+Agent unpackAgent(uint packedPosition, uint packedHeading) {
+    Agent agent;
+    agent.position = unpackUnorm2x16(packedPosition) * vec2(width, height);
+    agent.angle = float(packedHeading) / 65536.0 * 2.0 * PI;
+    agent.id = 0u;
+    return agent;
+}
+
+Agent loadAgent(uint index) {
+    uint slot = index & 1u;
+    return unpackAgent(positions[index >> 1][slot], (headings[index >> 1] >> (slot * 16u)) & 0xFFFFu);
+}
+
+// the other agent of the pair may be stored concurrently, so only this agent's half of the heading word is touched
+void storeAgent(uint index, Agent agent) {
+    uint slot = index & 1u;
+    positions[index >> 1][slot] = packPosition(agent.position);
+    atomicAnd(headings[index >> 1], 0xFFFF0000u >> (slot * 16u));
+    atomicOr(headings[index >> 1], packHeading(agent.angle) << (slot * 16u));
+}
+#elif defined(FIXED_POINT_AGENTS)
+// see AgentLayout::FixedPoint
+const float FIXED_POINT_ONE = 65536.0;
+
+struct StoredAgent {
+    uvec2 position;
+    float angle;
+    uint id;
+};
+
+layout (std430, binding = 1) buffer SSBO {
+	StoredAgent agents[];
+};
+
+// whole texels are converted on their own, a float can't hold all 32 bits
+vec2 fixedToFloat(uvec2 position) {
+    return vec2(position >> 16u) + vec2(position & 0xFFFFu) / FIXED_POINT_ONE;
+}
+
+Agent loadAgent(uint index) {
+    StoredAgent stored = agents[index];
+    Agent agent;
+    agent.position = fixedToFloat(stored.position);
+    agent.angle = stored.angle;
+    agent.id = stored.id;
+    agent.fixedPosition = stored.position;
+    return agent;
+}
+
+void storeAgent(uint index, Agent agent) {
+    agents[index].position = agent.fixedPosition;
+    agents[index].angle = agent.angle;
+}
+#else
+struct StoredAgent {
+    vec2 position;
+    float angle;
+    uint id;
+};
+
+layout (std430, binding = 1) buffer SSBO {
+	StoredAgent agents[];
+};
+
+Agent loadAgent(uint index) {
+    StoredAgent stored = agents[index];
+    return Agent(stored.position, stored.angle, stored.id);
+}
+
+void storeAgent(uint index, Agent agent) {
+    agents[index].position = agent.position;
+    agents[index].angle = agent.angle;
+}
+#endif
+
+// the texel the agent is in
+ivec2 agentTexel(Agent agent) {
+#ifdef FIXED_POINT_AGENTS
+    return ivec2(agent.fixedPosition >> 16u);
+#else
+    return ivec2(agent.position);
+#endif
+}
+
+void setAgentPosition(inout Agent agent, vec2 position) {
+    agent.position = position;
+#ifdef FIXED_POINT_AGENTS
+    agent.fixedPosition = (uvec2(position) << 16u) | uvec2(fract(position) * FIXED_POINT_ONE);
+#endif
+}
+
+// Moves the agent by offset texels. Returns whether that took it off the grid, it is then put back on the edge
+bool moveAgent(inout Agent agent, vec2 offset) {
+#ifdef FIXED_POINT_AGENTS
+    // only the offset is rounded, adding it is exact at any grid size
+    ivec2 fixedOffset = ivec2(round(offset * FIXED_POINT_ONE));
+    uvec2 size = uvec2(width, height);
+    bool outside = false;
+    for (int axis = 0; axis < 2; axis++) {
+        uint position = agent.fixedPosition[axis];
+        if (fixedOffset[axis] < 0 && uint(-fixedOffset[axis]) > position) {
+            agent.fixedPosition[axis] = 0u;
+            outside = true;
+        }
+        else if (position + uint(fixedOffset[axis]) >= size[axis] << 16u) {
+            agent.fixedPosition[axis] = (size[axis] - 1u) << 16u;
+            outside = true;
+        }
+        else {
+            agent.fixedPosition[axis] = position + uint(fixedOffset[axis]);
+        }
+    }
+    agent.position = fixedToFloat(agent.fixedPosition);
+    return outside;
+#else
+    agent.position += offset;
+    if (agent.position.x >= width || agent.position.x < 0 || agent.position.y >= height || agent.position.y < 0) {
+        agent.position.x = min(width - 1, max(0, agent.position.x));
+        agent.position.y = min(height - 1, max(0, agent.position.y));
+        return true;
+    }
+    return false;
+#endif
+}
@@ -0,0 +1,6 @@
+#version 430
+out vec4 FragColor;
+
+void main() {
+	FragColor = vec4(1.0, 1.0, 0.0, 1.0);
+}
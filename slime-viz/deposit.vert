@@ -0,0 +1,26 @@
+#version 430
+#ifdef PACKED_AGENTS
+layout (location = 0) in uint aPosition;
+#elif defined(FIXED_POINT_AGENTS)
+layout (location = 0) in uvec2 aPosition;
+#else
+layout (location = 0) in vec2 aPosition;
+#endif
+
+uniform int width;
+uniform int height;
+// the grid texels the framebuffer holds, less than the grid for a subdomain, see trail.glsl
+uniform ivec2 trailOrigin;
+uniform ivec2 trailSize;
+
+void main() {
+	// same texel update.comp would have written with imageStore
+#ifdef PACKED_AGENTS
+	vec2 texelCenter = floor(unpackUnorm2x16(aPosition) * vec2(width, height)) + 0.5;
+#elif defined(FIXED_POINT_AGENTS)
+	vec2 texelCenter = vec2(aPosition >> 16u) + 0.5;
+#else
+	vec2 texelCenter = floor(aPosition) + 0.5;
+#endif
+	gl_Position = vec4((texelCenter - vec2(trailOrigin)) / vec2(trailSize) * 2.0 - 1.0, 0.0, 1.0);
+}
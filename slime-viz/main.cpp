@@ -4,18 +4,611 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <memory>
 
 #include "expected.hpp";
 
 #include "ShaderProgramBuilder.hpp"
 #include "SlimeSimulation.hpp"
+#include "FrameExchange.hpp"
+#include "QualityController.hpp"
+#include "FrameCapture.hpp"
+#include "Checkpointer.hpp"
+#include "Timeline.hpp"
+#include "TrajectoryRecorder.hpp"
+#include "TiledRenderer.hpp"
+#include "SubdomainExchange.hpp"
+#include "BatchRunner.hpp"
 
-constexpr bool WINDOW_RESIZEABLE = false;
+constexpr bool WINDOW_RESIZEABLE = true;
+constexpr int WINDOW_WIDTH = 1000;
+constexpr int WINDOW_HEIGHT = 1000;
+// '[' and ']' halve and double the simulation grid, down to this size
+constexpr int MIN_GRID_SIZE = 64;
+constexpr AgentLayout AGENT_LAYOUT = AgentLayout::Structure;
+constexpr DepositMode DEPOSIT_MODE = DepositMode::ImageStore;
+constexpr UpdateMode UPDATE_MODE = UpdateMode::PerAgent;
+// DiffuseMode::ActiveTiles skips the parts of the grid without trail or agents nearby
+constexpr DiffuseMode DIFFUSE_MODE = DiffuseMode::Full;
+// TrailStorage::Sparse only keeps memory for the parts of the trail map in use, for very large grids
+constexpr TrailStorage TRAIL_STORAGE = TrailStorage::Dense;
+// grids beyond GL_MAX_TEXTURE_SIZE are split into square domains of this many texels (0 keeps one texture), the
+// window and captures then show a downscaled display. Checkpoints, keyframes and trail captures need one texture
+constexpr int DOMAIN_SIZE = 0;
+// runs this many simulations of the grid side by side for parameter studies (0 runs one), each with the whole agent
+// count, see SimulationSettings::ensembleSize. The sensor angle is swept over the members from the first to the
+// second ENSEMBLE_SENSOR_ANGLES in degrees. The window shows the first member, TRAIL_DUMP_PATH gets all of them
+constexpr int ENSEMBLE_SIZE = 0;
+constexpr float ENSEMBLE_SENSOR_ANGLES[2] = { 22.5f, 67.5f };
+// run the simulation on its own thread and GL context, the window shows the newest finished frame
+constexpr bool SIMULATION_THREAD = false;
+// simulation steps recorded per presented frame, the upper limit with ADAPTIVE_QUALITY
+constexpr int STEPS_PER_FRAME = 1;
+// 0 presents uncapped, 1 waits for vsync
+constexpr int SWAP_INTERVAL = 1;
+// lower steps per frame and then the share of updated agents while the GPU time of a frame exceeds the target
+constexpr bool ADAPTIVE_QUALITY = false;
+constexpr float TARGET_FRAME_MILLISECONDS = 16.6f;
+// record every presented frame, from the colormapped display texture or the raw trail texture
+constexpr bool CAPTURE = false;
+constexpr bool CAPTURE_TRAIL = false;
+constexpr CaptureFormat CAPTURE_FORMAT = CaptureFormat::Png;
+// frame number pattern for PNG; a file name for Y4M, "-" streams it to stdout and moves all other output to stderr;
+// the ring name for shared memory, which exports the trail as one float per texel (see slime-viz-consumer);
+// the listening address for streaming to slime-viz-viewer, "port", "host:port" or "unix:/path"
+constexpr const char* CAPTURE_PATH = "frame_%05d.png";
+constexpr int CAPTURE_THREADS = 4;
+// for Y4M, convert the display image to YUV 4:2:0 on the GPU and read back only that
+constexpr bool CAPTURE_GPU_YUV = true;
+// crop rectangle of the GPU conversion in grid pixels (x, y from the top left, width, height), zero size for all of it
+constexpr int CAPTURE_CROP[4] = { 0, 0, 0, 0 };
+// output size of the GPU conversion relative to the crop, rounded down to a multiple of 8x2
+constexpr float CAPTURE_SCALE = 1.0f;
+// F5 saves the simulation state to this file and F9 loads it back
+constexpr const char* SNAPSHOT_PATH = "slime-viz.snapshot";
+// start from the state in SNAPSHOT_PATH instead of randomly placed agents
+constexpr bool RESUME_SNAPSHOT = false;
+// incremental checkpoints appended to this file in the background, one every CHECKPOINT_INTERVAL seconds (0 disables them).
+// Every CHECKPOINT_FULL_INTERVAL records a full one replaces the file
+constexpr const char* CHECKPOINT_PATH = "slime-viz.checkpoint";
+constexpr double CHECKPOINT_INTERVAL = 0.0;
+constexpr int CHECKPOINT_FULL_INTERVAL = 32;
+constexpr int CHECKPOINT_THREADS = 4;
+// start from the newest complete checkpoint in CHECKPOINT_PATH
+constexpr bool RESUME_CHECKPOINT = false;
+// keyframes of the run every KEYFRAME_INTERVAL frames (0 disables them) for seeking: the left and right arrow keys jump
+// SEEK_FRAMES back and forth by restoring the nearest earlier keyframe and simulating forward from it. For the replay to
+// match, keyframes switch to point deposits and ADAPTIVE_QUALITY only changes the steps per frame
+constexpr int KEYFRAME_INTERVAL = 0;
+constexpr size_t KEYFRAME_MEMORY_BUDGET = static_cast<size_t>(1) << 30;
+// keyframes beyond the memory budget go to files named KEYFRAME_PATH plus the frame, which are removed on exit
+constexpr const char* KEYFRAME_PATH = "slime-viz.keyframe.";
+constexpr size_t KEYFRAME_DISK_BUDGET = static_cast<size_t>(8) << 30;
+constexpr int SEEK_FRAMES = 600;
+// every TRAJECTORY_INTERVAL frames (0 disables it) TRAJECTORY_AGENTS agents, every TRAJECTORY_STRIDE-th one,
+// are sampled into a trajectory file, see Trajectory.hpp
+constexpr const char* TRAJECTORY_PATH = "slime-viz.trajectory";
+constexpr int TRAJECTORY_INTERVAL = 0;
+constexpr int TRAJECTORY_AGENTS = 10000;
+constexpr int TRAJECTORY_STRIDE = 100;
+// seed of the random agent placement, 0 takes it from the clock
+constexpr unsigned int RANDOM_SEED = 0;
+// Splits the grid into SUBDOMAINS_X x SUBDOMAINS_Y subdomains, each run by its own process started with its rank
+// (0 .. count - 1) as the only argument, see SubdomainExchange.hpp. Every process needs the same RANDOM_SEED.
+// Checkpoints, keyframes, trajectories, captures, resuming and ADAPTIVE_QUALITY need the whole state in one process
+constexpr int SUBDOMAINS_X = 1;
+constexpr int SUBDOMAINS_Y = 1;
+constexpr TransportKind SUBDOMAIN_TRANSPORT = TransportKind::Socket;
+// for sockets the address of every rank separated by commas, each "port", "host:port" or "unix:/path", or one
+// address with a %i for the rank; for shared memory the name prefix of the rings, "/name" ("Local\\name" on Windows)
+constexpr const char* SUBDOMAIN_ADDRESSES = "unix:/tmp/slime-viz-%i.sock";
+// stop after this many steps, 0 runs until the window is closed
+constexpr int RUN_STEPS = 0;
+// the trail of the whole grid is written to this file when the run ends, as raw RGBA32F texels bottom row first
+// (nullptr disables it). In a distributed run rank 0 gathers and writes it
+constexpr const char* TRAIL_DUMP_PATH = nullptr;
+// runs with a hidden window and presents nothing, for offline renders. Needs RUN_STEPS
+constexpr bool HEADLESS = false;
+// every RENDER_INTERVAL frames (0 disables it) the colormapped trail is rendered at full grid resolution into a
+// tiled, pyramidal image file named by this pattern, {frame} being replaced by the frame, see TiledImage.hpp
+constexpr const char* RENDER_PATH = "render_{frame}.svti";
+constexpr int RENDER_INTERVAL = 0;
+constexpr int RENDER_TILE_SIZE = 256;
 
 using namespace nonstd;
 
-void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
-	glViewport(0, 0, width, height);
+// doublings (positive) or halvings (negative) of the grid requested from the keyboard and not applied yet
+std::atomic<int> gridScaleRequest (0);
+
+enum class SnapshotRequest {
+	None,
+	Save,
+	Load
+};
+
+std::atomic<SnapshotRequest> snapshotRequest (SnapshotRequest::None);
+
+// frames to seek by, requested from the keyboard and not applied yet
+std::atomic<int> seekRequest (0);
+
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	if (action != GLFW_PRESS) {
+		return;
+	}
+	if (key == GLFW_KEY_RIGHT_BRACKET) {
+		gridScaleRequest++;
+	}
+	if (key == GLFW_KEY_LEFT_BRACKET) {
+		gridScaleRequest--;
+	}
+	if (key == GLFW_KEY_F5) {
+		snapshotRequest = SnapshotRequest::Save;
+	}
+	if (key == GLFW_KEY_F9) {
+		snapshotRequest = SnapshotRequest::Load;
+	}
+	if (key == GLFW_KEY_LEFT) {
+		seekRequest -= SEEK_FRAMES;
+	}
+	if (key == GLFW_KEY_RIGHT) {
+		seekRequest += SEEK_FRAMES;
+	}
+}
+
+// runs on the thread that owns the simulation context, returns whether the grid changed
+bool applyGridScaleRequest(ApplicationBase& application) {
+	auto request = gridScaleRequest.exchange(0);
+	if (request == 0) {
+		return false;
+	}
+
+	auto width = application.getGridWidth();
+	auto height = application.getGridHeight();
+	for (; request > 0; request--) {
+		width *= 2;
+		height *= 2;
+	}
+	for (; request < 0 && std::min(width, height) / 2 >= MIN_GRID_SIZE; request++) {
+		width /= 2;
+		height /= 2;
+	}
+
+	auto result = application.resizeGrid(width, height);
+	if (!result) {
+		printf(result.error().c_str());
+		return false;
+	}
+	printf("grid resized to %ix%i\n", application.getGridWidth(), application.getGridHeight());
+	return true;
+}
+
+expected<int, std::string> loadSnapshot(ApplicationBase& application) {
+	auto startTime = glfwGetTime();
+	auto result = application.loadSnapshot(SNAPSHOT_PATH);
+	if (result) {
+		glFinish();
+		printf("loaded %s (%ix%i) in %.0f ms, continuing at step %i\n", SNAPSHOT_PATH,
+				application.getGridWidth(), application.getGridHeight(), (glfwGetTime() - startTime) * 1000.0, *result);
+	}
+	return result;
+}
+
+// runs on the thread that owns the simulation context, returns the step to continue from
+int applySnapshotRequest(ApplicationBase& application, Timeline* timeline, int step) {
+	auto request = snapshotRequest.exchange(SnapshotRequest::None);
+	if (request == SnapshotRequest::Save) {
+		auto startTime = glfwGetTime();
+		auto result = application.saveSnapshot(SNAPSHOT_PATH, step);
+		if (!result) {
+			printf(result.error().c_str());
+			return step;
+		}
+		printf("saved step %i to %s in %.0f ms\n", step, SNAPSHOT_PATH, (glfwGetTime() - startTime) * 1000.0);
+	}
+	if (request == SnapshotRequest::Load) {
+		auto result = loadSnapshot(application);
+		if (!result) {
+			printf(result.error().c_str());
+			return step;
+		}
+		if (timeline != nullptr) {
+			timeline->discardAfter(-1);
+		}
+		return *result;
+	}
+	return step;
+}
+
+// runs on the thread that owns the simulation context, returns the step to continue from
+int applySeekRequest(Timeline& timeline, ApplicationBase& application, int step) {
+	auto request = seekRequest.exchange(0);
+	if (request == 0) {
+		return step;
+	}
+
+	auto startTime = glfwGetTime();
+	auto result = timeline.seek(application, std::max(0, step + request));
+	if (!result) {
+		printf(result.error().c_str());
+		return step;
+	}
+	glFinish();
+	printf("seeked to step %i in %.0f ms (%i keyframes, %.0f MB in memory, %.0f MB on disk)\n", *result,
+			(glfwGetTime() - startTime) * 1000.0, timeline.getKeyframeCount(), timeline.getKeyframeBytes() / 1048576.0,
+			timeline.getDiskBytes() / 1048576.0);
+	return *result;
+}
+
+// the keyboard requests that change the state, keyframes after a change of course are dropped
+int applyRequests(ApplicationBase& application, Timeline* timeline, int step) {
+	if (applyGridScaleRequest(application) && timeline != nullptr) {
+		timeline->discardAfter(step);
+	}
+	step = applySnapshotRequest(application, timeline, step);
+	if (timeline != nullptr) {
+		step = applySeekRequest(*timeline, application, step);
+	}
+	return step;
+}
+
+expected<int, std::string> restoreCheckpoint(ApplicationBase& application, const CheckpointState& checkpoint) {
+	auto &header = checkpoint.header;
+	auto result = application.setState(header, checkpoint.agents.data(), checkpoint.headings.data(), checkpoint.trail.data());
+	if (!result) {
+		return make_unexpected(CHECKPOINT_PATH + std::string(": ") + result.error());
+	}
+	printf("restored %s from %i records, continuing at step %i\n", CHECKPOINT_PATH, checkpoint.recordCount, static_cast<int>(header.frame));
+	return static_cast<int>(header.frame);
+}
+
+// returns the step to start from, which is the snapshot's or checkpoint's when resuming one
+expected<int, std::string> setupApplication(ApplicationBase& application, const CheckpointState* checkpoint) {
+	application.setupTextures();
+	application.setupSSBO();
+	auto shaderResult = application.setupShaders();
+	if (!shaderResult) {
+		return make_unexpected(shaderResult.error());
+	}
+	if (checkpoint != nullptr) {
+		return restoreCheckpoint(application, *checkpoint);
+	}
+	if (!RESUME_SNAPSHOT) {
+		return 0;
+	}
+	return loadSnapshot(application);
+}
+
+std::vector<MemberParameters> createMemberParameters() {
+	std::vector<MemberParameters> parameters (ENSEMBLE_SIZE);
+	for (int member = 0; member < ENSEMBLE_SIZE; member++) {
+		auto position = ENSEMBLE_SIZE > 1 ? static_cast<float>(member) / (ENSEMBLE_SIZE - 1) : 0.0f;
+		parameters[member].sensorAngle = ENSEMBLE_SENSOR_ANGLES[0] + (ENSEMBLE_SENSOR_ANGLES[1] - ENSEMBLE_SENSOR_ANGLES[0]) * position;
+	}
+	return parameters;
+}
+
+std::unique_ptr<Checkpointer> createCheckpointer() {
+	if (CHECKPOINT_INTERVAL <= 0.0) {
+		return nullptr;
+	}
+	CheckpointSettings checkpointSettings;
+	checkpointSettings.path = CHECKPOINT_PATH;
+	checkpointSettings.interval = CHECKPOINT_INTERVAL;
+	checkpointSettings.fullInterval = CHECKPOINT_FULL_INTERVAL;
+	checkpointSettings.threadCount = CHECKPOINT_THREADS;
+	return std::make_unique<Checkpointer>(checkpointSettings);
+}
+
+std::unique_ptr<TrajectoryRecorder> createTrajectoryRecorder() {
+	if (TRAJECTORY_INTERVAL <= 0) {
+		return nullptr;
+	}
+	TrajectorySettings trajectorySettings;
+	trajectorySettings.path = TRAJECTORY_PATH;
+	trajectorySettings.frameInterval = TRAJECTORY_INTERVAL;
+	trajectorySettings.agentCount = TRAJECTORY_AGENTS;
+	trajectorySettings.agentStride = TRAJECTORY_STRIDE;
+	return std::make_unique<TrajectoryRecorder>(trajectorySettings);
+}
+
+std::unique_ptr<TiledRenderer> createTiledRenderer() {
+	if (RENDER_INTERVAL <= 0) {
+		return nullptr;
+	}
+	RenderSettings renderSettings;
+	renderSettings.path = RENDER_PATH;
+	renderSettings.frameInterval = RENDER_INTERVAL;
+	renderSettings.tileSize = RENDER_TILE_SIZE;
+	return std::make_unique<TiledRenderer>(renderSettings);
+}
+
+std::unique_ptr<Timeline> createTimeline() {
+	if (KEYFRAME_INTERVAL <= 0) {
+		return nullptr;
+	}
+	TimelineSettings timelineSettings;
+	timelineSettings.keyframeInterval = KEYFRAME_INTERVAL;
+	timelineSettings.memoryBudget = KEYFRAME_MEMORY_BUDGET;
+	timelineSettings.diskPath = KEYFRAME_PATH;
+	timelineSettings.diskBudget = KEYFRAME_DISK_BUDGET;
+	return std::make_unique<Timeline>(timelineSettings);
+}
+
+std::vector<std::string> getSubdomainAddresses(int rankCount) {
+	std::vector<std::string> addresses{};
+	if (std::string(SUBDOMAIN_ADDRESSES).find("%i") != std::string::npos) {
+		for (int rank = 0; rank < rankCount; rank++) {
+			char address[256];
+			snprintf(address, sizeof(address), SUBDOMAIN_ADDRESSES, rank);
+			addresses.push_back(address);
+		}
+		return addresses;
+	}
+	std::stringstream stream (SUBDOMAIN_ADDRESSES);
+	std::string address;
+	while (std::getline(stream, address, ',')) {
+		addresses.push_back(address);
+	}
+	return addresses;
+}
+
+std::unique_ptr<Transport> createTransport(int rank) {
+	auto rankCount = SUBDOMAINS_X * SUBDOMAINS_Y;
+	if (SUBDOMAIN_TRANSPORT == TransportKind::SharedMemory) {
+		return std::make_unique<SharedMemoryTransport>(rank, rankCount, SUBDOMAIN_ADDRESSES);
+	}
+	return std::make_unique<SocketTransport>(rank, getSubdomainAddresses(rankCount));
+}
+
+bool writeTrail(const std::string& path, const std::vector<float>& trail) {
+	std::ofstream file (path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(trail.data()), trail.size() * sizeof(float));
+	if (!file) {
+		fprintf(stderr, "writing %s failed\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// when the run ends, on the thread that owns the simulation context. Every process of a distributed run takes part
+void dumpTrail(ApplicationBase& application) {
+	if (TRAIL_DUMP_PATH == nullptr) {
+		return;
+	}
+	auto trail = application.gatherTrail();
+	if (!trail.empty()) {
+		writeTrail(TRAIL_DUMP_PATH, trail);
+	}
+}
+
+// whether the loop ends after step, printing why a distributed run can't go on
+bool isRunOver(SubdomainExchange* exchange, int step) {
+	if (exchange != nullptr && exchange->hasFailed()) {
+		fprintf(stderr, "subdomain %i: %s", exchange->getRank(), exchange->getError().c_str());
+		return true;
+	}
+	return RUN_STEPS > 0 && step >= RUN_STEPS;
+}
+
+// draws the grid as large as fits into the window without distorting it
+void present(GLFWwindow* window, unsigned int shaderProgram, unsigned int VAO, unsigned int texture, int gridWidth, int gridHeight) {
+	int windowWidth, windowHeight;
+	glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+	glViewport(0, 0, windowWidth, windowHeight);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	auto scale = std::min(static_cast<float>(windowWidth) / gridWidth, static_cast<float>(windowHeight) / gridHeight);
+	auto viewportWidth = static_cast<int>(gridWidth * scale);
+	auto viewportHeight = static_cast<int>(gridHeight * scale);
+	glViewport((windowWidth - viewportWidth) / 2, (windowHeight - viewportHeight) / 2, viewportWidth, viewportHeight);
+
+	glUseProgram(shaderProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindVertexArray(VAO);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+
+// shows the simulation rate in the window title once per second
+void reportThroughput(GLFWwindow* window, double& lastReportTime, int& lastReportStep, int step) {
+	auto now = glfwGetTime();
+	if (now - lastReportTime < 1.0) {
+		return;
+	}
+
+	char title[128];
+	snprintf(title, sizeof(title), "slime-viz - %.0f steps/s", (step - lastReportStep) / (now - lastReportTime));
+	glfwSetWindowTitle(window, title);
+
+	lastReportTime = now;
+	lastReportStep = step;
+}
+
+std::unique_ptr<FrameCapture> createFrameCapture(ApplicationBase& application) {
+	if (!CAPTURE) {
+		return nullptr;
+	}
+	CaptureSettings captureSettings;
+	captureSettings.format = CAPTURE_FORMAT;
+	captureSettings.path = CAPTURE_PATH;
+	captureSettings.threadCount = CAPTURE_THREADS;
+	// room for one doubling of the grid at 4 bytes per texel
+	captureSettings.sharedSlotCapacity = static_cast<size_t>(application.getGridWidth()) * application.getGridHeight() * 4 * 4;
+	return std::make_unique<FrameCapture>(captureSettings);
+}
+
+// after run(), on the thread that owns the simulation context
+void captureFrame(FrameCapture* frameCapture, ApplicationBase& application) {
+	if (frameCapture == nullptr) {
+		return;
+	}
+
+	auto gridWidth = application.getGridWidth();
+	auto gridHeight = application.getGridHeight();
+	if (CAPTURE_FORMAT == CaptureFormat::Y4m && CAPTURE_GPU_YUV && !CAPTURE_TRAIL) {
+		auto cropX = std::min(CAPTURE_CROP[0], gridWidth - 1);
+		auto cropY = std::min(CAPTURE_CROP[1], gridHeight - 1);
+		auto cropWidth = CAPTURE_CROP[2] > 0 ? std::min(CAPTURE_CROP[2], gridWidth - cropX) : gridWidth - cropX;
+		auto cropHeight = CAPTURE_CROP[3] > 0 ? std::min(CAPTURE_CROP[3], gridHeight - cropY) : gridHeight - cropY;
+		auto outputWidth = std::max(8, static_cast<int>(cropWidth * CAPTURE_SCALE) / 8 * 8);
+		auto outputHeight = std::max(2, static_cast<int>(cropHeight * CAPTURE_SCALE) / 2 * 2);
+
+		frameCapture->capture(outputWidth, outputHeight, CapturePixels::Yuv420, [&](unsigned int buffer) {
+			application.convertDisplayToYuv420(buffer, cropX, cropY, cropWidth, cropHeight, outputWidth, outputHeight);
+		});
+		return;
+	}
+
+	if (CAPTURE_FORMAT == CaptureFormat::SharedMemory) {
+		frameCapture->capture(application.getMainTexture(), gridWidth, gridHeight, CapturePixels::R32f);
+		return;
+	}
+
+	if (CAPTURE_TRAIL) {
+		frameCapture->capture(application.getMainTexture(), gridWidth, gridHeight);
+		return;
+	}
+	frameCapture->capture(application.getDisplayTexture(), application.getDisplayWidth(), application.getDisplayHeight());
+}
+
+QualityController createQualityController(ApplicationBase& application) {
+	return QualityController(TARGET_FRAME_MILLISECONDS, STEPS_PER_FRAME,
+		[&application](const QualityLevel& level, float gpuMilliseconds) {
+			application.setAgentFraction(level.agentFraction);
+			printf("quality: %i steps per frame, %.0f%% of agents per step (GPU %.1f ms per frame)\n",
+					level.stepsPerFrame, level.agentFraction * 100.0f, gpuMilliseconds);
+		});
+}
+
+// the mean displayed intensity of the trail and the share of texels with any trail, for comparing batch jobs
+bool writeMetrics(const std::string& path, const std::vector<float>& trail, int frames, double seconds) {
+	double intensitySum = 0.0;
+	size_t covered = 0;
+	auto texels = trail.size() / 4;
+	for (size_t i = 0; i < texels; i++) {
+		auto intensity = std::min(1.0f, std::max({ 0.0f, trail[i * 4], trail[i * 4 + 1], trail[i * 4 + 2] }));
+		intensitySum += intensity;
+		covered += intensity > 0.0f ? 1 : 0;
+	}
+	std::ofstream file (path);
+	file << "{ \"frames\": " << frames << ", \"seconds\": " << seconds << ", \"stepsPerSecond\": " << frames / seconds <<
+			", \"trailMean\": " << intensitySum / std::max<size_t>(1, texels) <<
+			", \"trailCoverage\": " << static_cast<double>(covered) / std::max<size_t>(1, texels) << " }\n";
+	if (!file) {
+		fprintf(stderr, "writing %s failed\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Runs job index of the job file in a hidden window and writes its outputs, the worker side of a BatchRunner.
+// Only the job file decides the run, the constants above don't apply
+int runJob(const std::string& jobFilePath, int index) {
+	// stdout and stderr share the job's log, unbuffered they stay in order
+	setvbuf(stdout, nullptr, _IONBF, 0);
+	auto jobFile = readJobFile(jobFilePath);
+	if (!jobFile) {
+		printf(jobFile.error().c_str());
+		return 1;
+	}
+	if (index < 0 || index >= static_cast<int>(jobFile->jobs.size())) {
+		printf("%s has no job %i\n", jobFilePath.c_str(), index);
+		return 1;
+	}
+	auto &job = jobFile->jobs[index];
+
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	const auto window = glfwCreateWindow(1, 1, "slime-viz job", nullptr, nullptr);
+	if (window == 0) {
+		printf("GLFW init failed\n");
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+		printf("GLAD init failed\n");
+		return 1;
+	}
+
+	SimulationSettings settings;
+	settings.width = job.width;
+	settings.height = job.height;
+	settings.agentCount = job.agentCount;
+	settings.memberParameters = { job.parameters };
+	// the same job file has to give the same outputs
+	settings.reproducible = true;
+	srand(job.seed);
+	SlimeSimulation application = SlimeSimulation(settings);
+	application.setupTextures();
+	application.setupSSBO();
+	auto shaderResult = application.setupShaders();
+	if (!shaderResult) {
+		printf(shaderResult.error().c_str());
+		return 1;
+	}
+
+	std::unique_ptr<TiledRenderer> tiledRenderer;
+	if (!job.outputs.render.empty()) {
+		RenderSettings renderSettings;
+		renderSettings.path = job.outputs.render;
+		renderSettings.frameInterval = job.outputs.renderInterval > 0 ? job.outputs.renderInterval : job.frames;
+		renderSettings.tileSize = job.outputs.renderTileSize;
+		tiledRenderer = std::make_unique<TiledRenderer>(renderSettings);
+		auto renderResult = tiledRenderer->setup();
+		if (!renderResult) {
+			printf(renderResult.error().c_str());
+			return 1;
+		}
+	}
+
+	printf("running %s: %ix%i, %i agents, seed %u, %i frames\n", job.name.c_str(), job.width, job.height, job.agentCount,
+			job.seed, job.frames);
+	auto startTime = glfwGetTime();
+	for (int step = 0; step < job.frames;) {
+		// bounded batches keep the queued GL work small, and end at every frame the renderer takes
+		auto steps = std::min(64, job.frames - step);
+		if (tiledRenderer) {
+			steps = std::min(steps, tiledRenderer->getFramesToNextRender(step));
+		}
+		application.run(step, steps);
+		step += steps;
+		if (tiledRenderer) {
+			tiledRenderer->update(application, step);
+		}
+	}
+	glFinish();
+	auto seconds = glfwGetTime() - startTime;
+	if (tiledRenderer) {
+		tiledRenderer->finish();
+	}
+
+	auto succeeded = true;
+	if (!job.outputs.snapshot.empty()) {
+		auto snapshotResult = application.saveSnapshot(job.outputs.snapshot, job.frames);
+		if (!snapshotResult) {
+			printf(snapshotResult.error().c_str());
+			succeeded = false;
+		}
+	}
+	if (!job.outputs.trail.empty() || !job.outputs.metrics.empty()) {
+		auto trail = application.gatherTrail();
+		if (!job.outputs.trail.empty()) {
+			succeeded &= writeTrail(job.outputs.trail, trail);
+		}
+		if (!job.outputs.metrics.empty()) {
+			succeeded &= writeMetrics(job.outputs.metrics, trail, job.frames, seconds);
+		}
+	}
+	printf("%s took %.2f s\n", job.name.c_str(), seconds);
+
+	glfwTerminate();
+	return succeeded ? 0 : 1;
 }
 
 void processInput(GLFWwindow* window) {
@@ -24,23 +617,131 @@ void processInput(GLFWwindow* window) {
 	}
 }
 
-int main() {
-	srand(static_cast<unsigned>(time(0)));
+int main(int argc, char** argv) {
+	// slime-viz --batch jobs.json runs a job file, see BatchRunner.hpp; its workers are started with --job
+	if (argc > 2 && std::string(argv[1]) == "--batch") {
+		auto jobFile = readJobFile(argv[2]);
+		if (!jobFile) {
+			printf(jobFile.error().c_str());
+			return 1;
+		}
+		BatchRunner runner (getExecutablePath(argv[0]), argv[2], *jobFile);
+		return runner.run() == 0 ? 0 : 1;
+	}
+	if (argc > 3 && std::string(argv[1]) == "--job") {
+		return runJob(argv[2], atoi(argv[3]));
+	}
+
+	srand(RANDOM_SEED != 0 ? RANDOM_SEED : static_cast<unsigned>(time(0)));
 
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_RESIZABLE, (int)WINDOW_RESIZEABLE);
+	glfwWindowHint(GLFW_VISIBLE, HEADLESS ? GLFW_FALSE : GLFW_TRUE);
+	if (HEADLESS && RUN_STEPS <= 0) {
+		printf("a headless run needs RUN_STEPS to end\n");
+		return -1;
+	}
+
+	SimulationSettings settings;
+	settings.agentLayout = AGENT_LAYOUT;
+	settings.depositMode = DEPOSIT_MODE;
+	settings.updateMode = UPDATE_MODE;
+	settings.diffuseMode = DIFFUSE_MODE;
+	settings.trailStorage = TRAIL_STORAGE;
+	settings.domainSize = DOMAIN_SIZE;
+	settings.reproducible = KEYFRAME_INTERVAL > 0;
+	if (DOMAIN_SIZE > 0 && (CHECKPOINT_INTERVAL > 0.0 || RESUME_CHECKPOINT || KEYFRAME_INTERVAL > 0 ||
+			(CAPTURE && (CAPTURE_TRAIL || CAPTURE_FORMAT == CaptureFormat::SharedMemory)))) {
+		printf("checkpoints, keyframes and trail captures don't support grids split into domains\n");
+		return -1;
+	}
+	settings.ensembleSize = ENSEMBLE_SIZE;
+	settings.memberParameters = createMemberParameters();
+	if (ENSEMBLE_SIZE > 0 && (CHECKPOINT_INTERVAL > 0.0 || RESUME_CHECKPOINT || RESUME_SNAPSHOT || KEYFRAME_INTERVAL > 0 ||
+			SUBDOMAINS_X * SUBDOMAINS_Y > 1 || (CAPTURE && (CAPTURE_TRAIL || CAPTURE_FORMAT == CaptureFormat::SharedMemory)))) {
+		printf("checkpoints, snapshots, keyframes, subdomains and trail captures don't support ensembles\n");
+		return -1;
+	}
+	settings.displayBufferCount = SIMULATION_THREAD ? FrameExchange::SLOT_COUNT : 1;
 
-	SlimeSimulation application = SlimeSimulation();
+	auto subdomainCount = SUBDOMAINS_X * SUBDOMAINS_Y;
+	std::unique_ptr<Transport> transport;
+	std::unique_ptr<SubdomainExchange> exchange;
+	if (subdomainCount > 1) {
+		if (CHECKPOINT_INTERVAL > 0.0 || RESUME_CHECKPOINT || RESUME_SNAPSHOT || KEYFRAME_INTERVAL > 0 || TRAJECTORY_INTERVAL > 0 ||
+				RENDER_INTERVAL > 0 || CAPTURE || ADAPTIVE_QUALITY || DOMAIN_SIZE > 0) {
+			printf("checkpoints, snapshots, keyframes, trajectories, renders, captures, adaptive quality and domains don't support subdomains\n");
+			return -1;
+		}
+		if (RANDOM_SEED == 0) {
+			printf("subdomains need a RANDOM_SEED to place the same agents\n");
+			return -1;
+		}
+		auto rank = argc > 1 ? atoi(argv[1]) : -1;
+		if (rank < 0 || rank >= subdomainCount) {
+			printf("pass the rank of the subdomain to run, 0..%i\n", subdomainCount - 1);
+			return -1;
+		}
+		transport = createTransport(rank);
+		exchange = std::make_unique<SubdomainExchange>(*transport,
+				SubdomainGrid(settings.width, settings.height, SUBDOMAINS_X, SUBDOMAINS_Y, SUBDOMAIN_HALO), rank);
+		auto connectResult = exchange->connect();
+		if (!connectResult) {
+			printf(connectResult.error().c_str());
+			return -1;
+		}
+		settings.exchange = exchange.get();
+	}
+	if (RESUME_SNAPSHOT) {
+		// the buffers are created at the snapshot's sizes and filled from it after setup
+		auto snapshotSettings = readSnapshotSettings(SNAPSHOT_PATH, settings);
+		if (!snapshotSettings) {
+			printf(snapshotSettings.error().c_str());
+			return -1;
+		}
+		settings = *snapshotSettings;
+	}
+	std::unique_ptr<CheckpointState> checkpoint;
+	if (RESUME_CHECKPOINT) {
+		// replayed into memory here, uploaded after setup and freed again
+		auto checkpointResult = readCheckpoint(CHECKPOINT_PATH);
+		if (!checkpointResult) {
+			printf(checkpointResult.error().c_str());
+			return -1;
+		}
+		auto checkpointSettings = getStateSettings(checkpointResult->header, settings);
+		if (!checkpointSettings) {
+			printf(checkpointSettings.error().c_str());
+			return -1;
+		}
+		settings = *checkpointSettings;
+		checkpoint = std::make_unique<CheckpointState>(std::move(*checkpointResult));
+	}
+	SlimeSimulation application = SlimeSimulation(settings);
 
-	const auto window = glfwCreateWindow(application.getWindowWidth(), application.getWindowHeight(), "slime-viz", nullptr, nullptr);
+	auto frameCapture = createFrameCapture(application);
+	auto checkpointer = createCheckpointer();
+	auto timeline = createTimeline();
+	auto trajectoryRecorder = createTrajectoryRecorder();
+	auto tiledRenderer = createTiledRenderer();
+	if (frameCapture) {
+		auto outputResult = frameCapture->openOutput();
+		if (!outputResult) {
+			printf(outputResult.error().c_str());
+			return -1;
+		}
+	}
+
+	const auto window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "slime-viz", nullptr, nullptr);
 	if (window == 0) {
 		printf("GLFW init failed\n");
 		return -1;
 	}
 	glfwMakeContextCurrent(window);
+	glfwSwapInterval(SWAP_INTERVAL);
 
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
 		printf("GLAD init failed\n");
@@ -65,10 +766,7 @@ int main() {
 	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &workGroupInv);
 	printf("max local work group invocations %i\n", workGroupInv);
 
-	glViewport(0, 0, application.getWindowWidth(), application.getWindowHeight());
-	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
-
-	application.setupTextures();
+	glfwSetKeyCallback(window, keyCallback);
 
 	float vertices[] = {
 		 1.0f,  1.0f, 0.0f,  1.0f, 1.0f,
@@ -90,8 +788,6 @@ int main() {
 	unsigned int EBO;
 	glGenBuffers(1, &EBO);
 
-	application.setupSSBO();
-
 	glBindVertexArray(VAO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
@@ -126,33 +822,251 @@ int main() {
 		return -1;
 	}
 
-	auto applicationShadersResult = application.setupShaders();
-	if (!applicationShadersResult) {
-		printf(applicationShadersResult.error().c_str());
-		return -1;
-	}
-
 	glUseProgram(*shaderProgram);
 	glUniform1i(glGetUniformLocation(*shaderProgram, "texture0"), 0);
 
-	int frame = 0;
+	// a headless run has no presenting to overlap the simulation with
+	if (SIMULATION_THREAD && !HEADLESS) {
+		// textures, buffers and syncs are shared between the two contexts, everything else is per context
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		const auto simulationWindow = glfwCreateWindow(1, 1, "slime-viz simulation", nullptr, window);
+		if (simulationWindow == 0) {
+			printf("GLFW simulation context creation failed\n");
+			return -1;
+		}
+
+		FrameExchange frameExchange;
+		std::atomic<bool> simulationRunning (true);
+		std::atomic<int> simulationStep (0);
+		expected<int, std::string> simulationResult;
+
+		std::thread simulationThread([&]() {
+			glfwMakeContextCurrent(simulationWindow);
+
+			simulationResult = setupApplication(application, checkpoint.get());
+			checkpoint.reset();
+			if (simulationResult && checkpointer) {
+				auto checkpointResult = checkpointer->setup();
+				if (!checkpointResult) {
+					simulationResult = make_unexpected(checkpointResult.error());
+				}
+			}
+			if (simulationResult && timeline) {
+				auto timelineResult = timeline->setup();
+				if (!timelineResult) {
+					simulationResult = make_unexpected(timelineResult.error());
+				}
+			}
+			if (simulationResult && trajectoryRecorder) {
+				auto trajectoryResult = trajectoryRecorder->setup();
+				if (!trajectoryResult) {
+					simulationResult = make_unexpected(trajectoryResult.error());
+				}
+			}
+			if (simulationResult && tiledRenderer) {
+				auto renderResult = tiledRenderer->setup();
+				if (!renderResult) {
+					simulationResult = make_unexpected(renderResult.error());
+				}
+			}
+			if (!simulationResult) {
+				simulationRunning = false;
+				return;
+			}
+			if (frameCapture) {
+				frameCapture->setup();
+			}
+
+			auto qualityController = createQualityController(application);
+
+			int step = *simulationResult;
+			while (simulationRunning) {
+				step = applyRequests(application, timeline.get(), step);
+				if (timeline) {
+					timeline->update(application, step);
+				}
+				auto steps = ADAPTIVE_QUALITY ? qualityController.getLevel().stepsPerFrame : STEPS_PER_FRAME;
+				// the frame's steps end at the next sample or render rather than running past it
+				if (trajectoryRecorder) {
+					steps = std::min(steps, trajectoryRecorder->getFramesToNextSample(step));
+				}
+				if (tiledRenderer) {
+					steps = std::min(steps, tiledRenderer->getFramesToNextRender(step));
+				}
+
+				application.setDisplaySlot(frameExchange.beginWrite());
+				application.run(step, steps);
+				captureFrame(frameCapture.get(), application);
+				frameExchange.publish({ application.getDisplayTexture(), application.getDisplayWidth(), application.getDisplayHeight() });
+
+				if (ADAPTIVE_QUALITY) {
+					qualityController.submit(application.getGpuMilliseconds());
+				}
+
+				step += steps;
+				simulationStep = step;
+				if (checkpointer) {
+					checkpointer->update(application, step);
+				}
+				if (trajectoryRecorder) {
+					trajectoryRecorder->update(application, step);
+				}
+				if (tiledRenderer) {
+					tiledRenderer->update(application, step);
+				}
+				if (isRunOver(exchange.get(), step)) {
+					simulationRunning = false;
+				}
+			}
+			dumpTrail(application);
+			if (frameCapture) {
+				frameCapture->finish();
+			}
+			if (checkpointer) {
+				checkpointer->finish();
+			}
+			if (timeline) {
+				timeline->finish();
+			}
+			if (trajectoryRecorder) {
+				trajectoryRecorder->finish();
+			}
+			if (tiledRenderer) {
+				tiledRenderer->finish();
+			}
+			glFinish();
+		});
+
+		double lastReportTime = glfwGetTime();
+		int lastReportStep = 0;
+
+		while (!glfwWindowShouldClose(window) && simulationRunning) {
+			processInput(window);
+			reportThroughput(window, lastReportTime, lastReportStep, simulationStep);
+
+			auto frame = frameExchange.acquire();
+			if (frame.texture != 0) {
+				present(window, *shaderProgram, VAO, frame.texture, frame.width, frame.height);
+				frameExchange.release();
+			}
+
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
+
+		simulationRunning = false;
+		simulationThread.join();
+		glfwDestroyWindow(simulationWindow);
+
+		if (!simulationResult) {
+			printf(simulationResult.error().c_str());
+			return -1;
+		}
+	}
+	else {
+		auto applicationResult = setupApplication(application, checkpoint.get());
+		checkpoint.reset();
+		if (!applicationResult) {
+			printf(applicationResult.error().c_str());
+			return -1;
+		}
+		if (checkpointer) {
+			auto checkpointResult = checkpointer->setup();
+			if (!checkpointResult) {
+				printf(checkpointResult.error().c_str());
+				return -1;
+			}
+		}
+		if (timeline) {
+			auto timelineResult = timeline->setup();
+			if (!timelineResult) {
+				printf(timelineResult.error().c_str());
+				return -1;
+			}
+		}
+		if (trajectoryRecorder) {
+			auto trajectoryResult = trajectoryRecorder->setup();
+			if (!trajectoryResult) {
+				printf(trajectoryResult.error().c_str());
+				return -1;
+			}
+		}
+		if (tiledRenderer) {
+			auto renderResult = tiledRenderer->setup();
+			if (!renderResult) {
+				printf(renderResult.error().c_str());
+				return -1;
+			}
+		}
+		if (frameCapture) {
+			frameCapture->setup();
+		}
+
+		auto qualityController = createQualityController(application);
+
+		int step = *applicationResult;
+		double lastReportTime = glfwGetTime();
+		int lastReportStep = step;
+
+		while (!glfwWindowShouldClose(window)) {
+			processInput(window);
+			step = applyRequests(application, timeline.get(), step);
+			if (timeline) {
+				timeline->update(application, step);
+			}
+
+			auto steps = ADAPTIVE_QUALITY ? qualityController.getLevel().stepsPerFrame : STEPS_PER_FRAME;
+			if (trajectoryRecorder) {
+				steps = std::min(steps, trajectoryRecorder->getFramesToNextSample(step));
+			}
+			if (tiledRenderer) {
+				steps = std::min(steps, tiledRenderer->getFramesToNextRender(step));
+			}
 
-	while (!glfwWindowShouldClose(window)) {
-		processInput(window);
+			application.run(step, steps);
+			captureFrame(frameCapture.get(), application);
+			if (!HEADLESS) {
+				present(window, *shaderProgram, VAO, application.getDisplayTexture(), application.getDisplayWidth(), application.getDisplayHeight());
+				glfwSwapBuffers(window);
+			}
+			glfwPollEvents();
 
-		application.run(frame);
+			if (ADAPTIVE_QUALITY) {
+				qualityController.submit(application.getGpuMilliseconds());
+			}
 
-		glClear(GL_COLOR_BUFFER_BIT);
-		glUseProgram(*shaderProgram);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, application.getMainTexture());
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+			step += steps;
+			reportThroughput(window, lastReportTime, lastReportStep, step);
+			if (checkpointer) {
+				checkpointer->update(application, step);
+			}
+			if (trajectoryRecorder) {
+				trajectoryRecorder->update(application, step);
+			}
+			if (tiledRenderer) {
+				tiledRenderer->update(application, step);
+			}
+			if (isRunOver(exchange.get(), step)) {
+				break;
+			}
+		}
 
-		frame++;
+		dumpTrail(application);
+		if (frameCapture) {
+			frameCapture->finish();
+		}
+		if (checkpointer) {
+			checkpointer->finish();
+		}
+		if (timeline) {
+			timeline->finish();
+		}
+		if (trajectoryRecorder) {
+			trajectoryRecorder->finish();
+		}
+		if (tiledRenderer) {
+			tiledRenderer->finish();
+		}
 	}
 
 	glDeleteVertexArrays(1, &VAO);
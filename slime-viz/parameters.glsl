@@ -0,0 +1,37 @@
+// Steering and trail parameters shared by the update and diffuse passes, see MemberParameters in
+// SlimeSimulation.hpp. A single simulation uses constants, MEMBER_PARAMETERS when the simulation defines it; with
+// ENSEMBLE every member has its own entry in a uniform buffer, picked by the ensembleMember trail.glsl declares, so
+// the including shader includes trail.glsl first.
+
+struct MemberParameters {
+    // degrees between the forward and the side sensors
+    float sensorAngle;
+    // texels from the agent to its sensors
+    float sensorDistance;
+    // turns per step at full steering
+    float turnSpeed;
+    // texels per step
+    float moveSpeed;
+    // share of the blurred trail mixed into each texel
+    float diffuseWeight;
+    // trail lost per step
+    float decay;
+};
+
+#ifdef ENSEMBLE
+layout (std140, binding = 0) uniform MemberParameterUBO {
+    MemberParameters memberParameters[ENSEMBLE_SIZE];
+};
+
+MemberParameters getMemberParameters() {
+    return memberParameters[ensembleMember];
+}
+#else
+#ifndef MEMBER_PARAMETERS
+#define MEMBER_PARAMETERS 45.0, 5.0, 0.20, 1.0, 0.4, 0.010
+#endif
+
+MemberParameters getMemberParameters() {
+    return MemberParameters(MEMBER_PARAMETERS);
+}
+#endif
@@ -0,0 +1,28 @@
+// Agent tile binning shared by the bin_*.comp passes and update_tiles.comp.
+// The including shader declares the width and height uniforms; TILE_SIZE comes from SlimeSimulation.
+
+layout (std430, binding = 4) buffer TileCountSSBO {
+	uint tileCounts[];
+};
+
+layout (std430, binding = 5) buffer TileOffsetSSBO {
+	uint tileOffsets[];
+};
+
+layout (std430, binding = 6) buffer TileCursorSSBO {
+	uint tileCursors[];
+};
+
+// agent indices sorted by tile, tile i owns [tileOffsets[i], tileOffsets[i] + tileCounts[i])
+layout (std430, binding = 7) buffer SortedAgentSSBO {
+	uint sortedAgents[];
+};
+
+int getTilesX() {
+    return (width + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+uint tileIndex(ivec2 texel) {
+    ivec2 tile = clamp(texel, ivec2(0, 0), ivec2(width - 1, height - 1)) / TILE_SIZE;
+    return uint(tile.x + tile.y * getTilesX());
+}
@@ -0,0 +1,58 @@
+// Trail image access shared by the passes that read or write the trail: the trail image at binding 0 and
+// the processed image diffuse writes at binding 2, both addressed by grid texel. With TRAIL_DOMAINS the
+// grid is split into squares of TRAIL_DOMAIN_SIZE texels, the layers of array images in row-major order,
+// see SimulationSettings::domainSize. With TRAIL_SUBDOMAIN the images only hold the texels of a subdomain
+// and its halo, from trailOrigin on, see SubdomainExchange. With ENSEMBLE every layer is the whole grid of one
+// ensemble member, the one in ensembleMember, which the including shader sets before touching the trail.
+// The including shader declares the width uniform.
+
+#if defined(ENSEMBLE)
+layout (rgba32f, binding = 0) uniform image2DArray trailImage;
+layout (rgba32f, binding = 2) uniform image2DArray processedImage;
+
+int ensembleMember = 0;
+
+ivec3 domainTexel(ivec2 texel) {
+	return ivec3(texel, ensembleMember);
+}
+#elif defined(TRAIL_DOMAINS)
+layout (rgba32f, binding = 0) uniform image2DArray trailImage;
+layout (rgba32f, binding = 2) uniform image2DArray processedImage;
+
+ivec3 domainTexel(ivec2 texel) {
+	ivec2 domain = texel / TRAIL_DOMAIN_SIZE;
+	int domainsX = (width + TRAIL_DOMAIN_SIZE - 1) / TRAIL_DOMAIN_SIZE;
+	return ivec3(texel - domain * TRAIL_DOMAIN_SIZE, domain.x + domain.y * domainsX);
+}
+#else
+layout (rgba32f, binding = 0) uniform image2D trailImage;
+layout (rgba32f, binding = 2) uniform image2D processedImage;
+
+#ifdef TRAIL_SUBDOMAIN
+uniform ivec2 trailOrigin;
+
+ivec2 domainTexel(ivec2 texel) {
+	return texel - trailOrigin;
+}
+#else
+ivec2 domainTexel(ivec2 texel) {
+	return texel;
+}
+#endif
+#endif
+
+vec4 loadTrail(ivec2 texel) {
+	return imageLoad(trailImage, domainTexel(texel));
+}
+
+void storeTrail(ivec2 texel, vec4 value) {
+	imageStore(trailImage, domainTexel(texel), value);
+}
+
+vec4 loadProcessed(ivec2 texel) {
+	return imageLoad(processedImage, domainTexel(texel));
+}
+
+void storeProcessed(ivec2 texel, vec4 value) {
+	imageStore(processedImage, domainTexel(texel), value);
+}